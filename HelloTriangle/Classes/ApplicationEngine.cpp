@@ -50,9 +50,9 @@ private:
 	Animation m_animation;
 };
 
-IApplicationEngine* AppEngineInstance()
+IApplicationEngine* AppEngineInstance(unsigned char renderingFlags)
 {
-	static ApplicationEngine App(ES2::CreateRenderingEngine(),
+	static ApplicationEngine App(ES2::CreateRenderingEngine(renderingFlags),
 								 CreateResourceManager());
 
 	return &App;
@@ -117,12 +117,14 @@ void ApplicationEngine::PopulateVisuals(Visual* visuals) const
 		visuals[visualIndex].LowerLeft.x = buttonIndex * m_buttonSize.x;
 		visuals[visualIndex].LowerLeft.y = 0;
 		visuals[visualIndex].Orientation = Quaternion();
+		visuals[visualIndex].Static = true;
 	}
 
 	visuals[m_currentSurface].Color = m_spinning ? vec3(1,1,1) : vec3(0,1,1);
 	visuals[m_currentSurface].LowerLeft = ivec2(0, 48);
 	visuals[m_currentSurface].ViewportSize = ivec2(320, 432);
 	visuals[m_currentSurface].Orientation = m_orientation;
+	visuals[m_currentSurface].Static = false;
 }
 
 void ApplicationEngine::Render() const
@@ -143,6 +145,7 @@ void ApplicationEngine::Render() const
 			tweened.ViewportSize = start.ViewportSize.Lerp(t, end.
 															ViewportSize);
 			tweened.Orientation = start.Orientation.Slerp(t, end.Orientation);
+			tweened.Static = false;
 		}
 	}
 
@@ -0,0 +1,313 @@
+#include "GLStateCache.hpp"
+#include <EGL/egl.h>
+#include <algorithm>
+#include <string>
+
+namespace ES2 {
+
+// Stands for a program, buffer or texture binding that is not known.
+static const GLuint UnknownName = ~0u;
+
+GLStateCache::GLStateCache() :
+    m_maxAttributes(0),
+    m_genVertexArrays(0),
+    m_bindVertexArray(0),
+    m_deleteVertexArrays(0),
+    m_vertexAttribDivisor(0),
+    m_drawElementsInstanced(0),
+    m_issuedCalls(0),
+    m_elidedCalls(0),
+    m_uniformBytes(0)
+{
+    // Reset would ask GL for the number of attributes, and there may be
+    // no context yet; until then no unknown location is disabled.
+    m_program = m_arrayBuffer = m_texture = UnknownName;
+    m_viewport[0] = m_viewport[1] = 0;
+    m_viewport[2] = m_viewport[3] = -1;
+    m_vertexArray = UnknownName;
+    m_current.ElementArrayBuffer = UnknownName;
+    m_current.EnabledAttributes = m_current.KnownAttributes = 0;
+    m_default = m_current;
+}
+
+void GLStateCache::Reset()
+{
+    m_program = m_arrayBuffer = m_texture = UnknownName;
+    m_viewport[2] = m_viewport[3] = -1;
+    m_vertexArray = UnknownName;
+    m_current.ElementArrayBuffer = UnknownName;
+    m_current.EnabledAttributes = m_current.KnownAttributes = 0;
+    m_default = m_current;
+    m_capabilities.clear();
+    m_uniforms.clear();
+    glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &m_maxAttributes);
+}
+
+bool GLStateCache::Issue(bool changed)
+{
+    if (changed)
+        ++m_issuedCalls;
+    else
+        ++m_elidedCalls;
+    return changed;
+}
+
+void GLStateCache::UseProgram(GLuint program)
+{
+    if (Issue(program != m_program)) {
+        glUseProgram(program);
+        m_program = program;
+    }
+}
+
+void GLStateCache::BindBuffer(GLenum target, GLuint buffer)
+{
+    GLuint& bound = target == GL_ELEMENT_ARRAY_BUFFER ?
+                    m_current.ElementArrayBuffer : m_arrayBuffer;
+    if (Issue(buffer != bound)) {
+        glBindBuffer(target, buffer);
+        bound = buffer;
+    }
+}
+
+void GLStateCache::DeleteBuffer(GLuint buffer)
+{
+    glDeleteBuffers(1, &buffer);
+    ++m_issuedCalls;
+    if (m_arrayBuffer == buffer)
+        m_arrayBuffer = 0;
+    if (m_current.ElementArrayBuffer == buffer)
+        m_current.ElementArrayBuffer = 0;
+    // Other vertex arrays may still hold it, but do not bind it anew.
+    if (m_default.ElementArrayBuffer == buffer)
+        m_default.ElementArrayBuffer = UnknownName;
+}
+
+void GLStateCache::SetVertexAttribArrays(unsigned int locations)
+{
+    unsigned int& enabledAttributes = m_current.EnabledAttributes;
+    unsigned int& knownAttributes = m_current.KnownAttributes;
+    for (GLuint location = 0; location < 32; location++) {
+        unsigned int bit = 1u << location;
+        bool enable = (locations & bit) != 0;
+        bool known = (knownAttributes & bit) != 0;
+        bool enabled = (enabledAttributes & bit) != 0;
+
+        // Locations that are neither wanted nor known to be enabled only
+        // count when they need disabling.
+        if (!enable && (known ? !enabled : (GLint) location >= m_maxAttributes))
+            continue;
+        if (!Issue(!known || enabled != enable))
+            continue;
+
+        if (enable)
+            glEnableVertexAttribArray(location);
+        else
+            glDisableVertexAttribArray(location);
+        knownAttributes |= bit;
+        enabledAttributes = (enabledAttributes & ~bit) | (enable ? bit : 0);
+    }
+}
+
+void GLStateCache::Viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    if (Issue(x != m_viewport[0] || y != m_viewport[1] ||
+              width != m_viewport[2] || height != m_viewport[3])) {
+        glViewport(x, y, width, height);
+        m_viewport[0] = x;
+        m_viewport[1] = y;
+        m_viewport[2] = width;
+        m_viewport[3] = height;
+    }
+}
+
+void GLStateCache::BindTexture(GLuint texture)
+{
+    if (Issue(texture != m_texture)) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        m_texture = texture;
+    }
+}
+
+void GLStateCache::Enable(GLenum capability)
+{
+    SetCapability(capability, true);
+}
+
+void GLStateCache::Disable(GLenum capability)
+{
+    SetCapability(capability, false);
+}
+
+void GLStateCache::SetCapability(GLenum capability, bool enabled)
+{
+    std::map<GLenum, bool>::iterator state = m_capabilities.find(capability);
+    bool changed = state == m_capabilities.end() || state->second != enabled;
+    if (!Issue(changed))
+        return;
+    if (enabled)
+        glEnable(capability);
+    else
+        glDisable(capability);
+    m_capabilities[capability] = enabled;
+}
+
+bool GLStateCache::LoadVertexArrays()
+{
+    m_genVertexArrays = (PFNGLGENVERTEXARRAYSOESPROC)
+        eglGetProcAddress("glGenVertexArraysOES");
+    m_bindVertexArray = (PFNGLBINDVERTEXARRAYOESPROC)
+        eglGetProcAddress("glBindVertexArrayOES");
+    m_deleteVertexArrays = (PFNGLDELETEVERTEXARRAYSOESPROC)
+        eglGetProcAddress("glDeleteVertexArraysOES");
+    return m_genVertexArrays && m_bindVertexArray && m_deleteVertexArrays;
+}
+
+GLuint GLStateCache::CreateVertexArray()
+{
+    GLuint array;
+    m_genVertexArrays(1, &array);
+    ++m_issuedCalls;
+    BindVertexArray(array);
+
+    // A new vertex array starts out with nothing bound or enabled.
+    m_current.ElementArrayBuffer = 0;
+    m_current.EnabledAttributes = 0;
+    m_current.KnownAttributes = ~0u;
+    return array;
+}
+
+void GLStateCache::BindVertexArray(GLuint array)
+{
+    if (!Issue(array != m_vertexArray))
+        return;
+    m_bindVertexArray(array);
+
+    // Leaving the default vertex array keeps its state for coming back;
+    // nothing is known about the others.
+    if (m_vertexArray == 0)
+        m_default = m_current;
+    if (array == 0) {
+        m_current = m_default;
+    } else {
+        m_current.ElementArrayBuffer = UnknownName;
+        m_current.EnabledAttributes = m_current.KnownAttributes = 0;
+    }
+    m_vertexArray = array;
+}
+
+void GLStateCache::DeleteVertexArray(GLuint array)
+{
+    // Deleting the bound vertex array binds the default one.
+    if (array == m_vertexArray)
+        BindVertexArray(0);
+    m_deleteVertexArrays(1, &array);
+    ++m_issuedCalls;
+}
+
+bool GLStateCache::LoadInstancedArrays(const char* suffix)
+{
+    std::string divisor = std::string("glVertexAttribDivisor") + suffix;
+    std::string drawElements = std::string("glDrawElementsInstanced") + suffix;
+    m_vertexAttribDivisor = (PFNGLVERTEXATTRIBDIVISORANGLEPROC)
+        eglGetProcAddress(divisor.c_str());
+    m_drawElementsInstanced = (PFNGLDRAWELEMENTSINSTANCEDANGLEPROC)
+        eglGetProcAddress(drawElements.c_str());
+    return m_vertexAttribDivisor && m_drawElementsInstanced;
+}
+
+void GLStateCache::VertexAttribDivisor(GLuint location, GLuint divisor)
+{
+    m_vertexAttribDivisor(location, divisor);
+    ++m_issuedCalls;
+}
+
+void GLStateCache::DrawElementsInstanced(GLenum mode, GLsizei count,
+                                         GLenum type, const GLvoid* indices,
+                                         GLsizei instanceCount)
+{
+    m_drawElementsInstanced(mode, count, type, indices, instanceCount);
+}
+
+bool GLStateCache::SetUniform(GLint location, const GLfloat* values, int count)
+{
+    if (location < 0)
+        return false;
+
+    // Without a known program there is nothing to compare with.
+    bool changed = true;
+    if (m_program != UnknownName) {
+        std::vector<GLfloat>& shadow =
+            m_uniforms[std::make_pair(m_program, location)];
+        changed = (int) shadow.size() != count ||
+                  !std::equal(values, values + count, shadow.begin());
+        if (changed)
+            shadow.assign(values, values + count);
+    }
+    if (Issue(changed))
+        m_uniformBytes += count * sizeof(GLfloat);
+    return changed;
+}
+
+void GLStateCache::Uniform1f(GLint location, GLfloat x)
+{
+    if (SetUniform(location, &x, 1))
+        glUniform1f(location, x);
+}
+
+void GLStateCache::Uniform2f(GLint location, GLfloat x, GLfloat y)
+{
+    GLfloat values[] = { x, y };
+    if (SetUniform(location, values, 2))
+        glUniform2f(location, x, y);
+}
+
+void GLStateCache::Uniform3f(GLint location, GLfloat x, GLfloat y, GLfloat z)
+{
+    GLfloat values[] = { x, y, z };
+    if (SetUniform(location, values, 3))
+        glUniform3f(location, x, y, z);
+}
+
+void GLStateCache::Uniform4f(GLint location,
+                             GLfloat x, GLfloat y, GLfloat z, GLfloat w)
+{
+    GLfloat values[] = { x, y, z, w };
+    if (SetUniform(location, values, 4))
+        glUniform4f(location, x, y, z, w);
+}
+
+void GLStateCache::Uniform3fv(GLint location, GLsizei count,
+                              const GLfloat* values)
+{
+    if (SetUniform(location, values, count * 3))
+        glUniform3fv(location, count, values);
+}
+
+void GLStateCache::Uniform4fv(GLint location, GLsizei count,
+                              const GLfloat* values)
+{
+    if (SetUniform(location, values, count * 4))
+        glUniform4fv(location, count, values);
+}
+
+void GLStateCache::UniformMatrix3fv(GLint location, const GLfloat* value)
+{
+    if (SetUniform(location, value, 9))
+        glUniformMatrix3fv(location, 1, GL_FALSE, value);
+}
+
+void GLStateCache::UniformMatrix4fv(GLint location, const GLfloat* value)
+{
+    if (SetUniform(location, value, 16))
+        glUniformMatrix4fv(location, 1, GL_FALSE, value);
+}
+
+void GLStateCache::ResetCounters()
+{
+    m_issuedCalls = 0;
+    m_elidedCalls = 0;
+    m_uniformBytes = 0;
+}
+
+}
@@ -0,0 +1,118 @@
+#pragma once
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <map>
+#include <vector>
+
+namespace ES2 {
+
+// Shadows the GL state the rendering engine sets between draws and drops
+// the calls that would leave it as it is. Everything the engine binds or
+// enables has to go through here, or the shadow goes stale.
+class GLStateCache {
+public:
+    GLStateCache();
+
+    // Forgets the shadow, for a context whose state is not known, so the
+    // next call for each piece of state is issued. Needs a current context.
+    void Reset();
+
+    void UseProgram(GLuint program);
+    void BindBuffer(GLenum target, GLuint buffer);
+    // Deletes buffer, which GL also unbinds wherever it is bound.
+    void DeleteBuffer(GLuint buffer);
+    // Enables the vertex attribute arrays whose locations are set in the
+    // bit mask locations, and disables the others.
+    void SetVertexAttribArrays(unsigned int locations);
+    void Viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+    // Binds texture to GL_TEXTURE_2D of the active unit, which is always
+    // the first.
+    void BindTexture(GLuint texture);
+    void Enable(GLenum capability);
+    void Disable(GLenum capability);
+
+    // OES_vertex_array_object, for a context that has the extension;
+    // false when its functions cannot be found. A vertex array holds the
+    // element buffer binding and the attribute arrays, so those are
+    // shadowed for the default one only.
+    bool LoadVertexArrays();
+    // Makes a vertex array and leaves it bound, ready to be recorded.
+    GLuint CreateVertexArray();
+    void BindVertexArray(GLuint array);
+    void DeleteVertexArray(GLuint array);
+
+    // Instanced arrays, from ES 3.0, or from an extension that gives the
+    // functions names ending in suffix; false when they cannot be found.
+    bool LoadInstancedArrays(const char* suffix);
+    void VertexAttribDivisor(GLuint location, GLuint divisor);
+    void DrawElementsInstanced(GLenum mode, GLsizei count, GLenum type,
+                               const GLvoid* indices, GLsizei instanceCount);
+
+    // Uniforms of the program in use. Each program keeps its own values,
+    // so they are shadowed per program; location -1 is ignored.
+    void Uniform1f(GLint location, GLfloat x);
+    void Uniform2f(GLint location, GLfloat x, GLfloat y);
+    void Uniform3f(GLint location, GLfloat x, GLfloat y, GLfloat z);
+    void Uniform4f(GLint location, GLfloat x, GLfloat y, GLfloat z, GLfloat w);
+    // Arrays of count elements, from location on.
+    void Uniform3fv(GLint location, GLsizei count, const GLfloat* values);
+    void Uniform4fv(GLint location, GLsizei count, const GLfloat* values);
+    void UniformMatrix3fv(GLint location, const GLfloat* value);
+    void UniformMatrix4fv(GLint location, const GLfloat* value);
+
+    // Calls passed on to GL, and calls dropped, since ResetCounters.
+    int GetIssuedCalls() const { return m_issuedCalls; }
+    int GetElidedCalls() const { return m_elidedCalls; }
+    // Bytes of uniform values uploaded since ResetCounters.
+    int GetUniformBytes() const { return m_uniformBytes; }
+    void ResetCounters();
+
+private:
+    // The part of the state that belongs to the bound vertex array.
+    struct VertexArrayState {
+        GLuint ElementArrayBuffer;
+        unsigned int EnabledAttributes;
+        unsigned int KnownAttributes;
+    };
+
+    // Counts the call and returns whether it has to be issued.
+    bool Issue(bool changed);
+    void SetCapability(GLenum capability, bool enabled);
+    // Takes the count values of a uniform and returns whether they have
+    // to be uploaded.
+    bool SetUniform(GLint location, const GLfloat* values, int count);
+
+    GLuint m_program;
+    GLuint m_arrayBuffer;
+    GLuint m_texture;
+    // Width and height are -1 while the viewport is unknown.
+    GLint m_viewport[4];
+    GLint m_maxAttributes;
+    GLuint m_vertexArray;
+    VertexArrayState m_current;
+    // The default vertex array's state while another one is bound.
+    VertexArrayState m_default;
+    PFNGLGENVERTEXARRAYSOESPROC m_genVertexArrays;
+    PFNGLBINDVERTEXARRAYOESPROC m_bindVertexArray;
+    PFNGLDELETEVERTEXARRAYSOESPROC m_deleteVertexArrays;
+    // The ANGLE types, which the other names share.
+    PFNGLVERTEXATTRIBDIVISORANGLEPROC m_vertexAttribDivisor;
+    PFNGLDRAWELEMENTSINSTANCEDANGLEPROC m_drawElementsInstanced;
+    // Capabilities missing from the map are unknown.
+    std::map<GLenum, bool> m_capabilities;
+    // Uniform values by program and location, as last uploaded.
+    std::map<std::pair<GLuint, GLint>, std::vector<GLfloat> > m_uniforms;
+
+    int m_issuedCalls;
+    int m_elidedCalls;
+    int m_uniformBytes;
+};
+
+// Bit of a vertex attribute location in the masks above; locations of
+// attributes a program does not have (-1) have none.
+inline unsigned int AttributeBit(GLuint location)
+{
+    return location < 32 ? 1u << location : 0;
+}
+
+}
@@ -27,14 +27,111 @@ enum VertexFlags {
     VertexFlagsTexCoords = 1 << 1,
 };
 
+enum VertexLayout {
+    // Each vertex's position, normal and texture coordinate together.
+    VertexLayoutInterleaved,
+    // All the positions, then all the normals, then all the texture
+    // coordinates.
+    VertexLayoutPlanar,
+};
+
+// Where one attribute lies in a vertex array, in floats: the values of
+// vertex n start at Offset + n * Stride. Size is 0 for an attribute the
+// format leaves out.
+struct VertexAttribute {
+    int Size;
+    int Offset;
+    int Stride;
+};
+
+// The attributes GenerateVertices writes, from VertexFlags, and their
+// layout. Both layouts are tightly packed: a position (3 floats), then
+// only the attributes asked for, a normal (3) and a texture coordinate
+// (2), with no gaps.
+struct VertexFormat {
+    VertexFormat(unsigned char flags = 0,
+                 VertexLayout layout = VertexLayoutInterleaved) :
+        Flags(flags), Layout(layout) {}
+
+    int GetFloatsPerVertex() const
+    {
+        return 3 + GetNormalSize() + GetTexCoordSize();
+    }
+    // Planar offsets depend on how many vertices there are.
+    VertexAttribute GetPosition(int vertexCount) const
+    {
+        return GetAttribute(3, 0, vertexCount);
+    }
+    VertexAttribute GetNormal(int vertexCount) const
+    {
+        return GetAttribute(GetNormalSize(), 3, vertexCount);
+    }
+    VertexAttribute GetTexCoord(int vertexCount) const
+    {
+        return GetAttribute(GetTexCoordSize(), 3 + GetNormalSize(),
+                            vertexCount);
+    }
+
+    unsigned char Flags;
+    VertexLayout Layout;
+
+private:
+    int GetNormalSize() const { return Flags & VertexFlagsNormals ? 3 : 0; }
+    int GetTexCoordSize() const { return Flags & VertexFlagsTexCoords ? 2 : 0; }
+    VertexAttribute GetAttribute(int size, int floatsBefore,
+                                 int vertexCount) const
+    {
+        VertexAttribute attribute;
+        attribute.Size = size;
+        if (Layout == VertexLayoutInterleaved) {
+            attribute.Offset = floatsBefore;
+            attribute.Stride = GetFloatsPerVertex();
+        } else {
+            attribute.Offset = floatsBefore * vertexCount;
+            attribute.Stride = size;
+        }
+        return attribute;
+    }
+};
+
+// A surface's equation in GLSL, for evaluating it in the vertex shader
+// instead of uploading its vertices.
+struct ShaderEquation {
+    // Defines void Evaluate(vec2 domain, out vec3 range, out vec3 dx,
+    // out vec3 dy), the point and its derivatives along domain.x and
+    // domain.y, from the uniform vec4 Parameters and the constants Pi and
+    // TwoPi.
+    const char* Source;
+    vec4 Parameters;
+    // Evaluate gets Grid * UpperBound.
+    vec2 UpperBound;
+    // s, t pairs in [0, 1] for each vertex, in the order GenerateVertices
+    // writes them, so the surface's index lists apply as they are.
+    vector<float> Grid;
+};
+
 struct ISurface {
     virtual int GetVertexCount() const = 0;
     virtual int GetLineIndexCount() const = 0;
 	virtual int GetTriangleIndexCount() const = 0;
-    virtual void GenerateVertices(vector<float>& vertices, unsigned char flags = 0) const = 0;
+	// Bytes per index needed to address every vertex: 2, or 4 for surfaces
+	// with more than 65536 vertices.
+	virtual int GetIndexSize() const = 0;
+    // Resizes vertices to hold exactly the attributes of format.
+    virtual void GenerateVertices(vector<float>& vertices,
+                                  const VertexFormat& format = VertexFormat()) const = 0;
     virtual void GenerateLineIndices(vector<unsigned short>& indices) const = 0;
 	virtual void 
 		GenerateTriangleIndices(vector<unsigned short>& indices) const = 0;
+	virtual void
+		GenerateTriangleIndices(vector<unsigned int>& indices) const = 0;
+	// The same triangles as one strip, with the rows joined by degenerate
+	// triangles; surfaces that are not a grid return 0 and generate none.
+	virtual int GetTriangleStripIndexCount() const = 0;
+	virtual void
+		GenerateTriangleStripIndices(vector<unsigned int>& indices) const = 0;
+	// Returns false for surfaces without a shader equation.
+	virtual bool GetShaderEquation(ShaderEquation& equation) const = 0;
     virtual ~ISurface() {}
 };
 
@@ -43,17 +140,80 @@ struct Visual {
     ivec2 LowerLeft;
     ivec2 ViewportSize;
     Quaternion Orientation;
+    // Set for a visual that looks the same from one frame to the next, so
+    // the rendering engine may draw it once and copy it from then on.
+    bool Static;
+};
+
+// Counters for the work done by the last call to Render, and for the
+// memory it draws from.
+struct RenderStatistics {
+    int DrawCalls;
+    int TrianglesDrawn;
+    // Bytes of triangle indices read by the draw calls.
+    int IndexBytesDrawn;
+    // Bytes held by all the vertex and index buffers, as set up by
+    // Initialize.
+    int VertexBufferBytes;
+    int IndexBufferBytes;
+    // Bytes of index data that matched a live buffer and share it, so
+    // they take no memory of their own.
+    int IndexBytesShared;
+    // Calls that set GL state, such as binding a buffer or enabling a
+    // capability, made by the last frame, and those left out because the
+    // state already was as asked.
+    int StateCallsIssued;
+    int StateCallsElided;
+    // Bytes of uniform values the last frame uploaded; uniforms already
+    // holding the value are not uploaded again.
+    int UniformBytesUploaded;
+    // Static visuals the last frame copied from thumbnails drawn before,
+    // and the thumbnails it had to draw first.
+    int ThumbnailsCopied;
+    int ThumbnailsRendered;
+    // Pixel-lit fragments the copies did not have to shade: the pixels
+    // each thumbnail drawn before this frame covered when it was drawn.
+    // Overdraw is not counted.
+    int FragmentsSaved;
 };
 
 struct IRenderingEngine {
     virtual void Initialize(const vector<ISurface*>& surfaces) = 0;
+    // Replaces the surface at index, as passed to Initialize, with another.
+    // When both have the same topology, as when only their parameters
+    // differ, the new vertices are written into the existing buffers.
+    virtual void UpdateSurface(int index, ISurface* surface) = 0;
     virtual void Render(const vector<Visual>& visuals) const = 0;
+    // Draws the surface at index once for each of the instances, over
+    // what Render drew, and adds to its statistics. The copies share few
+    // draw calls, so one reaching out of its viewport is not cut off.
+    virtual void RenderInstances(int index,
+                                 const vector<Visual>& instances) const = 0;
+    virtual RenderStatistics GetStatistics() const = 0;
     virtual ~IRenderingEngine() {}
 };
 
-IApplicationEngine* AppEngineInstance();
+// The one application engine, made on the first call with an ES2
+// rendering engine of the given RenderingFlags; later calls ignore them.
+IApplicationEngine* AppEngineInstance(unsigned char renderingFlags = 0);
 IResourceManager* CreateResourceManager();
 
 namespace ES1 { IRenderingEngine* CreateRenderingEngine(); }
-namespace ES2 { IRenderingEngine* CreateRenderingEngine(); }
+enum RenderingFlags {
+    // Surfaces with a ShaderEquation are evaluated by the vertex shader
+    // over a grid they share, rather than drawn from vertex buffers.
+    RenderingFlagsShaderSurfaces = 1 << 0,
+    // Sets the attribute arrays up at every draw even where the context
+    // has OES_vertex_array_object, to measure what the extension saves.
+    RenderingFlagsNoVertexArrays = 1 << 1,
+    // Draws grids as triangle lists, or as strips, rather than as
+    // whichever moves fewer bytes, to compare the two.
+    RenderingFlagsTriangleLists = 1 << 2,
+    RenderingFlagsTriangleStrips = 1 << 3,
+    // Draws the copies of RenderInstances in batches from ES 2.0 buffers
+    // even where the context can instance them, to test the fallback.
+    RenderingFlagsNoInstancedArrays = 1 << 4,
+};
+
+namespace ES2 { IRenderingEngine* CreateRenderingEngine(unsigned char flags = 0); }
 
@@ -0,0 +1,94 @@
+#include <stdexcept>
+
+#include "MappedFile.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+MappedFile::MappedFile(const string& path) :
+    m_data(0),
+    m_size(0),
+    m_file(INVALID_HANDLE_VALUE),
+    m_mapping(0)
+{
+    m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0,
+                         OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+    if (m_file == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Could not open file");
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size)) {
+        CloseHandle(m_file);
+        throw std::runtime_error("Could not read file size");
+    }
+    m_size = (size_t) size.QuadPart;
+
+    // An empty file cannot be mapped, but it is still a valid (empty) view.
+    if (m_size == 0)
+        return;
+
+    m_mapping = CreateFileMappingA(m_file, 0, PAGE_READONLY, 0, 0, 0);
+    if (m_mapping)
+        m_data = (const char*) MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+
+    if (!m_data) {
+        if (m_mapping)
+            CloseHandle(m_mapping);
+        CloseHandle(m_file);
+        throw std::runtime_error("Could not map file");
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_data)
+        UnmapViewOfFile(m_data);
+    if (m_mapping)
+        CloseHandle(m_mapping);
+    CloseHandle(m_file);
+}
+
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+MappedFile::MappedFile(const string& path) :
+    m_data(0),
+    m_size(0),
+    m_file(-1)
+{
+    m_file = open(path.c_str(), O_RDONLY);
+    if (m_file < 0)
+        throw std::runtime_error("Could not open file");
+
+    struct stat info;
+    if (fstat(m_file, &info) != 0) {
+        close(m_file);
+        throw std::runtime_error("Could not read file size");
+    }
+    m_size = (size_t) info.st_size;
+
+    // An empty file cannot be mapped, but it is still a valid (empty) view.
+    if (m_size == 0)
+        return;
+
+    void* data = mmap(0, m_size, PROT_READ, MAP_PRIVATE, m_file, 0);
+    if (data == MAP_FAILED) {
+        close(m_file);
+        throw std::runtime_error("Could not map file");
+    }
+    madvise(data, m_size, MADV_SEQUENTIAL);
+    m_data = (const char*) data;
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_data)
+        munmap((void*) m_data, m_size);
+    close(m_file);
+}
+
+#endif
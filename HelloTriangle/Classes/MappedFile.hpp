@@ -0,0 +1,29 @@
+#pragma once
+#include <string>
+#include <cstddef>
+
+using std::string;
+
+// Read-only view of a whole file mapped into memory.
+// The mapping lives as long as the object; Data() is not null-terminated.
+class MappedFile {
+public:
+    MappedFile(const string& path);
+    ~MappedFile();
+
+    const char* Data() const { return m_data; }
+    size_t Size() const { return m_size; }
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    const char* m_data;
+    size_t m_size;
+#ifdef _WIN32
+    void* m_file;
+    void* m_mapping;
+#else
+    int m_file;
+#endif
+};
@@ -0,0 +1,193 @@
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "MeshCache.hpp"
+#include "MappedFile.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+static unsigned int AlignOffset(unsigned int offset)
+{
+    return (offset + MeshFileAlignment - 1) & ~(MeshFileAlignment - 1);
+}
+
+static bool GetFileStamp(const string& path, unsigned long long& size,
+                         long long& time)
+{
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+        return false;
+    size = (unsigned long long) info.st_size;
+    time = (long long) info.st_mtime;
+    return true;
+}
+
+unsigned long long HashBytes(const void* data, size_t size)
+{
+    const unsigned char* bytes = (const unsigned char*) data;
+    unsigned long long hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+string GetMeshCachePath(const string& sourcePath)
+{
+    return sourcePath + ".mesh";
+}
+
+// Checks a mapped cache file against its header and its source.
+static bool IsUsableMeshCache(const MappedFile& cacheFile,
+                              const MeshFileHeader& header,
+                              const string& sourcePath,
+                              unsigned long long sourceSize,
+                              long long sourceTime)
+{
+    if (header.Magic != MeshFileMagic ||
+        header.Version != MeshFileVersion ||
+        header.HeaderSize != sizeof(MeshFileHeader) ||
+        header.VertexFlags != VertexFlagsNormals ||
+        header.FloatsPerVertex != 6 ||
+        header.IndexSize != sizeof(unsigned int) ||
+        header.IndexCount % 3 != 0)
+        return false;
+
+    unsigned long long vertexBytes = (unsigned long long)
+        header.VertexCount * header.FloatsPerVertex * sizeof(float);
+    unsigned long long indexBytes = (unsigned long long)
+        header.IndexCount * header.IndexSize;
+    if (header.VertexOffset < sizeof(header) ||
+        header.VertexOffset % MeshFileAlignment != 0 ||
+        header.IndexOffset % MeshFileAlignment != 0 ||
+        header.VertexOffset + vertexBytes > header.IndexOffset ||
+        header.IndexOffset + indexBytes > cacheFile.Size())
+        return false;
+
+    if (header.SourcePathHash !=
+            HashBytes(sourcePath.data(), sourcePath.size()) ||
+        header.SourceSize != sourceSize)
+        return false;
+
+    // A touched but unchanged source keeps its cache.
+    if (header.SourceTime != sourceTime) {
+        MappedFile sourceFile(sourcePath);
+        if (header.SourceHash !=
+            HashBytes(sourceFile.Data(), sourceFile.Size()))
+            return false;
+    }
+
+    // A damaged index buffer would send reads past the vertices, here and
+    // on the GPU.
+    const unsigned int* indices =
+        (const unsigned int*) (cacheFile.Data() + header.IndexOffset);
+    for (unsigned int i = 0; i < header.IndexCount; i++)
+        if (indices[i] >= header.VertexCount)
+            return false;
+    return true;
+}
+
+MappedFile* MapMeshCache(const string& sourcePath, MeshFileHeader& header)
+{
+    unsigned long long sourceSize;
+    long long sourceTime;
+    if (!GetFileStamp(sourcePath, sourceSize, sourceTime))
+        return 0;
+
+    MappedFile* cacheFile = 0;
+    try {
+        cacheFile = new MappedFile(GetMeshCachePath(sourcePath));
+        if (cacheFile->Size() >= sizeof(MeshFileHeader)) {
+            memcpy(&header, cacheFile->Data(), sizeof(header));
+            if (IsUsableMeshCache(*cacheFile, header, sourcePath,
+                                  sourceSize, sourceTime))
+                return cacheFile;
+        }
+    } catch (const std::exception&) {
+    }
+    delete cacheFile;
+    return 0;
+}
+
+static bool WriteMeshCache(const string& path, const MeshFileHeader& header,
+                           const MeshData& mesh)
+{
+    std::ofstream cacheFile(path.c_str(), std::ios::binary | std::ios::trunc);
+    if (!cacheFile)
+        return false;
+
+    const char padding[MeshFileAlignment] = {};
+    unsigned int vertexEnd = header.VertexOffset +
+        (unsigned int) (mesh.Vertices.size() * sizeof(float));
+
+    cacheFile.write((const char*) &header, sizeof(header));
+    cacheFile.write(padding, header.VertexOffset - sizeof(header));
+    if (!mesh.Vertices.empty())
+        cacheFile.write((const char*) &mesh.Vertices[0],
+                        mesh.Vertices.size() * sizeof(float));
+    cacheFile.write(padding, header.IndexOffset - vertexEnd);
+    if (!mesh.Indices.empty())
+        cacheFile.write((const char*) &mesh.Indices[0],
+                        mesh.Indices.size() * sizeof(unsigned int));
+    cacheFile.close();
+    return !cacheFile.fail();
+}
+
+// Replaces the file at to with the one at from. Mappings of the old file
+// keep its contents. Windows refuses while the old file is mapped, which
+// leaves it in place.
+static bool MoveFileOver(const string& from, const string& to)
+{
+#ifdef _WIN32
+    return MoveFileExA(from.c_str(), to.c_str(),
+                       MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+bool SaveMeshCache(const string& sourcePath, unsigned long long sourceHash,
+                   const MeshData& mesh)
+{
+    MeshFileHeader header;
+    memset(&header, 0, sizeof(header));
+    if (!GetFileStamp(sourcePath, header.SourceSize, header.SourceTime))
+        return false;
+
+    header.Magic = MeshFileMagic;
+    header.Version = MeshFileVersion;
+    header.HeaderSize = sizeof(header);
+    header.VertexFlags = VertexFlagsNormals;
+    header.FloatsPerVertex = 6;
+    header.VertexCount = (unsigned int) mesh.Vertices.size() / 6;
+    header.IndexCount = (unsigned int) mesh.Indices.size();
+    header.IndexSize = sizeof(unsigned int);
+    header.VertexOffset = AlignOffset(sizeof(header));
+    header.IndexOffset = AlignOffset(header.VertexOffset +
+        (unsigned int) (mesh.Vertices.size() * sizeof(float)));
+    memcpy(header.BoundsMin, mesh.BoundsMin.Pointer(), sizeof(float) * 3);
+    memcpy(header.BoundsMax, mesh.BoundsMax.Pointer(), sizeof(float) * 3);
+    header.SourcePathHash = HashBytes(sourcePath.data(), sourcePath.size());
+    header.SourceHash = sourceHash;
+
+    // The cache is written beside the old one and moved over it: another
+    // surface may still have the old one mapped, and truncating a mapped
+    // file pulls the pages from under it.
+    string cachePath = GetMeshCachePath(sourcePath);
+    string writtenPath = cachePath + ".tmp";
+    if (!WriteMeshCache(writtenPath, header, mesh) ||
+        !MoveFileOver(writtenPath, cachePath)) {
+        remove(writtenPath.c_str());
+        return false;
+    }
+    return true;
+}
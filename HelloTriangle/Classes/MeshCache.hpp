@@ -0,0 +1,64 @@
+#pragma once
+#include "Interfaces.hpp"
+
+// Binary ".mesh" container written next to a source model.
+//
+// The file is a MeshFileHeader followed by the vertex stream and the index
+// buffer, both starting on a MeshFileAlignment boundary so that a mapped
+// file can be handed to glBufferData as is. Values are stored in native
+// byte order; the magic number doubles as the byte-order check.
+//
+// A cache file belongs to one source path and is reused as long as the
+// source has the same size and modification time. When only the time
+// changed, the content hash decides.
+
+static const unsigned int MeshFileMagic = 0x4853454D; // "MESH"
+static const unsigned int MeshFileVersion = 1;
+static const unsigned int MeshFileAlignment = 16;
+
+struct MeshFileHeader {
+    unsigned int Magic;
+    unsigned int Version;
+    unsigned int HeaderSize;
+    unsigned int VertexFlags;
+    unsigned int VertexCount;
+    unsigned int FloatsPerVertex;
+    unsigned int IndexCount;
+    unsigned int IndexSize;
+    unsigned int VertexOffset;
+    unsigned int IndexOffset;
+    float BoundsMin[3];
+    float BoundsMax[3];
+    unsigned long long SourcePathHash;
+    unsigned long long SourceSize;
+    long long SourceTime;
+    unsigned long long SourceHash;
+};
+
+class MappedFile;
+
+// The processed form of a model: interleaved positions and normals,
+// triangle indices and the axis-aligned bounds of the positions.
+struct MeshData {
+    vector<float> Vertices;
+    vector<unsigned int> Indices;
+    vec3 BoundsMin;
+    vec3 BoundsMax;
+};
+
+string GetMeshCachePath(const string& sourcePath);
+
+// Maps the cache of sourcePath and fills header from it; null if there is
+// no usable one. The caller owns the mapping, which holds the vertex
+// stream and the index buffer at the offsets in header. Every index is
+// checked to address one of the vertices.
+MappedFile* MapMeshCache(const string& sourcePath, MeshFileHeader& header);
+
+// Writes the cache of sourcePath. sourceHash is HashBytes() of the source
+// file contents. Failures (e.g. a read-only bundle) are not fatal. An old
+// cache is replaced whole, so mappings of it keep what they had.
+bool SaveMeshCache(const string& sourcePath, unsigned long long sourceHash,
+                   const MeshData& mesh);
+
+// 64-bit FNV-1a.
+unsigned long long HashBytes(const void* data, size_t size);
@@ -0,0 +1,542 @@
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+#include "MeshOptimizer.hpp"
+
+float ComputeAcmr(const vector<unsigned int>& indices, int vertexCount,
+                  int cacheSize, VertexCacheModel model)
+{
+    int triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return 0;
+
+    int misses = 0;
+    if (model == VertexCacheFifo) {
+        // A vertex is still cached while fewer than cacheSize misses
+        // happened after the one that brought it in.
+        vector<int> insertedAt(vertexCount, -cacheSize - 1);
+        for (size_t i = 0; i < indices.size(); i++) {
+            unsigned int v = indices[i];
+            if (misses - insertedAt[v] > cacheSize)
+                insertedAt[v] = misses++;
+        }
+    } else {
+        vector<unsigned int> cache;
+        cache.reserve(cacheSize + 1);
+        for (size_t i = 0; i < indices.size(); i++) {
+            unsigned int v = indices[i];
+            vector<unsigned int>::iterator hit =
+                std::find(cache.begin(), cache.end(), v);
+            if (hit == cache.end()) {
+                ++misses;
+                cache.insert(cache.begin(), v);
+                if ((int) cache.size() > cacheSize)
+                    cache.pop_back();
+            } else {
+                std::rotate(cache.begin(), hit, hit + 1);
+            }
+        }
+    }
+
+    return (float) misses / triangleCount;
+}
+
+// Scoring constants from Forsyth's article.
+static const int ScoringCacheSize = 32;
+static const int MaxValence = 32;
+static const float CacheDecayPower = 1.5f;
+static const float LastTriangleScore = 0.75f;
+static const float ValenceBoostScale = 2.0f;
+static const float ValenceBoostPower = 0.5f;
+
+struct ForsythTables {
+    ForsythTables()
+    {
+        for (int i = 0; i < ScoringCacheSize; i++) {
+            if (i < 3) {
+                Cache[i] = LastTriangleScore;
+            } else {
+                float scale = 1.0f / (ScoringCacheSize - 3);
+                Cache[i] = std::pow(1 - (i - 3) * scale, CacheDecayPower);
+            }
+        }
+        Valence[0] = 0;
+        for (int i = 1; i <= MaxValence; i++)
+            Valence[i] = ValenceBoostScale * std::pow((float) i,
+                                                      -ValenceBoostPower);
+    }
+    float Cache[ScoringCacheSize];
+    float Valence[MaxValence + 1];
+};
+
+static float VertexScore(const ForsythTables& tables, int cachePosition,
+                         int liveTriangles)
+{
+    // Vertices without triangles left to draw no longer matter.
+    if (liveTriangles == 0)
+        return -1;
+
+    float score = cachePosition < 0 ? 0 : tables.Cache[cachePosition];
+    return score + tables.Valence[std::min(liveTriangles, MaxValence)];
+}
+
+VertexCacheStatistics OptimizeVertexCache(vector<unsigned int>& indices,
+                                          int vertexCount,
+                                          int cacheSize,
+                                          VertexCacheModel model)
+{
+    static const ForsythTables tables;
+
+    VertexCacheStatistics statistics;
+    statistics.AcmrBefore = ComputeAcmr(indices, vertexCount, cacheSize, model);
+
+    int triangleCount = indices.size() / 3;
+    if (triangleCount == 0) {
+        statistics.AcmrAfter = statistics.AcmrBefore;
+        return statistics;
+    }
+
+    // Triangles using each vertex, as offsets into one shared array.
+    // liveTriangles[v] is the number of entries not yet drawn.
+    vector<int> liveTriangles(vertexCount, 0);
+    for (int i = 0; i < triangleCount * 3; i++)
+        liveTriangles[indices[i]]++;
+
+    vector<int> firstTriangle(vertexCount + 1, 0);
+    for (int v = 0; v < vertexCount; v++)
+        firstTriangle[v + 1] = firstTriangle[v] + liveTriangles[v];
+
+    vector<int> adjacency(triangleCount * 3);
+    vector<int> filled(firstTriangle.begin(), firstTriangle.end() - 1);
+    for (int i = 0; i < triangleCount * 3; i++)
+        adjacency[filled[indices[i]]++] = i / 3;
+
+    vector<int> cachePosition(vertexCount, -1);
+    vector<float> vertexScore(vertexCount);
+    for (int v = 0; v < vertexCount; v++)
+        vertexScore[v] = VertexScore(tables, -1, liveTriangles[v]);
+
+    vector<float> triangleScore(triangleCount);
+    vector<bool> drawn(triangleCount, false);
+    for (int t = 0; t < triangleCount; t++)
+        triangleScore[t] = vertexScore[indices[t * 3]] +
+                           vertexScore[indices[t * 3 + 1]] +
+                           vertexScore[indices[t * 3 + 2]];
+
+    int best = (int) (std::max_element(triangleScore.begin(),
+                                       triangleScore.end()) -
+                      triangleScore.begin());
+
+    vector<unsigned int> optimized;
+    optimized.reserve(indices.size());
+
+    // Room for the scored entries plus the three a new triangle pushes in.
+    vector<int> cache, nextCache;
+    cache.reserve(ScoringCacheSize + 3);
+    nextCache.reserve(ScoringCacheSize + 3);
+
+    int nextUndrawn = 0;
+    for (int drawnCount = 0; drawnCount < triangleCount; drawnCount++) {
+        // Nothing in the cache leads anywhere; restart with any triangle.
+        if (best < 0) {
+            while (drawn[nextUndrawn])
+                ++nextUndrawn;
+            best = nextUndrawn;
+        }
+
+        drawn[best] = true;
+        const unsigned int* triangle = &indices[best * 3];
+        nextCache.clear();
+        for (int k = 0; k < 3; k++) {
+            int v = triangle[k];
+            optimized.push_back(v);
+
+            // Take the triangle out of the vertex's live list.
+            int* begin = &adjacency[firstTriangle[v]];
+            int* end = begin + liveTriangles[v];
+            std::swap(*std::find(begin, end, best), end[-1]);
+            --liveTriangles[v];
+
+            if (std::find(nextCache.begin(), nextCache.end(), v) ==
+                nextCache.end())
+                nextCache.push_back(v);
+        }
+
+        for (size_t i = 0; i < cache.size(); i++)
+            if (std::find(nextCache.begin(), nextCache.end(), cache[i]) ==
+                nextCache.end())
+                nextCache.push_back(cache[i]);
+
+        // Rescore every vertex whose position changed, including the ones
+        // that just fell out, and push the difference to their triangles.
+        for (size_t i = 0; i < nextCache.size(); i++) {
+            int v = nextCache[i];
+            int position = (int) i < ScoringCacheSize ? (int) i : -1;
+            cachePosition[v] = position;
+
+            float score = VertexScore(tables, position, liveTriangles[v]);
+            float delta = score - vertexScore[v];
+            vertexScore[v] = score;
+            for (int j = 0; j < liveTriangles[v]; j++)
+                triangleScore[adjacency[firstTriangle[v] + j]] += delta;
+        }
+
+        if (nextCache.size() > (size_t) ScoringCacheSize)
+            nextCache.resize(ScoringCacheSize);
+        cache.swap(nextCache);
+
+        best = -1;
+        float bestScore = -1;
+        for (size_t i = 0; i < cache.size(); i++) {
+            int v = cache[i];
+            for (int j = 0; j < liveTriangles[v]; j++) {
+                int t = adjacency[firstTriangle[v] + j];
+                if (triangleScore[t] > bestScore) {
+                    bestScore = triangleScore[t];
+                    best = t;
+                }
+            }
+        }
+    }
+
+    indices.swap(optimized);
+    statistics.AcmrAfter = ComputeAcmr(indices, vertexCount, cacheSize, model);
+    return statistics;
+}
+
+VertexFetchStatistics AnalyzeVertexFetch(const vector<unsigned int>& indices,
+                                         int vertexCount, int vertexSize,
+                                         int cacheLineSize, int cacheLines)
+{
+    VertexFetchStatistics statistics = { 0, 0 };
+    int triangleCount = indices.size() / 3;
+    if (triangleCount == 0 || vertexCount == 0)
+        return statistics;
+
+    // Vertices that hit the post-transform cache are not fetched at all;
+    // it is modelled like the FIFO in ComputeAcmr.
+    const int vertexCacheSize = 16;
+    vector<int> insertedAt(vertexCount, -vertexCacheSize - 1);
+    int misses = 0;
+
+    // Most recently used line first.
+    vector<unsigned int> cache;
+    cache.reserve(cacheLines + 1);
+
+    unsigned long long bytesFetched = 0;
+    for (size_t i = 0; i < indices.size(); i++) {
+        if (misses - insertedAt[indices[i]] <= vertexCacheSize)
+            continue;
+        insertedAt[indices[i]] = misses++;
+
+        unsigned int first = indices[i] * vertexSize / cacheLineSize;
+        unsigned int last = (indices[i] * vertexSize + vertexSize - 1) /
+                            cacheLineSize;
+        for (unsigned int line = first; line <= last; line++) {
+            vector<unsigned int>::iterator hit =
+                std::find(cache.begin(), cache.end(), line);
+            if (hit == cache.end()) {
+                bytesFetched += cacheLineSize;
+                cache.insert(cache.begin(), line);
+                if ((int) cache.size() > cacheLines)
+                    cache.pop_back();
+            } else {
+                std::rotate(cache.begin(), hit, hit + 1);
+            }
+        }
+    }
+
+    statistics.BytesPerTriangle = (float) bytesFetched / triangleCount;
+    statistics.Overfetch = (float) bytesFetched /
+                           ((float) vertexCount * vertexSize);
+    return statistics;
+}
+
+void OptimizeVertexFetch(vector<unsigned int>& indices,
+                         vector<float>& vertices, int floatsPerVertex,
+                         vector<unsigned int>& remap)
+{
+    const unsigned int Unused = ~0u;
+    int vertexCount = vertices.size() / floatsPerVertex;
+
+    remap.assign(vertexCount, Unused);
+    unsigned int nextVertex = 0;
+    for (size_t i = 0; i < indices.size(); i++) {
+        unsigned int& target = remap[indices[i]];
+        if (target == Unused)
+            target = nextVertex++;
+        indices[i] = target;
+    }
+    for (int v = 0; v < vertexCount; v++)
+        if (remap[v] == Unused)
+            remap[v] = nextVertex++;
+
+    vector<float> reordered(vertices.size());
+    for (int v = 0; v < vertexCount; v++) {
+        const float* source = &vertices[v * floatsPerVertex];
+        std::copy(source, source + floatsPerVertex,
+                  reordered.begin() + remap[v] * floatsPerVertex);
+    }
+    vertices.swap(reordered);
+}
+
+static vec3 GetPosition(const vector<float>& vertices, int floatsPerVertex,
+                        unsigned int v)
+{
+    const float* position = &vertices[v * floatsPerVertex];
+    return vec3(position[0], position[1], position[2]);
+}
+
+// Twice the signed area of (a, b, p); positive when p is left of a->b.
+static float EdgeFunction(const vec3& a, const vec3& b, float x, float y)
+{
+    return (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x);
+}
+
+// Pixels exactly on an edge belong to the triangle when it is a top or
+// left edge, so pixels on a shared edge are not counted twice.
+static bool IsTopLeft(const vec3& a, const vec3& b)
+{
+    return b.y < a.y || (b.y == a.y && b.x < a.x);
+}
+
+static bool Covers(float w, const vec3& a, const vec3& b)
+{
+    return w > 0 || (w == 0 && IsTopLeft(a, b));
+}
+
+// Rasterizes a triangle with x, y in pixels and depth in z; returns the
+// number of fragments that passed the depth test.
+static unsigned int RasterizeTriangle(vec3 a, vec3 b, vec3 c, int resolution,
+                                      vector<float>& depth)
+{
+    float area = EdgeFunction(a, b, c.x, c.y);
+    if (area == 0)
+        return 0;
+    if (area < 0) {
+        std::swap(b, c);
+        area = -area;
+    }
+
+    int minX = std::max(0, (int) std::floor(std::min(a.x, std::min(b.x, c.x))));
+    int minY = std::max(0, (int) std::floor(std::min(a.y, std::min(b.y, c.y))));
+    int maxX = std::min(resolution - 1,
+                        (int) std::ceil(std::max(a.x, std::max(b.x, c.x))));
+    int maxY = std::min(resolution - 1,
+                        (int) std::ceil(std::max(a.y, std::max(b.y, c.y))));
+
+    unsigned int shaded = 0;
+    for (int y = minY; y <= maxY; y++) {
+        for (int x = minX; x <= maxX; x++) {
+            float px = x + 0.5f;
+            float py = y + 0.5f;
+            float wa = EdgeFunction(b, c, px, py);
+            float wb = EdgeFunction(c, a, px, py);
+            float wc = EdgeFunction(a, b, px, py);
+            if (!Covers(wa, b, c) || !Covers(wb, c, a) || !Covers(wc, a, b))
+                continue;
+
+            float z = (wa * a.z + wb * b.z + wc * c.z) / area;
+            float& stored = depth[y * resolution + x];
+            if (z < stored) {
+                stored = z;
+                ++shaded;
+            }
+        }
+    }
+    return shaded;
+}
+
+OverdrawStatistics AnalyzeOverdraw(const vector<unsigned int>& indices,
+                                   const vector<float>& vertices,
+                                   int floatsPerVertex, int resolution)
+{
+    OverdrawStatistics statistics = { 0, 0, 0 };
+    int vertexCount = vertices.size() / floatsPerVertex;
+    if (indices.size() < 3 || vertexCount == 0)
+        return statistics;
+
+    vec3 boundsMin = GetPosition(vertices, floatsPerVertex, 0);
+    vec3 boundsMax = boundsMin;
+    for (int v = 1; v < vertexCount; v++) {
+        vec3 p = GetPosition(vertices, floatsPerVertex, v);
+        boundsMin = vec3(std::min(boundsMin.x, p.x), std::min(boundsMin.y, p.y),
+                         std::min(boundsMin.z, p.z));
+        boundsMax = vec3(std::max(boundsMax.x, p.x), std::max(boundsMax.y, p.y),
+                         std::max(boundsMax.z, p.z));
+    }
+    vec3 extent = boundsMax - boundsMin;
+    float size = std::max(extent.x, std::max(extent.y, extent.z));
+    if (size == 0)
+        return statistics;
+
+    // One scale for every axis, leaving the last pixel row and column for
+    // the far side of the bounds.
+    float scale = (resolution - 1) / size;
+
+    vector<float> depth(resolution * resolution);
+    for (int view = 0; view < 6; view++) {
+        int axis = view / 2;
+        float direction = view % 2 ? -1.0f : 1.0f;
+        std::fill(depth.begin(), depth.end(), FLT_MAX);
+
+        for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+            vec3 corners[3];
+            for (int k = 0; k < 3; k++) {
+                vec3 p = GetPosition(vertices, floatsPerVertex, indices[i + k]) -
+                         boundsMin;
+                const float* coordinates = p.Pointer();
+                corners[k] = vec3(coordinates[(axis + 1) % 3] * scale,
+                                  coordinates[(axis + 2) % 3] * scale,
+                                  coordinates[axis] * direction);
+            }
+            statistics.PixelsShaded += RasterizeTriangle(corners[0], corners[1],
+                                                         corners[2], resolution,
+                                                         depth);
+        }
+
+        for (size_t i = 0; i < depth.size(); i++)
+            if (depth[i] != FLT_MAX)
+                ++statistics.PixelsCovered;
+    }
+
+    if (statistics.PixelsCovered != 0)
+        statistics.Overdraw = (float) statistics.PixelsShaded /
+                              statistics.PixelsCovered;
+    return statistics;
+}
+
+// Feeds a triangle through the FIFO model of ComputeAcmr and returns how
+// many of its vertices missed. Adding cacheSize + 1 to misses empties it.
+static int SimulateTriangle(const unsigned int* triangle,
+                            vector<int>& insertedAt, int& misses,
+                            int cacheSize)
+{
+    int before = misses;
+    for (int k = 0; k < 3; k++)
+        if (misses - insertedAt[triangle[k]] > cacheSize)
+            insertedAt[triangle[k]] = misses++;
+    return misses - before;
+}
+
+struct TriangleCluster {
+    int Start;
+    int End;
+    float Key;
+};
+
+static bool DrawsBefore(const TriangleCluster& a, const TriangleCluster& b)
+{
+    return a.Key > b.Key;
+}
+
+void OptimizeOverdraw(vector<unsigned int>& indices,
+                      const vector<float>& vertices, int floatsPerVertex,
+                      float threshold)
+{
+    const int cacheSize = 16;
+    int triangleCount = indices.size() / 3;
+    int vertexCount = vertices.size() / floatsPerVertex;
+    if (triangleCount == 0)
+        return;
+
+    // The cache restarts where a triangle misses with all its vertices;
+    // clusters can be moved around freely at those points.
+    vector<int> insertedAt(vertexCount, -cacheSize - 1);
+    int misses = 0;
+    vector<int> hardStarts;
+    for (int t = 0; t < triangleCount; t++)
+        if (SimulateTriangle(&indices[t * 3], insertedAt, misses, cacheSize) == 3)
+            hardStarts.push_back(t);
+    if (hardStarts.empty() || hardStarts[0] != 0)
+        hardStarts.insert(hardStarts.begin(), 0);
+
+    // Cut the runs further wherever the ACMR from the last cut, with a
+    // cold cache, is already close to that of the whole run.
+    vector<TriangleCluster> clusters;
+    for (size_t h = 0; h < hardStarts.size(); h++) {
+        int start = hardStarts[h];
+        int end = h + 1 < hardStarts.size() ? hardStarts[h + 1] : triangleCount;
+
+        misses += cacheSize + 1;
+        int runMisses = 0;
+        for (int t = start; t < end; t++)
+            runMisses += SimulateTriangle(&indices[t * 3], insertedAt, misses,
+                                          cacheSize);
+        float limit = threshold * runMisses / (end - start);
+
+        TriangleCluster cluster = { start, end, 0 };
+        misses += cacheSize + 1;
+        int clusterMisses = 0;
+        for (int t = start; t < end; t++) {
+            clusterMisses += SimulateTriangle(&indices[t * 3], insertedAt,
+                                              misses, cacheSize);
+            if (t + 1 < end &&
+                (float) clusterMisses / (t + 1 - cluster.Start) <= limit) {
+                cluster.End = t + 1;
+                clusters.push_back(cluster);
+                cluster.Start = t + 1;
+                misses += cacheSize + 1;
+                clusterMisses = 0;
+            }
+        }
+        cluster.End = end;
+        clusters.push_back(cluster);
+    }
+
+    // Area weighted centroids and normals of the clusters and the mesh.
+    vector<vec3> centroids(clusters.size(), vec3(0, 0, 0));
+    vector<vec3> normals(clusters.size(), vec3(0, 0, 0));
+    vector<float> areas(clusters.size(), 0);
+    vec3 meshCentroid(0, 0, 0);
+    float meshArea = 0;
+    for (size_t c = 0; c < clusters.size(); c++) {
+        for (int t = clusters[c].Start; t < clusters[c].End; t++) {
+            vec3 a = GetPosition(vertices, floatsPerVertex, indices[t * 3]);
+            vec3 b = GetPosition(vertices, floatsPerVertex, indices[t * 3 + 1]);
+            vec3 d = GetPosition(vertices, floatsPerVertex, indices[t * 3 + 2]);
+            vec3 normal = (b - a).Cross(d - a);
+            float area = std::sqrt(normal.Dot(normal));
+            centroids[c] += (a + b + d) * (area / 3);
+            normals[c] += normal;
+            areas[c] += area;
+        }
+        meshCentroid += centroids[c];
+        meshArea += areas[c];
+    }
+    if (meshArea > 0)
+        meshCentroid /= meshArea;
+
+    for (size_t c = 0; c < clusters.size(); c++) {
+        float length = std::sqrt(normals[c].Dot(normals[c]));
+        if (areas[c] > 0 && length > 0)
+            clusters[c].Key = (centroids[c] / areas[c] - meshCentroid).Dot(
+                                  normals[c] / length);
+    }
+
+    std::stable_sort(clusters.begin(), clusters.end(), DrawsBefore);
+
+    vector<unsigned int> sorted;
+    sorted.reserve(indices.size());
+    for (size_t c = 0; c < clusters.size(); c++)
+        sorted.insert(sorted.end(), indices.begin() + clusters[c].Start * 3,
+                      indices.begin() + clusters[c].End * 3);
+    indices.swap(sorted);
+}
+
+void UnpackTriangleStrip(const vector<unsigned int>& strip,
+                         vector<unsigned int>& triangles)
+{
+    triangles.clear();
+    for (size_t i = 0; i + 2 < strip.size(); i++) {
+        unsigned int a = strip[i], b = strip[i + 1], c = strip[i + 2];
+        if (a == b || b == c || a == c)
+            continue;
+        if (i % 2)
+            std::swap(a, b);
+        triangles.push_back(a);
+        triangles.push_back(b);
+        triangles.push_back(c);
+    }
+}
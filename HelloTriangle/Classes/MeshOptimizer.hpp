@@ -0,0 +1,87 @@
+#pragma once
+#include "Interfaces.hpp"
+
+// Load-time passes over triangle lists. They only reorder data, so a mesh
+// renders the same before and after, just with less work for the GPU.
+
+enum VertexCacheModel {
+    VertexCacheFifo,
+    VertexCacheLru,
+};
+
+// Vertex shader invocations per triangle (ACMR) of a simulated post-
+// transform cache; 3 is the worst case, 0.5 the limit for a large grid.
+float ComputeAcmr(const vector<unsigned int>& indices, int vertexCount,
+                  int cacheSize = 16, VertexCacheModel model = VertexCacheFifo);
+
+struct VertexCacheStatistics {
+    float AcmrBefore;
+    float AcmrAfter;
+};
+
+// Reorders the triangles for the post-transform vertex cache with Tom
+// Forsyth's "Linear-Speed Vertex Cache Optimisation". The ACMR before and
+// after is measured with the given cache simulation.
+VertexCacheStatistics OptimizeVertexCache(vector<unsigned int>& indices,
+                                          int vertexCount,
+                                          int cacheSize = 16,
+                                          VertexCacheModel model = VertexCacheFifo);
+
+struct VertexFetchStatistics {
+    // Vertex memory pulled in through a simulated cache, per triangle.
+    float BytesPerTriangle;
+    // Fetched bytes over the size of the vertex buffer; 1 is ideal.
+    float Overfetch;
+};
+
+// Memory traffic of the vertex fetches of a triangle list: the vertices
+// missing a 16-entry post-transform cache are read through a simulated
+// LRU cache of cacheLines lines of cacheLineSize bytes.
+VertexFetchStatistics AnalyzeVertexFetch(const vector<unsigned int>& indices,
+                                         int vertexCount, int vertexSize,
+                                         int cacheLineSize = 64,
+                                         int cacheLines = 64);
+
+// Renumbers the vertices in the order the triangles first use them and
+// rewrites both the interleaved vertex stream and the indices to match;
+// unused vertices move to the end. remap receives the new index of every
+// old vertex, for other index lists that refer to the same vertices.
+void OptimizeVertexFetch(vector<unsigned int>& indices,
+                         vector<float>& vertices, int floatsPerVertex,
+                         vector<unsigned int>& remap);
+
+struct OverdrawStatistics {
+    // Pixels with at least one fragment, summed over the views.
+    unsigned int PixelsCovered;
+    // Fragments that passed the depth test and were shaded.
+    unsigned int PixelsShaded;
+    // Shaded over covered; 1 means no pixel was shaded twice.
+    float Overdraw;
+};
+
+// Counts overdraw with a software rasterizer: the triangles are drawn in
+// index order, with depth testing and without culling like the renderer,
+// by orthographic cameras looking along the six axis directions at a
+// resolution x resolution target fitted to the mesh. Positions are the
+// first three floats of each vertex.
+OverdrawStatistics AnalyzeOverdraw(const vector<unsigned int>& indices,
+                                   const vector<float>& vertices,
+                                   int floatsPerVertex, int resolution = 256);
+
+// Reorders the triangles to reduce overdraw after OptimizeVertexCache, as
+// in Sander, Nehab and Barczak's "Fast Triangle Reordering for Vertex
+// Locality and Reduced Overdraw": the list is cut into clusters wherever
+// the cache restarts or the ACMR of the cluster so far is within
+// threshold of its whole run, and the clusters facing away from the
+// middle of the mesh, which are the likeliest to occlude the rest, are
+// drawn first. threshold bounds the ACMR given up for it.
+void OptimizeOverdraw(vector<unsigned int>& indices,
+                      const vector<float>& vertices, int floatsPerVertex,
+                      float threshold = 1.05f);
+
+// Expands a triangle strip into the list of triangles GL draws from it,
+// every other one reversed to keep the winding, without the degenerate
+// triangles that join strips together. For measuring strips with the
+// functions above, which all take lists.
+void UnpackTriangleStrip(const vector<unsigned int>& strip,
+                         vector<unsigned int>& triangles);
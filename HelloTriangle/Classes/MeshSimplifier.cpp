@@ -0,0 +1,284 @@
+#include <cmath>
+#include <iterator>
+#include <algorithm>
+
+#include "MeshSimplifier.hpp"
+
+// Sum of squared distances to a set of planes, as the symmetric matrix of
+// Garland and Heckbert, plus the total weight of the planes.
+struct Quadric {
+    double XX, XY, XZ, XW, YY, YZ, YW, ZZ, ZW, WW;
+    double Weight;
+};
+
+static void AddPlane(Quadric& q, const vec3& normal, float distance,
+                     double weight)
+{
+    double a = normal.x, b = normal.y, c = normal.z, d = distance;
+    q.XX += weight * a * a; q.XY += weight * a * b; q.XZ += weight * a * c;
+    q.XW += weight * a * d; q.YY += weight * b * b; q.YZ += weight * b * c;
+    q.YW += weight * b * d; q.ZZ += weight * c * c; q.ZW += weight * c * d;
+    q.WW += weight * d * d;
+    q.Weight += weight;
+}
+
+static void AddQuadric(Quadric& q, const Quadric& r)
+{
+    q.XX += r.XX; q.XY += r.XY; q.XZ += r.XZ; q.XW += r.XW; q.YY += r.YY;
+    q.YZ += r.YZ; q.YW += r.YW; q.ZZ += r.ZZ; q.ZW += r.ZW; q.WW += r.WW;
+    q.Weight += r.Weight;
+}
+
+// Weighted mean squared distance from p to the planes of q.
+static double EvaluateQuadric(const Quadric& q, const vec3& p)
+{
+    double x = p.x, y = p.y, z = p.z;
+    double sum = q.XX * x * x + q.YY * y * y + q.ZZ * z * z + q.WW +
+                 2 * (q.XY * x * y + q.XZ * x * z + q.YZ * y * z +
+                      q.XW * x + q.YW * y + q.ZW * z);
+    return q.Weight > 0 ? std::max(sum, 0.0) / q.Weight : 0;
+}
+
+static vec3 GetPosition(const vector<float>& vertices, int floatsPerVertex,
+                        unsigned int v)
+{
+    const float* position = &vertices[v * floatsPerVertex];
+    return vec3(position[0], position[1], position[2]);
+}
+
+struct Collapse {
+    double Cost;
+    unsigned int From;
+    unsigned int To;
+};
+
+static bool CostsLess(const Collapse& a, const Collapse& b)
+{
+    return a.Cost < b.Cost;
+}
+
+// Marks the vertices of edges that are not shared by exactly two
+// triangles; seams between duplicated vertices look like borders too.
+static void FindLockedVertices(const vector<unsigned int>& indices,
+                               vector<bool>& locked)
+{
+    vector<unsigned long long> edges;
+    edges.reserve(indices.size());
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        for (int k = 0; k < 3; k++) {
+            unsigned long long a = indices[i + k];
+            unsigned long long b = indices[i + (k + 1) % 3];
+            edges.push_back(a < b ? a << 32 | b : b << 32 | a);
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+
+    for (size_t i = 0; i < edges.size();) {
+        size_t j = i;
+        while (j < edges.size() && edges[j] == edges[i])
+            ++j;
+        if (j - i != 2) {
+            locked[(unsigned int) (edges[i] >> 32)] = true;
+            locked[(unsigned int) edges[i]] = true;
+        }
+        i = j;
+    }
+}
+
+// The triangles around every vertex, as offsets into one shared array.
+struct TriangleAdjacency {
+    vector<int> FirstTriangle;
+    vector<int> Triangles;
+};
+
+static void BuildAdjacency(const vector<unsigned int>& indices,
+                           int vertexCount, TriangleAdjacency& adjacency)
+{
+    vector<int>& first = adjacency.FirstTriangle;
+    first.assign(vertexCount + 1, 0);
+    for (size_t i = 0; i < indices.size(); i++)
+        first[indices[i] + 1]++;
+    for (int v = 0; v < vertexCount; v++)
+        first[v + 1] += first[v];
+
+    adjacency.Triangles.resize(indices.size());
+    vector<int> filled(first.begin(), first.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++)
+        adjacency.Triangles[filled[indices[i]]++] = i / 3;
+}
+
+static bool HasVertex(const unsigned int* triangle, unsigned int v)
+{
+    return triangle[0] == v || triangle[1] == v || triangle[2] == v;
+}
+
+// Sorted vertices of the triangles around v, v included.
+static void GatherNeighbours(const vector<unsigned int>& indices,
+                             const TriangleAdjacency& adjacency,
+                             unsigned int v, vector<unsigned int>& neighbours)
+{
+    neighbours.clear();
+    for (int t = adjacency.FirstTriangle[v];
+         t < adjacency.FirstTriangle[v + 1]; t++) {
+        const unsigned int* triangle = &indices[adjacency.Triangles[t] * 3];
+        neighbours.insert(neighbours.end(), triangle, triangle + 3);
+    }
+    std::sort(neighbours.begin(), neighbours.end());
+    neighbours.erase(std::unique(neighbours.begin(), neighbours.end()),
+                     neighbours.end());
+}
+
+// Whether moving from onto to turns any triangle that survives around.
+static bool CollapseFlips(const vector<unsigned int>& indices,
+                          const TriangleAdjacency& adjacency,
+                          const vector<float>& vertices, int floatsPerVertex,
+                          unsigned int from, unsigned int to)
+{
+    vec3 destination = GetPosition(vertices, floatsPerVertex, to);
+    for (int t = adjacency.FirstTriangle[from];
+         t < adjacency.FirstTriangle[from + 1]; t++) {
+        const unsigned int* triangle = &indices[adjacency.Triangles[t] * 3];
+        if (HasVertex(triangle, to))
+            continue;
+
+        vec3 p[3];
+        for (int k = 0; k < 3; k++)
+            p[k] = GetPosition(vertices, floatsPerVertex, triangle[k]);
+        vec3 before = (p[1] - p[0]).Cross(p[2] - p[0]);
+        for (int k = 0; k < 3; k++)
+            if (triangle[k] == from)
+                p[k] = destination;
+        vec3 after = (p[1] - p[0]).Cross(p[2] - p[0]);
+        if (after.Dot(before) <= 0)
+            return true;
+    }
+    return false;
+}
+
+void BuildLodChain(const vector<unsigned int>& indices,
+                   const vector<float>& vertices, int floatsPerVertex,
+                   const float* ratios, int ratioCount,
+                   vector<MeshLod>& levels)
+{
+    levels.clear();
+    int vertexCount = vertices.size() / floatsPerVertex;
+    vector<unsigned int> current(indices);
+
+    // Every vertex starts with the planes of the triangles around it.
+    Quadric zero = {};
+    vector<Quadric> quadrics(vertexCount, zero);
+    for (size_t i = 0; i + 2 < current.size(); i += 3) {
+        vec3 a = GetPosition(vertices, floatsPerVertex, current[i]);
+        vec3 b = GetPosition(vertices, floatsPerVertex, current[i + 1]);
+        vec3 c = GetPosition(vertices, floatsPerVertex, current[i + 2]);
+        vec3 normal = (b - a).Cross(c - a);
+        float area = std::sqrt(normal.Dot(normal));
+        if (area == 0)
+            continue;
+        normal = normal / area;
+        for (int k = 0; k < 3; k++)
+            AddPlane(quadrics[current[i + k]], normal, -normal.Dot(a), area);
+    }
+
+    vector<bool> locked(vertexCount, false);
+    FindLockedVertices(current, locked);
+
+    TriangleAdjacency adjacency;
+    vector<Collapse> collapses;
+    vector<unsigned int> remap(vertexCount);
+    vector<bool> touched(vertexCount);
+    vector<unsigned int> fromNeighbours, toNeighbours, common;
+
+    float error = 0;
+    int triangleCount = current.size() / 3;
+    for (int level = 0; level < ratioCount; level++) {
+        int target = (int) (indices.size() / 3 * ratios[level]);
+
+        // Collapse in passes; a pass leaves the neighbourhood of every
+        // collapse alone so the costs and checks of the rest stay valid.
+        while (triangleCount > target) {
+            BuildAdjacency(current, vertexCount, adjacency);
+
+            collapses.clear();
+            for (size_t i = 0; i < current.size(); i++) {
+                unsigned int from = current[i];
+                unsigned int to = current[i - i % 3 + (i + 1) % 3];
+                if (locked[from])
+                    continue;
+                Quadric q = quadrics[from];
+                AddQuadric(q, quadrics[to]);
+                vec3 destination = GetPosition(vertices, floatsPerVertex, to);
+                Collapse collapse = {
+                    EvaluateQuadric(q, destination), from, to
+                };
+                collapses.push_back(collapse);
+            }
+            std::sort(collapses.begin(), collapses.end(), CostsLess);
+
+            for (int v = 0; v < vertexCount; v++)
+                remap[v] = v;
+            std::fill(touched.begin(), touched.end(), false);
+            int collapsed = 0;
+
+            for (size_t c = 0;
+                 c < collapses.size() && triangleCount > target; c++) {
+                unsigned int from = collapses[c].From;
+                unsigned int to = collapses[c].To;
+                if (touched[from] || touched[to])
+                    continue;
+
+                // The triangles on the edge disappear. Any other vertex
+                // next to both ends would end up on a non-manifold edge.
+                int shared = 0;
+                for (int t = adjacency.FirstTriangle[from];
+                     t < adjacency.FirstTriangle[from + 1]; t++)
+                    if (HasVertex(&current[adjacency.Triangles[t] * 3], to))
+                        ++shared;
+                GatherNeighbours(current, adjacency, from, fromNeighbours);
+                GatherNeighbours(current, adjacency, to, toNeighbours);
+                common.clear();
+                std::set_intersection(fromNeighbours.begin(),
+                                      fromNeighbours.end(),
+                                      toNeighbours.begin(), toNeighbours.end(),
+                                      std::back_inserter(common));
+                if ((int) common.size() != shared + 2)
+                    continue;
+
+                if (CollapseFlips(current, adjacency, vertices,
+                                  floatsPerVertex, from, to))
+                    continue;
+
+                remap[from] = to;
+                AddQuadric(quadrics[to], quadrics[from]);
+                error = std::max(error, (float) std::sqrt(collapses[c].Cost));
+                for (size_t n = 0; n < fromNeighbours.size(); n++)
+                    touched[fromNeighbours[n]] = true;
+                triangleCount -= shared;
+                ++collapsed;
+            }
+
+            if (collapsed == 0)
+                break;
+
+            vector<unsigned int> next;
+            next.reserve(current.size());
+            for (size_t i = 0; i + 2 < current.size(); i += 3) {
+                unsigned int a = remap[current[i]];
+                unsigned int b = remap[current[i + 1]];
+                unsigned int c = remap[current[i + 2]];
+                if (a != b && b != c && c != a) {
+                    next.push_back(a);
+                    next.push_back(b);
+                    next.push_back(c);
+                }
+            }
+            current.swap(next);
+            triangleCount = current.size() / 3;
+        }
+
+        MeshLod lod;
+        lod.Indices = current;
+        lod.Error = error;
+        levels.push_back(lod);
+    }
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include "Interfaces.hpp"
+
+// A simplified version of a triangle list that uses the vertices of the
+// original, so every level can be drawn from the same vertex buffer.
+struct MeshLod {
+    vector<unsigned int> Indices;
+    // Root mean square distance, in model units, from the vertices that
+    // were collapsed to the original triangles around them; the largest
+    // one of all the collapses so far.
+    float Error;
+};
+
+// Simplifies a triangle list with quadric error metrics (Garland and
+// Heckbert) by collapsing vertices into their neighbours, cheapest first.
+// One run produces every level: a snapshot is taken when the triangle
+// count reaches each of the ratios, which must be decreasing. Vertices on
+// borders and seams stay where they are, and collapses that would flip a
+// triangle are skipped, so a level can stop short of its ratio.
+void BuildLodChain(const vector<unsigned int>& indices,
+                   const vector<float>& vertices, int floatsPerVertex,
+                   const float* ratios, int ratioCount,
+                   vector<MeshLod>& levels);
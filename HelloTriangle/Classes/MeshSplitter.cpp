@@ -0,0 +1,55 @@
+#include <algorithm>
+
+#include "MeshSplitter.hpp"
+
+void SplitMesh(const vector<unsigned int>& indices, int vertexCount,
+               int maxVertices, vector<MeshPart>& parts)
+{
+    parts.clear();
+    if (indices.empty())
+        return;
+
+    // Part-local index of every source vertex, or -1 when the current part
+    // does not reference it yet. Only the entries a part touched are reset.
+    vector<int> localIndex(vertexCount, -1);
+
+    parts.push_back(MeshPart());
+    MeshPart* part = &parts.back();
+
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        int newVertices = 0;
+        for (int k = 0; k < 3; k++) {
+            unsigned int v = indices[i + k];
+            bool repeated = (k > 0 && indices[i] == v) ||
+                            (k > 1 && indices[i + 1] == v);
+            if (localIndex[v] < 0 && !repeated)
+                ++newVertices;
+        }
+
+        if ((int) part->VertexRemap.size() + newVertices > maxVertices) {
+            for (size_t j = 0; j < part->VertexRemap.size(); j++)
+                localIndex[part->VertexRemap[j]] = -1;
+            parts.push_back(MeshPart());
+            part = &parts.back();
+        }
+
+        for (int k = 0; k < 3; k++) {
+            unsigned int v = indices[i + k];
+            if (localIndex[v] < 0) {
+                localIndex[v] = (int) part->VertexRemap.size();
+                part->VertexRemap.push_back(v);
+            }
+            part->Indices.push_back((unsigned short) localIndex[v]);
+        }
+    }
+}
+
+void GatherVertices(const vector<float>& vertices, int floatsPerVertex,
+                    const vector<unsigned int>& remap, vector<float>& out)
+{
+    out.resize(remap.size() * floatsPerVertex);
+    for (size_t i = 0; i < remap.size(); i++) {
+        const float* source = &vertices[remap[i] * floatsPerVertex];
+        std::copy(source, source + floatsPerVertex, &out[i * floatsPerVertex]);
+    }
+}
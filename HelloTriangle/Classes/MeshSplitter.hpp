@@ -0,0 +1,19 @@
+#pragma once
+#include "Interfaces.hpp"
+
+// A piece of a larger mesh that can be drawn with 16-bit indices.
+struct MeshPart {
+    // Source vertex for every vertex of the part, in first-use order.
+    vector<unsigned int> VertexRemap;
+    vector<unsigned short> Indices;
+};
+
+// Splits a triangle list into parts of at most maxVertices vertices each,
+// keeping the triangle order. Vertices shared across a part boundary are
+// duplicated into every part that uses them.
+void SplitMesh(const vector<unsigned int>& indices, int vertexCount,
+               int maxVertices, vector<MeshPart>& parts);
+
+// Copies the source vertices named by remap into a new interleaved stream.
+void GatherVertices(const vector<float>& vertices, int floatsPerVertex,
+                    const vector<unsigned int>& remap, vector<float>& out);
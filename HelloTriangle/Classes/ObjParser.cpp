@@ -0,0 +1,294 @@
+#include <cmath>
+#include <algorithm>
+
+#include "ObjParser.hpp"
+#include "ThreadPool.hpp"
+
+// Chunks smaller than this are not worth a thread of their own.
+static const size_t MinimumChunkSize = 1 << 20;
+
+// Exact powers of ten representable as doubles.
+static const double PowersOfTen[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+    1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+    1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static inline bool IsBlank(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+static inline bool IsDigit(char c)
+{
+    return (unsigned char)(c - '0') < 10;
+}
+
+static inline const char* SkipBlanks(const char* p, const char* end)
+{
+    while (p != end && IsBlank(*p))
+        ++p;
+    return p;
+}
+
+static inline const char* SkipLine(const char* p, const char* end)
+{
+    while (p != end && *p != '\n')
+        ++p;
+    return p == end ? p : p + 1;
+}
+
+const char* ParseFloat(const char* p, const char* end, float& value)
+{
+    p = SkipBlanks(p, end);
+
+    bool negative = false;
+    if (p != end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    // Keep up to 19 significant digits in an integer mantissa; the rest
+    // only shift the decimal exponent.
+    unsigned long long mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+
+    for (; p != end && IsDigit(*p); ++p) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa)
+                ++digits;
+        } else {
+            ++exponent;
+        }
+    }
+
+    if (p != end && *p == '.') {
+        for (++p; p != end && IsDigit(*p); ++p) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa)
+                    ++digits;
+                --exponent;
+            }
+        }
+    }
+
+    if (p != end && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        bool negativeExponent = false;
+        if (q != end && (*q == '-' || *q == '+'))
+            negativeExponent = *q++ == '-';
+        if (q != end && IsDigit(*q)) {
+            int e = 0;
+            for (; q != end && IsDigit(*q); ++q)
+                if (e < 10000)
+                    e = e * 10 + (*q - '0');
+            exponent += negativeExponent ? -e : e;
+            p = q;
+        }
+    }
+
+    double result = (double) mantissa;
+    if (mantissa != 0) {
+        // Fast path: both operands are exact, so the division or
+        // multiplication is correctly rounded.
+        if (exponent < 0 && exponent >= -22 && mantissa < (1ull << 53))
+            result /= PowersOfTen[-exponent];
+        else if (exponent >= 0 && exponent <= 22 && mantissa < (1ull << 53))
+            result *= PowersOfTen[exponent];
+        else
+            result *= std::pow(10.0, exponent);
+    }
+
+    value = (float) (negative ? -result : result);
+    return p;
+}
+
+const char* ParseInt(const char* p, const char* end, int& value)
+{
+    p = SkipBlanks(p, end);
+
+    bool negative = false;
+    if (p != end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    int result = 0;
+    for (; p != end && IsDigit(*p); ++p)
+        result = result * 10 + (*p - '0');
+
+    value = negative ? -result : result;
+    return p;
+}
+
+// Reads one face index of the form "i", "i/t", "i//n" or "i/t/n" and
+// resolves it to a zero-based vertex index. Returns false at end of record.
+// Negative indices count back from the last vertex read so far; since that
+// is only known within the current chunk, they are flagged as relative.
+static inline bool ParseFaceIndex(const char*& p, const char* end,
+                                  int vertexCount, int& index, bool& relative)
+{
+    p = SkipBlanks(p, end);
+    if (p == end || !(IsDigit(*p) || *p == '-' || *p == '+'))
+        return false;
+
+    p = ParseInt(p, end, index);
+    while (p != end && !IsBlank(*p) && *p != '\r' && *p != '\n')
+        ++p;
+
+    relative = index < 0;
+    index = relative ? vertexCount + index : index - 1;
+    return true;
+}
+
+// Parses [begin, end) into the chunk-local arrays. The positions (in ints,
+// counting from faces.begin()) of indices that are relative to the chunk's
+// first vertex are appended to relativeIndices.
+static void ParseChunk(const char* begin, const char* end,
+                       vector<vec3>& vertices, vector<ivec3>& faces,
+                       vector<int>& relativeIndices)
+{
+    const char* p = begin;
+    while (p != end) {
+        p = SkipBlanks(p, end);
+        if (end - p > 1 && p[0] == 'v' && IsBlank(p[1])) {
+            vec3 v;
+            p = ParseFloat(p + 1, end, v.x);
+            p = ParseFloat(p, end, v.y);
+            p = ParseFloat(p, end, v.z);
+            vertices.push_back(v);
+        } else if (end - p > 1 && p[0] == 'f' && IsBlank(p[1])) {
+            int vertexCount = (int) vertices.size();
+            ivec3 face;
+            bvec2 relative;
+            bool relativeZ;
+            const char* q = p + 1;
+            if (ParseFaceIndex(q, end, vertexCount, face.x, relative.x) &&
+                ParseFaceIndex(q, end, vertexCount, face.y, relative.y)) {
+                while (ParseFaceIndex(q, end, vertexCount, face.z, relativeZ)) {
+                    int slot = (int) faces.size() * 3;
+                    if (relative.x)
+                        relativeIndices.push_back(slot);
+                    if (relative.y)
+                        relativeIndices.push_back(slot + 1);
+                    if (relativeZ)
+                        relativeIndices.push_back(slot + 2);
+                    faces.push_back(face);
+                    face.y = face.z;
+                    relative.y = relativeZ;
+                }
+            }
+            p = q;
+        }
+        p = SkipLine(p, end);
+    }
+}
+
+// Drops the faces from first on that refer to a vertex outside
+// [0, vertexCount), such as those of "f 0" records or of indices past the
+// last vertex; nothing downstream checks them again.
+static void RemoveInvalidFaces(vector<ivec3>& faces, size_t first,
+                               int vertexCount)
+{
+    unsigned int count = (unsigned int) vertexCount;
+    vector<ivec3>::iterator valid = std::remove_if(
+        faces.begin() + first, faces.end(), [count] (const ivec3& face) {
+            return (unsigned int) face.x >= count ||
+                   (unsigned int) face.y >= count ||
+                   (unsigned int) face.z >= count;
+        });
+    faces.erase(valid, faces.end());
+}
+
+void ParseObj(const char* begin, const char* end,
+              vector<vec3>& vertices, vector<ivec3>& faces)
+{
+    // A single chunk starts at vertex zero, so relative indices are final.
+    size_t firstFace = faces.size();
+    vector<int> relativeIndices;
+    ParseChunk(begin, end, vertices, faces, relativeIndices);
+    RemoveInvalidFaces(faces, firstFace, (int) vertices.size());
+}
+
+struct ObjChunk {
+    const char* Begin;
+    const char* End;
+    vector<vec3> Vertices;
+    vector<ivec3> Faces;
+    vector<int> RelativeIndices;
+    int FirstVertex;
+    int FirstFace;
+};
+
+void ParseObj(const char* begin, const char* end,
+              vector<vec3>& vertices, vector<ivec3>& faces,
+              int workerCount)
+{
+    ThreadPool& pool = ThreadPool::Shared();
+    if (workerCount <= 0)
+        workerCount = pool.GetThreadCount();
+
+    size_t size = end - begin;
+    int chunkCount = (int) std::min<size_t>(workerCount,
+                                            size / MinimumChunkSize);
+    if (chunkCount <= 1) {
+        ParseObj(begin, end, vertices, faces);
+        return;
+    }
+
+    // Cut the image into roughly equal pieces, moving every cut forward to
+    // the start of the next line so that no record is split.
+    vector<ObjChunk> chunks(chunkCount);
+    const char* cut = begin;
+    for (int i = 0; i < chunkCount; i++) {
+        chunks[i].Begin = cut;
+        if (i == chunkCount - 1) {
+            cut = end;
+        } else {
+            cut = std::max(cut, begin + size * (i + 1) / chunkCount);
+            while (cut != end && cut[-1] != '\n')
+                ++cut;
+        }
+        chunks[i].End = cut;
+    }
+
+    pool.ParallelFor(chunkCount, [&chunks] (int i) {
+        ObjChunk& chunk = chunks[i];
+        size_t chunkSize = chunk.End - chunk.Begin;
+        chunk.Vertices.reserve(chunkSize / 64);
+        chunk.Faces.reserve(chunkSize / 32);
+        ParseChunk(chunk.Begin, chunk.End,
+                   chunk.Vertices, chunk.Faces, chunk.RelativeIndices);
+    });
+
+    // Exclusive prefix sums give every chunk its place in the output.
+    size_t firstFace = faces.size();
+    int vertexCount = (int) vertices.size();
+    int faceCount = (int) faces.size();
+    for (int i = 0; i < chunkCount; i++) {
+        chunks[i].FirstVertex = vertexCount;
+        chunks[i].FirstFace = faceCount;
+        vertexCount += (int) chunks[i].Vertices.size();
+        faceCount += (int) chunks[i].Faces.size();
+    }
+    vertices.resize(vertexCount);
+    faces.resize(faceCount);
+
+    pool.ParallelFor(chunkCount, [&chunks, &vertices, &faces] (int i) {
+        ObjChunk& chunk = chunks[i];
+        std::copy(chunk.Vertices.begin(), chunk.Vertices.end(),
+                  vertices.begin() + chunk.FirstVertex);
+        std::copy(chunk.Faces.begin(), chunk.Faces.end(),
+                  faces.begin() + chunk.FirstFace);
+
+        if (chunk.RelativeIndices.empty())
+            return;
+
+        int* indices = &faces[chunk.FirstFace].x;
+        for (size_t j = 0; j < chunk.RelativeIndices.size(); j++)
+            indices[chunk.RelativeIndices[j]] += chunk.FirstVertex;
+    });
+
+    // Absolute indices may point into any chunk, so they can only be
+    // checked once all of them are merged.
+    RemoveInvalidFaces(faces, firstFace, vertexCount);
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include "Interfaces.hpp"
+
+// Parses the "v" and "f" records of a Wavefront OBJ image in [begin, end).
+// Face indices are converted to zero-based; polygons are fanned into
+// triangles and any "/vt/vn" suffixes are ignored. Faces that refer to a
+// vertex the image does not have are dropped. Every other record is
+// skipped. Numbers are read with a locale-independent parser.
+void ParseObj(const char* begin, const char* end,
+              vector<vec3>& vertices, vector<ivec3>& faces);
+
+// Same as above, but splits the image at line boundaries into chunks that
+// are parsed on the shared thread pool and merged back in file order.
+// workerCount == 0 uses one chunk per pool thread; small images are parsed
+// on the calling thread regardless.
+void ParseObj(const char* begin, const char* end,
+              vector<vec3>& vertices, vector<ivec3>& faces,
+              int workerCount);
+
+// Locale-independent number parsers. They skip leading blanks, stop at the
+// first character that cannot belong to the number and return its address.
+const char* ParseFloat(const char* p, const char* end, float& value);
+const char* ParseInt(const char* p, const char* end, int& value);
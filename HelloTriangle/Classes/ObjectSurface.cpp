@@ -1,58 +1,100 @@
-#include <fstream>
 #include <algorithm>
 
 #include "ObjectSurface.h"
+#include "MappedFile.hpp"
+#include "ObjParser.hpp"
+#include "MeshCache.hpp"
+
+// A vertex in the cache: a position, then a normal.
+static const int CachedFloatsPerVertex = 6;
+
+ObjSurface::ObjSurface(const string& name, int workerCount) :
+	m_name(name),
+	m_vertexCount(0),
+	m_triangleIndexCount(0),
+	m_cachedVertices(0),
+	m_cachedIndices(0)
+{
+	// A cache that is still valid already holds the smoothed normals.
+	if (LoadCache())
+		return;
+
+	unsigned long long sourceHash;
+	{
+		// Parse the records straight out of the mapped file; a rough size
+		// estimate avoids most of the reallocations while the arrays grow.
+		MappedFile objFile(m_name);
+		m_vertices.reserve(objFile.Size() / 64);
+		m_faces.reserve(objFile.Size() / 32);
+		ParseObj(objFile.Data(), objFile.Data() + objFile.Size(),
+				 m_vertices, m_faces, workerCount);
+		sourceHash = HashBytes(objFile.Data(), objFile.Size());
+	}
+	m_vertexCount = m_vertices.size();
+	m_triangleIndexCount = m_faces.size() * 3;
 
-std::istream& operator>>(std::istream& stream, ivec3& out)
+	ComputeNormals();
+	ComputeBounds();
+	SaveCache(sourceHash);
+}
+
+ObjSurface::~ObjSurface()
 {
-	return stream >> out.x >> out.y >> out.z;
 }
 
-std::istream& operator>>(std::istream& stream, vec3& out)
+bool ObjSurface::LoadCache()
 {
-	return stream >> out.x >> out.y >> out.z;
+	MeshFileHeader header;
+	m_cacheFile.reset(MapMeshCache(m_name, header));
+	if (!m_cacheFile)
+		return false;
+
+	const char* data = m_cacheFile->Data();
+	m_cachedVertices = (const float*) (data + header.VertexOffset);
+	m_cachedIndices = (const unsigned int*) (data + header.IndexOffset);
+	m_vertexCount = header.VertexCount;
+	m_triangleIndexCount = header.IndexCount;
+	m_boundsMin = vec3(header.BoundsMin[0], header.BoundsMin[1],
+					   header.BoundsMin[2]);
+	m_boundsMax = vec3(header.BoundsMax[0], header.BoundsMax[1],
+					   header.BoundsMax[2]);
+	return true;
 }
 
-ObjSurface::ObjSurface(const string& name) :
-	m_name(name)
+void ObjSurface::SaveCache(unsigned long long sourceHash) const
 {
-	using std::ifstream;
-	using std::string;
-	using std::vector;
-	using std::istreambuf_iterator;
-
-	ifstream objFile(m_name.c_str());
-	objFile.exceptions( ifstream::badbit );
-	if (!objFile.is_open())
-		throw std::exception("Could not open file");
-
-	std::back_insert_iterator<vector<vec3>> v_it(m_vertices);
-
-	while (objFile) {
-		char type = objFile.peek();
-		if (type == 'v') {
-			vec3 v;
-			objFile >> type >> v.x >> v.y >> v.z;
-			*v_it++ = v; 
-		} else {
-			break;
-		}
-		objFile.ignore(512, '\n');
-	}
+	MeshData mesh;
+	GenerateVertices(mesh.Vertices, VertexFlagsNormals);
+	GenerateTriangleIndices(mesh.Indices);
+	mesh.BoundsMin = m_boundsMin;
+	mesh.BoundsMax = m_boundsMax;
+	SaveMeshCache(m_name, sourceHash, mesh);
+}
 
-	std::back_insert_iterator<vector<ivec3>> f_it(m_faces);
-	while (objFile) {
-		char type = objFile.peek();
-		if (type == 'f') {
-			ivec3 f;
-			objFile >> type >> f.x >> f.y >> f.z;
-			*f_it++ = f-ivec3(1, 1, 1);
-		} else {
-			break;
-		}
-		objFile.ignore(512, '\n');
+void ObjSurface::ComputeBounds()
+{
+	m_boundsMin = m_boundsMax = vec3(0, 0, 0);
+	if (!m_vertices.empty())
+		m_boundsMin = m_boundsMax = m_vertices[0];
+	for (int i = 0; i < GetVertexCount(); i++) {
+		const vec3& v = m_vertices[i];
+		m_boundsMin = vec3(std::min(m_boundsMin.x, v.x),
+						   std::min(m_boundsMin.y, v.y),
+						   std::min(m_boundsMin.z, v.z));
+		m_boundsMax = vec3(std::max(m_boundsMax.x, v.x),
+						   std::max(m_boundsMax.y, v.y),
+						   std::max(m_boundsMax.z, v.z));
 	}
+}
 
+void ObjSurface::GetBounds(vec3& boundsMin, vec3& boundsMax) const
+{
+	boundsMin = m_boundsMin;
+	boundsMax = m_boundsMax;
+}
+
+void ObjSurface::ComputeNormals()
+{
 	m_normals = vector<vec3>(GetVertexCount(), vec3(0.f, 0.f, 0.f));
 
 	for (auto face = m_faces.begin(); face != m_faces.end(); ++face)
@@ -76,36 +118,68 @@ ObjSurface::ObjSurface(const string& name) :
 		m_normals[i].Normalize();
 }
 
-void ObjSurface::GenerateVertices(vector<float>& vertices, unsigned char flags) const 
+void ObjSurface::GenerateVertices(vector<float>& vertices,
+								  const VertexFormat& format) const
 {
-    // ﰢ ϱ  3 ŭ 뷮 ø.
-    int floatsPerVertex = 3;
-
-    //  Normal vector ʿϴٸ ߰ 3 ŭ   ø.
-    if (flags & VertexFlagsNormals)
-        floatsPerVertex += 3;
-
-	vertices.reserve(GetVertexCount() * floatsPerVertex);
-
-	back_insert_iterator<vector<float>> it(vertices);
-
-	for (int i = 0; i < GetVertexCount(); ++i) {
-		*it++ = m_vertices[i].x;
-		*it++ = m_vertices[i].y;
-		*it++ = m_vertices[i].z;
+	int vertexCount = GetVertexCount();
+	const float* cached = m_cachedVertices;
+
+	// The cache holds exactly this layout; it goes out as it is.
+	if (cached && format.Flags == VertexFlagsNormals &&
+		format.Layout == VertexLayoutInterleaved) {
+		vertices.assign(cached, cached + vertexCount * CachedFloatsPerVertex);
+		return;
+	}
 
-		*it++ = m_normals[i].x;
-		*it++ = m_normals[i].y;
-		*it++ = m_normals[i].z;
+	VertexAttribute position = format.GetPosition(vertexCount);
+	VertexAttribute normal = format.GetNormal(vertexCount);
+	VertexAttribute texCoord = format.GetTexCoord(vertexCount);
+	vertices.resize(vertexCount * format.GetFloatsPerVertex());
+
+	for (int i = 0; i < vertexCount; ++i) {
+		vec3 p = cached ? vec3(cached[0], cached[1], cached[2]) : m_vertices[i];
+		p.Write(&vertices[position.Offset + i * position.Stride]);
+		if (normal.Size) {
+			vec3 n = cached ? vec3(cached[3], cached[4], cached[5])
+							: m_normals[i];
+			n.Write(&vertices[normal.Offset + i * normal.Stride]);
+		}
+		if (cached)
+			cached += CachedFloatsPerVertex;
+		// The parser skips "vt" records; every vertex gets (0, 0).
+		if (texCoord.Size) {
+			float* attribute = &vertices[texCoord.Offset + i * texCoord.Stride];
+			attribute[0] = attribute[1] = 0;
+		}
 	}
 }
 
-void ObjSurface::GenerateTriangleIndices(vector<unsigned short>& indices) const
+template <typename Index>
+static void WriteFaceIndices(const vector<ivec3>& faces, vector<Index>& indices)
 {
-	for (int i = 0; i < m_faces.size(); i++) {
+	indices.resize(faces.size() * 3);
+	for (int i = 0; i < faces.size(); i++) {
 		int idx = i*3;
-		indices[idx++] = m_faces[i].x;
-		indices[idx++] = m_faces[i].y;
-		indices[idx++] = m_faces[i].z;
+		indices[idx++] = faces[i].x;
+		indices[idx++] = faces[i].y;
+		indices[idx++] = faces[i].z;
 	}
 }
+
+void ObjSurface::GenerateTriangleIndices(vector<unsigned short>& indices) const
+{
+	if (m_cachedIndices)
+		indices.assign(m_cachedIndices,
+					   m_cachedIndices + m_triangleIndexCount);
+	else
+		WriteFaceIndices(m_faces, indices);
+}
+
+void ObjSurface::GenerateTriangleIndices(vector<unsigned int>& indices) const
+{
+	if (m_cachedIndices)
+		indices.assign(m_cachedIndices,
+					   m_cachedIndices + m_triangleIndexCount);
+	else
+		WriteFaceIndices(m_faces, indices);
+}
@@ -1,24 +1,52 @@
 #include <iterator>
 #include <istream>
+#include <memory>
 
 #include "Interfaces.hpp"
 
 using namespace std;
 
+class MappedFile;
+
 class ObjSurface : public ISurface {
 public:
-	ObjSurface(const string& name);
-    ~ObjSurface() {}
+	// workerCount is the number of threads used to parse the file;
+	// zero picks one per hardware thread.
+	ObjSurface(const string& name, int workerCount = 0);
+    ~ObjSurface();
 
-    int GetVertexCount() const { return m_vertices.size(); }
+    int GetVertexCount() const { return m_vertexCount; }
 	int GetLineIndexCount() const { return 0; }
-	int GetTriangleIndexCount() const { return m_faces.size()*3; }
-    void GenerateVertices(vector<float>& vertices, unsigned char flags = 0) const;
+	int GetTriangleIndexCount() const { return m_triangleIndexCount; }
+	int GetIndexSize() const { return GetVertexCount() > 65536 ? 4 : 2; }
+    void GenerateVertices(vector<float>& vertices,
+                          const VertexFormat& format = VertexFormat()) const;
 	void GenerateLineIndices(vector<unsigned short>& indices) const {}
 	void GenerateTriangleIndices(vector<unsigned short>& indices) const;
+	void GenerateTriangleIndices(vector<unsigned int>& indices) const;
+	int GetTriangleStripIndexCount() const { return 0; }
+	void GenerateTriangleStripIndices(vector<unsigned int>& indices) const {}
+	bool GetShaderEquation(ShaderEquation& equation) const { return false; }
+	// Axis-aligned bounds of the vertex positions.
+	void GetBounds(vec3& boundsMin, vec3& boundsMax) const;
 
 private:
+	bool LoadCache();
+	void SaveCache(unsigned long long sourceHash) const;
+	void ComputeNormals();
+	void ComputeBounds();
+
 	string m_name;
+	int m_vertexCount;
+	int m_triangleIndexCount;
+	vec3 m_boundsMin;
+	vec3 m_boundsMax;
+
+	// A valid cache stays mapped, and the vertices and indices are served
+	// straight from it; the arrays below are then empty.
+	unique_ptr<MappedFile> m_cacheFile;
+	const float* m_cachedVertices;
+	const unsigned int* m_cachedIndices;
 
 	vector<vec3> m_vertices;
 	vector<vec3> m_normals;
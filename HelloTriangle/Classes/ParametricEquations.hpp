@@ -1,6 +1,13 @@
-#include "ParametricSurface.hpp"
+#include "ParametricMesher.hpp"
+#include "SimdMath.hpp"
 
-class Cone : public ParametricSurface {
+// The GLSL versions of the equations below. They are arrays, which every
+// file including this header gets a copy of without the names clashing.
+#define STRINGIFY(A)  #A
+#include "../Shaders/ParametricEquations.vert"
+#undef STRINGIFY
+
+class Cone : public ParametricSurfaceT<Cone> {
 public:
     Cone(float height, float radius) : m_height(height), m_radius(radius)
     {
@@ -23,7 +30,7 @@ private:
     float m_radius;
 };
 
-class Sphere : public ParametricSurface {
+class Sphere : public ParametricSurfaceT<Sphere> {
 public:
     Sphere(float radius) : m_radius(radius)
     {
@@ -45,7 +52,7 @@ private:
     float m_radius;
 };
 
-class Torus : public ParametricSurface {
+class Torus : public ParametricSurfaceT<Torus> {
 public:
     Torus(float majorRadius, float minorRadius) :
         m_majorRadius(majorRadius),
@@ -67,12 +74,74 @@ public:
         float z = minor * sin(v);
         return vec3(x, y, z);
     }
+
+    bool EvaluateWithDerivatives(const vec2& domain, vec3& range,
+                                 vec3& dx, vec3& dy) const
+    {
+        const float major = m_majorRadius;
+        const float minor = m_minorRadius;
+        float u = domain.x;
+        float v = domain.y;
+        float ring = major + minor * cos(v);
+        range = vec3(ring * cos(u), ring * sin(u), minor * sin(v));
+        dx = vec3(-ring * sin(u), ring * cos(u), 0);
+        dy = vec3(-minor * sin(v) * cos(u), -minor * sin(v) * sin(u),
+                  minor * cos(v));
+        return true;
+    }
+
+    void EvaluateBatch(const float* u, const float* v, int count,
+                       float* range) const
+    {
+        EvaluateBatch4(*this, u, v, count, range, 0, 0);
+    }
+    bool EvaluateBatchWithDerivatives(const float* u, const float* v,
+                                      int count, float* range,
+                                      float* dx, float* dy) const
+    {
+        EvaluateBatch4(*this, u, v, count, range, dx, dy);
+        return true;
+    }
+    bool GetLatticeAngles(LatticeAngles& angles) const
+    {
+        angles.AddColumn(1, 0);
+        angles.AddRow(1, 0);
+        return true;
+    }
+    bool EvaluateLatticeRow(const TrigLattice& lattice, int row,
+                            float* range, float* dx, float* dy) const
+    {
+        EvaluateLatticeRow4(*this, lattice, row, range, dx, dy);
+        return true;
+    }
+    void EvaluateLattice4(const LatticePoint4& p, vec3x4& range,
+                          vec3x4* dx, vec3x4* dy) const
+    {
+        const float major = m_majorRadius;
+        const float minor = m_minorRadius;
+        const Float4& sinU = p.SinX[0];
+        const Float4& cosU = p.CosX[0];
+        const Float4& sinV = p.SinY[0];
+        const Float4& cosV = p.CosY[0];
+        Float4 ring = major + minor * cosV;
+        range = vec3x4(ring * cosU, ring * sinU, minor * sinV);
+        if (dx)
+            *dx = vec3x4(-ring * sinU, ring * cosU, 0.0f);
+        if (dy)
+            *dy = vec3x4(-minor * sinV * cosU, -minor * sinV * sinU,
+                         minor * cosV);
+    }
+    const char* GetShaderSource(vec4& parameters) const
+    {
+        parameters = vec4(m_majorRadius, m_minorRadius, 0, 0);
+        return TorusShaderEquation;
+    }
 private:
     float m_majorRadius;
     float m_minorRadius;
 };
 
-class TrefoilKnot : public ParametricSurface {
+class TrefoilKnot : public ParametricSurfaceT<TrefoilKnot> {
 public:
     TrefoilKnot(float scale) : m_scale(scale)
     {
@@ -114,11 +183,142 @@ public:
         range.z = z + d * ww.z * sin(v);
         return range * m_scale;
     }
+
+    // The tube around the curve is swept by the frame (q, qvn, ww), so the
+    // derivative along the curve needs the frame's derivative as well;
+    // for a unit vector n = w / |w| that is (w' - n (n . w')) / |w|.
+    bool EvaluateWithDerivatives(const vec2& domain, vec3& range,
+                                 vec3& dx, vec3& dy) const
+    {
+        const float a = 0.5f;
+        const float b = 0.3f;
+        const float c = 0.5f;
+        const float d = 0.1f;
+        float u = (TwoPi - domain.x) * 2;
+        float v = domain.y;
+
+        float r = a + b * cos(1.5f * u);
+        vec3 center(r * cos(u), r * sin(u), c * sin(1.5f * u));
+
+        vec3 du;
+        du.x = -1.5f * b * sin(1.5f * u) * cos(u) - r * sin(u);
+        du.y = -1.5f * b * sin(1.5f * u) * sin(u) + r * cos(u);
+        du.z = 1.5f * c * cos(1.5f * u);
+
+        vec3 ddu;
+        ddu.x = -2.25f * b * cos(1.5f * u) * cos(u) +
+                3 * b * sin(1.5f * u) * sin(u) - r * cos(u);
+        ddu.y = -2.25f * b * cos(1.5f * u) * sin(u) -
+                3 * b * sin(1.5f * u) * cos(u) - r * sin(u);
+        ddu.z = -2.25f * c * sin(1.5f * u);
+
+        float length = sqrt(du.Dot(du));
+        vec3 q = du / length;
+        vec3 dq = (ddu - q * q.Dot(ddu)) / length;
+
+        vec3 side(du.y, -du.x, 0);
+        vec3 dside(ddu.y, -ddu.x, 0);
+        float sideLength = sqrt(side.Dot(side));
+        vec3 qvn = side / sideLength;
+        vec3 dqvn = (dside - qvn * qvn.Dot(dside)) / sideLength;
+
+        vec3 ww = q.Cross(qvn);
+        vec3 dww = dq.Cross(qvn) + q.Cross(dqvn);
+
+        vec3 radial = qvn * cos(v) + ww * sin(v);
+        vec3 dradial = dqvn * cos(v) + dww * sin(v);
+        range = (center + radial * d) * m_scale;
+
+        // u runs backwards at twice the speed of domain.x.
+        dx = (du + dradial * d) * (-2 * m_scale);
+        dy = (qvn * -sin(v) + ww * cos(v)) * (d * m_scale);
+        return true;
+    }
+
+    void EvaluateBatch(const float* u, const float* v, int count,
+                       float* range) const
+    {
+        EvaluateBatch4(*this, u, v, count, range, 0, 0);
+    }
+    bool EvaluateBatchWithDerivatives(const float* u, const float* v,
+                                      int count, float* range,
+                                      float* dx, float* dy) const
+    {
+        EvaluateBatch4(*this, u, v, count, range, dx, dy);
+        return true;
+    }
+    // u = (TwoPi - domain.x) * 2, and 1.5 u, along the columns.
+    bool GetLatticeAngles(LatticeAngles& angles) const
+    {
+        angles.AddColumn(-2, 2 * TwoPi);
+        angles.AddColumn(-3, 3 * TwoPi);
+        angles.AddRow(1, 0);
+        return true;
+    }
+    bool EvaluateLatticeRow(const TrigLattice& lattice, int row,
+                            float* range, float* dx, float* dy) const
+    {
+        EvaluateLatticeRow4(*this, lattice, row, range, dx, dy);
+        return true;
+    }
+    // EvaluateWithDerivatives four points at a time.
+    void EvaluateLattice4(const LatticePoint4& p, vec3x4& range,
+                          vec3x4* dx, vec3x4* dy) const
+    {
+        const float a = 0.5f;
+        const float b = 0.3f;
+        const float c = 0.5f;
+        const float d = 0.1f;
+        const Float4& sinU = p.SinX[0];
+        const Float4& cosU = p.CosX[0];
+        const Float4& sin15 = p.SinX[1];
+        const Float4& cos15 = p.CosX[1];
+        const Float4& sinV = p.SinY[0];
+        const Float4& cosV = p.CosY[0];
+
+        Float4 r = a + b * cos15;
+        vec3x4 center(r * cosU, r * sinU, c * sin15);
+
+        vec3x4 du(-1.5f * b * sin15 * cosU - r * sinU,
+                  -1.5f * b * sin15 * sinU + r * cosU,
+                  1.5f * c * cos15);
+        Float4 length = Sqrt(du.Dot(du));
+        vec3x4 q = du / length;
+
+        vec3x4 side(du.y, -du.x, 0.0f);
+        Float4 sideLength = Sqrt(side.Dot(side));
+        vec3x4 qvn = side / sideLength;
+        vec3x4 ww = q.Cross(qvn);
+
+        vec3x4 radial = qvn * cosV + ww * sinV;
+        range = (center + radial * d) * m_scale;
+        if (dy)
+            *dy = (qvn * -sinV + ww * cosV) * (d * m_scale);
+        if (!dx)
+            return;
+
+        vec3x4 ddu(-2.25f * b * cos15 * cosU + 3.0f * b * sin15 * sinU -
+                   r * cosU,
+                   -2.25f * b * cos15 * sinU - 3.0f * b * sin15 * cosU -
+                   r * sinU,
+                   -2.25f * c * sin15);
+        vec3x4 dq = (ddu - q * q.Dot(ddu)) / length;
+        vec3x4 dside(ddu.y, -ddu.x, 0.0f);
+        vec3x4 dqvn = (dside - qvn * qvn.Dot(dside)) / sideLength;
+        vec3x4 dww = dq.Cross(qvn) + q.Cross(dqvn);
+        vec3x4 dradial = dqvn * cosV + dww * sinV;
+        *dx = (du + dradial * d) * (-2 * m_scale);
+    }
+    const char* GetShaderSource(vec4& parameters) const
+    {
+        parameters = vec4(m_scale, 0, 0, 0);
+        return TrefoilKnotShaderEquation;
+    }
 private:
     float m_scale;
 };
 
-class MobiusStrip : public ParametricSurface {
+class MobiusStrip : public ParametricSurfaceT<MobiusStrip> {
 public:
     MobiusStrip(float scale) : m_scale(scale)
     {
@@ -146,11 +346,101 @@ public:
         range.z = y;
         return range * m_scale;
     }
+
+    bool EvaluateWithDerivatives(const vec2& domain, vec3& range,
+                                 vec3& dx, vec3& dy) const
+    {
+        float u = domain.x;
+        float t = domain.y;
+        float major = 1.25f;
+        float a = 0.125f;
+        float b = 0.5f;
+        float phi = u / 2;
+
+        float x = a * cos(t) * cos(phi) - b * sin(t) * sin(phi);
+        float y = a * cos(t) * sin(phi) + b * sin(t) * cos(phi);
+
+        // Turning the ellipse by phi = u / 2 rotates (x, y) a quarter as
+        // fast as the sweep.
+        float xu = -y / 2;
+        float yu = x / 2;
+        float xt = -a * sin(t) * cos(phi) - b * cos(t) * sin(phi);
+        float yt = -a * sin(t) * sin(phi) + b * cos(t) * cos(phi);
+
+        range = vec3((major + x) * cos(u), (major + x) * sin(u), y) * m_scale;
+        dx = vec3(xu * cos(u) - (major + x) * sin(u),
+                  xu * sin(u) + (major + x) * cos(u), yu) * m_scale;
+        dy = vec3(xt * cos(u), xt * sin(u), yt) * m_scale;
+        return true;
+    }
+
+    void EvaluateBatch(const float* u, const float* v, int count,
+                       float* range) const
+    {
+        EvaluateBatch4(*this, u, v, count, range, 0, 0);
+    }
+    bool EvaluateBatchWithDerivatives(const float* u, const float* v,
+                                      int count, float* range,
+                                      float* dx, float* dy) const
+    {
+        EvaluateBatch4(*this, u, v, count, range, dx, dy);
+        return true;
+    }
+    // u and phi = u / 2 along the columns, t along the rows.
+    bool GetLatticeAngles(LatticeAngles& angles) const
+    {
+        angles.AddColumn(1, 0);
+        angles.AddColumn(0.5f, 0);
+        angles.AddRow(1, 0);
+        return true;
+    }
+    bool EvaluateLatticeRow(const TrigLattice& lattice, int row,
+                            float* range, float* dx, float* dy) const
+    {
+        EvaluateLatticeRow4(*this, lattice, row, range, dx, dy);
+        return true;
+    }
+    void EvaluateLattice4(const LatticePoint4& p, vec3x4& range,
+                          vec3x4* dx, vec3x4* dy) const
+    {
+        float major = 1.25f;
+        float a = 0.125f;
+        float b = 0.5f;
+
+        const Float4& sinU = p.SinX[0];
+        const Float4& cosU = p.CosX[0];
+        const Float4& sinPhi = p.SinX[1];
+        const Float4& cosPhi = p.CosX[1];
+        const Float4& sinT = p.SinY[0];
+        const Float4& cosT = p.CosY[0];
+
+        Float4 x = a * cosT * cosPhi - b * sinT * sinPhi;
+        Float4 y = a * cosT * sinPhi + b * sinT * cosPhi;
+        Float4 sweep = major + x;
+        range = vec3x4(sweep * cosU, sweep * sinU, y) * m_scale;
+
+        if (dx) {
+            Float4 xu = -y * 0.5f;
+            Float4 yu = x * 0.5f;
+            *dx = vec3x4(xu * cosU - sweep * sinU, xu * sinU + sweep * cosU,
+                         yu) * m_scale;
+        }
+        if (dy) {
+            Float4 xt = -a * sinT * cosPhi - b * cosT * sinPhi;
+            Float4 yt = -a * sinT * sinPhi + b * cosT * cosPhi;
+            *dy = vec3x4(xt * cosU, xt * sinU, yt) * m_scale;
+        }
+    }
+    const char* GetShaderSource(vec4& parameters) const
+    {
+        parameters = vec4(m_scale, 0, 0, 0);
+        return MobiusStripShaderEquation;
+    }
 private:
     float m_scale;
 };
 
-class KleinBottle : public ParametricSurface {
+class KleinBottle : public ParametricSurfaceT<KleinBottle> {
 public:
     KleinBottle(float scale) : m_scale(scale)
     {
@@ -178,15 +468,117 @@ public:
         range.z = (-2 * (1 - cos(u) / 2)) * sin(v);
         return range * m_scale;
     }
+
+    // Same pieces as Evaluate; g = 2 (1 - cos(u) / 2) has g' = sin(u), and
+    // v runs against domain.x.
+    bool EvaluateWithDerivatives(const vec2& domain, vec3& range,
+                                 vec3& dx, vec3& dy) const
+    {
+        float v = 1.f - domain.x;
+        float u = domain.y;
+        float g = 2 * (1 - cos(u) / 2);
+        float bend = 3 * (cos(u) * cos(u) - sin(u) - sin(u) * sin(u));
+
+        vec3 p, pu, pv;
+        if (u < Pi) {
+            p.x = 3 * cos(u) * (1 + sin(u)) + g * cos(u) * cos(v);
+            p.y = 8 * sin(u) + g * sin(u) * cos(v);
+            pu.x = bend + (sin(u) * cos(u) - g * sin(u)) * cos(v);
+            pu.y = 8 * cos(u) + (sin(u) * sin(u) + g * cos(u)) * cos(v);
+            pv.x = -g * cos(u) * sin(v);
+            pv.y = -g * sin(u) * sin(v);
+        } else {
+            p.x = 3 * cos(u) * (1 + sin(u)) + g * cos(v + Pi);
+            p.y = 8 * sin(u);
+            pu.x = bend + sin(u) * cos(v + Pi);
+            pu.y = 8 * cos(u);
+            pv.x = -g * sin(v + Pi);
+            pv.y = 0;
+        }
+        p.z = -g * sin(v);
+        pu.z = -sin(u) * sin(v);
+        pv.z = -g * cos(v);
+
+        range = vec3(p.x, -p.y, p.z) * m_scale;
+        dx = vec3(-pv.x, pv.y, -pv.z) * m_scale;
+        dy = vec3(pu.x, -pu.y, pu.z) * m_scale;
+        return true;
+    }
+
+    void EvaluateBatch(const float* u, const float* v, int count,
+                       float* range) const
+    {
+        EvaluateBatch4(*this, u, v, count, range, 0, 0);
+    }
+    bool EvaluateBatchWithDerivatives(const float* u, const float* v,
+                                      int count, float* range,
+                                      float* dx, float* dy) const
+    {
+        EvaluateBatch4(*this, u, v, count, range, dx, dy);
+        return true;
+    }
+    // v = 1 - domain.x along the columns, u = domain.y along the rows.
+    bool GetLatticeAngles(LatticeAngles& angles) const
+    {
+        angles.AddColumn(-1, 1);
+        angles.AddRow(1, 0);
+        return true;
+    }
+    bool EvaluateLatticeRow(const TrigLattice& lattice, int row,
+                            float* range, float* dx, float* dy) const
+    {
+        EvaluateLatticeRow4(*this, lattice, row, range, dx, dy);
+        return true;
+    }
+    // EvaluateWithDerivatives four points at a time; both pieces are
+    // computed and the lanes pick theirs.
+    void EvaluateLattice4(const LatticePoint4& p, vec3x4& range,
+                          vec3x4* dx, vec3x4* dy) const
+    {
+        const Float4& sinV = p.SinX[0];
+        const Float4& cosV = p.CosX[0];
+        const Float4& sinU = p.SinY[0];
+        const Float4& cosU = p.CosY[0];
+        Float4 g = 2.0f * (1.0f - cosU * 0.5f);
+        Float4 first = p.Y < Float4(Pi);
+
+        Float4 px = 3.0f * cosU * (1.0f + sinU) +
+                    Select(first, g * cosU * cosV, -g * cosV);
+        Float4 py = 8.0f * sinU + Select(first, g * sinU * cosV, 0.0f);
+        Float4 pz = -g * sinV;
+        range = vec3x4(px, -py, pz) * m_scale;
+
+        if (dx) {
+            Float4 pvx = Select(first, -g * cosU * sinV, g * sinV);
+            Float4 pvy = Select(first, -g * sinU * sinV, 0.0f);
+            Float4 pvz = -g * cosV;
+            *dx = vec3x4(-pvx, pvy, -pvz) * m_scale;
+        }
+        if (dy) {
+            Float4 bend = 3.0f * (cosU * cosU - sinU - sinU * sinU);
+            Float4 pux = bend + Select(first,
+                                       (sinU * cosU - g * sinU) * cosV,
+                                       -sinU * cosV);
+            Float4 puy = 8.0f * cosU +
+                         Select(first, (sinU * sinU + g * cosU) * cosV, 0.0f);
+            Float4 puz = -sinU * sinV;
+            *dy = vec3x4(pux, -puy, puz) * m_scale;
+        }
+    }
     bool InvertNormal(const vec2& domain) const
     {
         return domain.y > 3 * Pi / 2;
     }
+    const char* GetShaderSource(vec4& parameters) const
+    {
+        parameters = vec4(m_scale, 0, 0, 0);
+        return KleinBottleShaderEquation;
+    }
 private:
     float m_scale;
 };
 
-class Quad : public ParametricSurface {
+class Quad : public ParametricSurfaceT<Quad> {
 public:
     Quad(float width, float height) : m_size(width, height)
     {
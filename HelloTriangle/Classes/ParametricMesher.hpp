@@ -0,0 +1,434 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+
+#include "ParametricSurface.hpp"
+#include "ThreadPool.hpp"
+
+// Grids with fewer vertices than this are generated on the calling thread.
+static const int MinimumBandVertices = 16384;
+
+// Calls body(begin, end) for contiguous bands of the rows [0, rows) on the
+// shared thread pool. The bands write disjoint rows of outputs sized up
+// front, so they need no locking and the result matches a serial pass.
+// workerCount == 0 cuts four bands per pool thread to balance the load;
+// otherwise there is at most one band per worker, and 1 runs serially.
+template <typename Body>
+void ForEachRowBand(int rows, int columns, const Body& body,
+                    int workerCount = 0)
+{
+    ThreadPool& pool = ThreadPool::Shared();
+    int bandCount = workerCount > 0 ? workerCount : 4 * pool.GetThreadCount();
+    bandCount = std::min(rows, bandCount);
+    bandCount = std::min(bandCount, rows * columns / MinimumBandVertices);
+    if (bandCount <= 1) {
+        body(0, rows);
+        return;
+    }
+
+    pool.ParallelFor(bandCount, [rows, bandCount, &body] (int band) {
+        body(rows * band / bandCount, rows * (band + 1) / bandCount);
+    });
+}
+
+// How the mesher calls into an equation. The calls are qualified with
+// the equation's own type, so they are bound at compile time and can be
+// inlined; only ParametricSurface itself goes through the vtable, for
+// surfaces that do not derive from ParametricSurfaceT.
+template <typename Equation>
+struct EquationCalls {
+    static vec3 Evaluate(const Equation& e, const vec2& domain)
+    {
+        return e.Equation::Evaluate(domain);
+    }
+    static bool InvertNormal(const Equation& e, const vec2& domain)
+    {
+        return e.Equation::InvertNormal(domain);
+    }
+    static void EvaluateBatch(const Equation& e, const float* u,
+                              const float* v, int count, float* range)
+    {
+        e.Equation::EvaluateBatch(u, v, count, range);
+    }
+    static bool EvaluateBatchWithDerivatives(const Equation& e,
+                                             const float* u, const float* v,
+                                             int count, float* range,
+                                             float* dx, float* dy)
+    {
+        return e.Equation::EvaluateBatchWithDerivatives(u, v, count, range,
+                                                        dx, dy);
+    }
+    static bool GetLatticeAngles(const Equation& e, LatticeAngles& angles)
+    {
+        return e.Equation::GetLatticeAngles(angles);
+    }
+    static bool EvaluateLatticeRow(const Equation& e,
+                                   const TrigLattice& lattice, int row,
+                                   float* range, float* dx, float* dy)
+    {
+        return e.Equation::EvaluateLatticeRow(lattice, row, range, dx, dy);
+    }
+};
+
+template <>
+struct EquationCalls<ParametricSurface> {
+    static vec3 Evaluate(const ParametricSurface& e, const vec2& domain)
+    {
+        return e.Evaluate(domain);
+    }
+    static bool InvertNormal(const ParametricSurface& e, const vec2& domain)
+    {
+        return e.InvertNormal(domain);
+    }
+    static void EvaluateBatch(const ParametricSurface& e, const float* u,
+                              const float* v, int count, float* range)
+    {
+        e.EvaluateBatch(u, v, count, range);
+    }
+    static bool EvaluateBatchWithDerivatives(const ParametricSurface& e,
+                                             const float* u, const float* v,
+                                             int count, float* range,
+                                             float* dx, float* dy)
+    {
+        return e.EvaluateBatchWithDerivatives(u, v, count, range, dx, dy);
+    }
+    static bool GetLatticeAngles(const ParametricSurface& e,
+                                 LatticeAngles& angles)
+    {
+        return e.GetLatticeAngles(angles);
+    }
+    static bool EvaluateLatticeRow(const ParametricSurface& e,
+                                   const TrigLattice& lattice, int row,
+                                   float* range, float* dx, float* dy)
+    {
+        return e.EvaluateLatticeRow(lattice, row, range, dx, dy);
+    }
+};
+
+// Generates the vertices of an equation's grid with the attributes chosen
+// at compile time from VertexFlags: a position, the normal and the texture
+// coordinate, which runs from 0 to 1 over the domain. The attribute tests
+// fold away, leaving one straight loop each; the format only places the
+// values, interleaved or planar.
+template <typename Equation, unsigned char Flags>
+struct ParametricMesher {
+    enum {
+        Normals = (Flags & VertexFlagsNormals) != 0,
+        TexCoords = (Flags & VertexFlagsTexCoords) != 0,
+        FloatsPerVertex = 3 + (Normals ? 3 : 0) + (TexCoords ? 2 : 0),
+    };
+
+    // workerCount is passed on to ForEachRowBand.
+    static void Generate(const Equation& equation,
+                         const ParametricInterval& interval,
+                         const VertexFormat& format,
+                         vector<float>& vertices, int workerCount = 0);
+
+private:
+    typedef EquationCalls<Equation> Calls;
+
+    // Domain coordinate of grid line i, which may be fractional, along an
+    // axis with the given lines or, when there are none, even spacing.
+    static float GridCoordinate(const vector<float>& lines, int divisions,
+                                float upperBound, float i)
+    {
+        if (lines.empty())
+            return i * upperBound / (divisions - 1);
+        int k = (int) i;
+        if (k == i)
+            return lines[k];
+        return lines[k] + (i - k) * (lines[k + 1] - lines[k]);
+    }
+
+    static vec2 ComputeDomain(const ParametricInterval& interval,
+                              float i, float j)
+    {
+        return vec2(GridCoordinate(interval.Columns, interval.Divisions.x,
+                                   interval.UpperBound.x, i),
+                    GridCoordinate(interval.Rows, interval.Divisions.y,
+                                   interval.UpperBound.y, j));
+    }
+
+    // Grid rows are in structure of arrays form: x, y, then z values.
+    static vec3 GetGridPoint(const vector<float>& grid, int columns,
+                             int row, int i)
+    {
+        return vec3(grid[row + i], grid[row + columns + i],
+                    grid[row + 2 * columns + i]);
+    }
+
+    static void BuildLattice(const ParametricInterval& interval,
+                             const LatticeAngles& angles,
+                             TrigLattice& lattice);
+    static void ComputeGridDerivatives(const vector<float>& grid,
+                                       const ivec2& divisions, int i, int j,
+                                       vec3& dx, vec3& dy);
+    static vec3 EstimateNormal(const Equation& equation,
+                               const ParametricInterval& interval,
+                               int i, int j);
+};
+
+template <typename Equation, unsigned char Flags>
+void ParametricMesher<Equation, Flags>::Generate(
+    const Equation& equation, const ParametricInterval& interval,
+    const VertexFormat& format, vector<float>& vertices, int workerCount)
+{
+    int columns = interval.Divisions.x;
+    int rows = interval.Divisions.y;
+    int vertexCount = columns * rows;
+    vertices.resize(vertexCount * FloatsPerVertex);
+    VertexAttribute position = format.GetPosition(vertexCount);
+    VertexAttribute normalAttribute = format.GetNormal(vertexCount);
+    VertexAttribute texCoord = format.GetTexCoord(vertexCount);
+
+    // Evaluate the grid a row at a time. Normals come from the analytic
+    // derivatives when the equation has them, else from the neighbouring
+    // samples of the grid, so every row has to be evaluated before the
+    // first normal is taken.
+    vector<float> grid(3 * columns * rows);
+    vector<float> gridDx(Normals ? grid.size() : 0);
+    vector<float> gridDy(Normals ? grid.size() : 0);
+    vector<char> bandAnalytic(rows, Normals);
+
+    // Equations of the sines and cosines of a few angles look them up
+    // from tables of every column and row.
+    LatticeAngles angles;
+    TrigLattice lattice;
+    bool latticed = Calls::GetLatticeAngles(equation, angles);
+    if (latticed)
+        BuildLattice(interval, angles, lattice);
+
+    ForEachRowBand(rows, columns, [&] (int begin, int end) {
+        vector<float> u(columns), v(columns);
+        bool analytic = Normals;
+        for (int j = begin; j < end; j++) {
+            int row = 3 * columns * j;
+            if (latticed && Calls::EvaluateLatticeRow(
+                    equation, lattice, j, &grid[row],
+                    analytic ? &gridDx[row] : 0,
+                    analytic ? &gridDy[row] : 0))
+                continue;
+            for (int i = 0; i < columns; i++) {
+                vec2 domain = ComputeDomain(interval, i, j);
+                u[i] = domain.x;
+                v[i] = domain.y;
+            }
+            if (analytic)
+                analytic = Calls::EvaluateBatchWithDerivatives(
+                    equation, &u[0], &v[0], columns, &grid[row],
+                    &gridDx[row], &gridDy[row]);
+            if (!analytic)
+                Calls::EvaluateBatch(equation, &u[0], &v[0], columns,
+                                     &grid[row]);
+        }
+        bandAnalytic[begin] = analytic;
+    }, workerCount);
+
+    // Derivatives from some rows and differences from others would put a
+    // crease where they meet.
+    bool analytic = std::find(bandAnalytic.begin(), bandAnalytic.end(),
+                              false) == bandAnalytic.end();
+
+    ForEachRowBand(rows, columns, [&] (int begin, int end) {
+        float* base = &vertices[0];
+        for (int j = begin; j < end; j++) {
+            int row = 3 * columns * j;
+            for (int i = 0; i < columns; i++) {
+                int vertex = j * columns + i;
+                vec3 range = GetGridPoint(grid, columns, row, i);
+                range.Write(base + position.Offset + vertex * position.Stride);
+
+                if (Normals) {
+                    vec3 dx, dy;
+                    if (analytic) {
+                        dx = GetGridPoint(gridDx, columns, row, i);
+                        dy = GetGridPoint(gridDy, columns, row, i);
+                    } else {
+                        ComputeGridDerivatives(grid, interval.Divisions, i, j,
+                                               dx, dy);
+                    }
+
+                    // Where the surface pinches to a point, like the poles
+                    // of a sphere, the derivatives give no direction.
+                    vec3 normal = dx.Cross(dy);
+                    float scale = dx.Dot(dx) + dy.Dot(dy);
+                    if (normal.Dot(normal) <= 1e-12f * scale * scale)
+                        normal = EstimateNormal(equation, interval, i, j);
+
+                    normal.Normalize();
+                    if (Calls::InvertNormal(equation,
+                                            ComputeDomain(interval, i, j)))
+                        normal = -normal;
+
+                    normal.Write(base + normalAttribute.Offset +
+                                 vertex * normalAttribute.Stride);
+                }
+
+                if (TexCoords) {
+                    vec2 domain = ComputeDomain(interval, i, j);
+                    float* attribute = base + texCoord.Offset +
+                                       vertex * texCoord.Stride;
+                    attribute[0] = domain.x / interval.UpperBound.x;
+                    attribute[1] = domain.y / interval.UpperBound.y;
+                }
+            }
+        }
+    }, workerCount);
+}
+
+template <typename Equation, unsigned char Flags>
+void ParametricMesher<Equation, Flags>::BuildLattice(
+    const ParametricInterval& interval, const LatticeAngles& angles,
+    TrigLattice& lattice)
+{
+    int columns = interval.Divisions.x;
+    int rows = interval.Divisions.y;
+    int stride = (columns + 3) & ~3;
+    lattice.Angles = angles;
+    lattice.Columns = columns;
+    lattice.Rows = rows;
+    lattice.Stride = stride;
+
+    lattice.X.resize(stride);
+    for (int i = 0; i < stride; i++)
+        lattice.X[i] = ComputeDomain(interval, std::min(i, columns - 1), 0).x;
+    lattice.Y.resize(rows);
+    for (int j = 0; j < rows; j++)
+        lattice.Y[j] = ComputeDomain(interval, 0, j).y;
+
+    lattice.ColumnSin.resize(angles.ColumnCount * stride);
+    lattice.ColumnCos.resize(angles.ColumnCount * stride);
+    for (int k = 0; k < angles.ColumnCount; k++) {
+        const LatticeAngle& angle = angles.Columns[k];
+        for (int i = 0; i < stride; i++) {
+            float a = angle.Scale * lattice.X[i] + angle.Offset;
+            lattice.ColumnSin[k * stride + i] = std::sin(a);
+            lattice.ColumnCos[k * stride + i] = std::cos(a);
+        }
+    }
+
+    lattice.RowSin.resize(angles.RowCount * rows);
+    lattice.RowCos.resize(angles.RowCount * rows);
+    for (int k = 0; k < angles.RowCount; k++) {
+        const LatticeAngle& angle = angles.Rows[k];
+        for (int j = 0; j < rows; j++) {
+            float a = angle.Scale * lattice.Y[j] + angle.Offset;
+            lattice.RowSin[k * rows + j] = std::sin(a);
+            lattice.RowCos[k * rows + j] = std::cos(a);
+        }
+    }
+}
+
+template <typename Equation, unsigned char Flags>
+void ParametricMesher<Equation, Flags>::ComputeGridDerivatives(
+    const vector<float>& grid, const ivec2& divisions, int i, int j,
+    vec3& dx, vec3& dy)
+{
+    // Central differences, one-sided at the edges of the domain.
+    int left = i > 0 ? i - 1 : i;
+    int right = i < divisions.x - 1 ? i + 1 : i;
+    int below = j > 0 ? j - 1 : j;
+    int above = j < divisions.y - 1 ? j + 1 : j;
+    int rowSize = 3 * divisions.x;
+    dx = GetGridPoint(grid, divisions.x, j * rowSize, right) -
+         GetGridPoint(grid, divisions.x, j * rowSize, left);
+    dy = GetGridPoint(grid, divisions.x, above * rowSize, i) -
+         GetGridPoint(grid, divisions.x, below * rowSize, i);
+}
+
+template <typename Equation, unsigned char Flags>
+vec3 ParametricMesher<Equation, Flags>::EstimateNormal(
+    const Equation& equation, const ParametricInterval& interval,
+    int i, int j)
+{
+    float s = i, t = j;
+
+    // Step off the edges of the domain, where the normal is undefined.
+    if (i == 0) s += 0.01f;
+    if (i == interval.Divisions.x - 1) s -= 0.01f;
+    if (j == 0) t += 0.01f;
+    if (j == interval.Divisions.y - 1) t -= 0.01f;
+
+    // Cross two vectors of the tangent plane.
+    vec2 domain = ComputeDomain(interval, s, t);
+    vec2 du = ComputeDomain(interval, s + 0.01f, t);
+    vec2 dv = ComputeDomain(interval, s, t + 0.01f);
+    vec3 p = Calls::Evaluate(equation, domain);
+    vec3 u = Calls::Evaluate(equation, du) - p;
+    vec3 v = Calls::Evaluate(equation, dv) - p;
+    return u.Cross(v);
+}
+
+// Generates the vertices of interval's grid in any VertexFormat, with one
+// specialized mesher per set of attributes.
+template <typename Equation>
+void GenerateParametricVertices(const Equation& equation,
+                                const ParametricInterval& interval,
+                                const VertexFormat& format,
+                                vector<float>& vertices)
+{
+    switch (format.Flags & (VertexFlagsNormals | VertexFlagsTexCoords)) {
+    case 0:
+        ParametricMesher<Equation, 0>::Generate(equation, interval, format,
+                                                vertices);
+        break;
+    case VertexFlagsNormals:
+        ParametricMesher<Equation, VertexFlagsNormals>::Generate(
+            equation, interval, format, vertices);
+        break;
+    case VertexFlagsTexCoords:
+        ParametricMesher<Equation, VertexFlagsTexCoords>::Generate(
+            equation, interval, format, vertices);
+        break;
+    default:
+        ParametricMesher<Equation, VertexFlagsNormals | VertexFlagsTexCoords>::
+            Generate(equation, interval, format, vertices);
+        break;
+    }
+}
+
+// Base for the equations in ParametricEquations.hpp (CRTP): GenerateVertices
+// runs a mesher built for the equation itself, so its Evaluate is inlined
+// into the loop instead of called through ISurface. Equations with SIMD
+// versions of the batch functions hide the scalar loops below.
+template <typename Equation>
+class ParametricSurfaceT : public ParametricSurface {
+public:
+    void GenerateVertices(vector<float>& vertices,
+                          const VertexFormat& format) const
+    {
+        GenerateParametricVertices(static_cast<const Equation&>(*this),
+                                   GetInterval(), format, vertices);
+    }
+    void EvaluateBatch(const float* u, const float* v, int count,
+                       float* range) const
+    {
+        const Equation& equation = static_cast<const Equation&>(*this);
+        for (int i = 0; i < count; i++) {
+            vec3 p = equation.Equation::Evaluate(vec2(u[i], v[i]));
+            range[i] = p.x;
+            range[count + i] = p.y;
+            range[2 * count + i] = p.z;
+        }
+    }
+    bool EvaluateBatchWithDerivatives(const float* u, const float* v,
+                                      int count, float* range,
+                                      float* dx, float* dy) const
+    {
+        const Equation& equation = static_cast<const Equation&>(*this);
+        for (int i = 0; i < count; i++) {
+            vec3 p, pdx, pdy;
+            if (!equation.Equation::EvaluateWithDerivatives(vec2(u[i], v[i]),
+                                                            p, pdx, pdy))
+                return false;
+            const vec3* sources[3] = { &p, &pdx, &pdy };
+            float* targets[3] = { range, dx, dy };
+            for (int o = 0; o < 3; o++) {
+                targets[o][i] = sources[o]->x;
+                targets[o][count + i] = sources[o]->y;
+                targets[o][2 * count + i] = sources[o]->z;
+            }
+        }
+        return true;
+    }
+};
@@ -1,111 +1,391 @@
+#include <algorithm>
+
 #include "Interfaces.hpp"
-#include "ParametricSurface.hpp"
+#include "ParametricMesher.hpp"
 
 void ParametricSurface::SetInterval(const ParametricInterval& interval)
 {
     m_upperBound = interval.UpperBound;
     m_divisions = interval.Divisions;
     m_slices = m_divisions - ivec2(1, 1);
+    m_columns = interval.Columns;
+    m_rows = interval.Rows;
 }
 
-int ParametricSurface::GetVertexCount() const
+ParametricInterval ParametricSurface::GetInterval() const
 {
-    return m_divisions.x * m_divisions.y;
+    ParametricInterval interval = { m_divisions, m_upperBound };
+    interval.Columns = m_columns;
+    interval.Rows = m_rows;
+    return interval;
 }
 
-int ParametricSurface::GetLineIndexCount() const
+// Samples along each axis of the grid that measures how the surface bends.
+static const int CurvatureSamples = 129;
+// The most grid lines SetChordalTolerance places along one axis.
+static const int MaximumGridLines = 1025;
+// Steps along each side of a cell at which GridFits measures it.
+static const int CellSamples = 8;
+
+// Distance of p from the line through a and b, or from a when they meet.
+static float DistanceFromLine(const vec3& p, const vec3& a, const vec3& b)
 {
-    return 4 * m_slices.x * m_slices.y;
+    vec3 d = p - a, e = b - a;
+    float length = e.Dot(e);
+    if (length > 0)
+        d -= e * (d.Dot(e) / length);
+    return sqrt(d.Dot(d));
 }
 
-int ParametricSurface::GetTriangleIndexCount() const
+// Distance of p from the segment from a to b.
+static float DistanceFromSegment(const vec3& p, const vec3& a, const vec3& b)
 {
-	return 6 * m_slices.x * m_slices.y;
+    vec3 d = p - a, e = b - a;
+    float length = e.Dot(e);
+    if (length > 0)
+        d -= e * std::max(0.0f, std::min(d.Dot(e) / length, 1.0f));
+    return sqrt(d.Dot(d));
 }
 
-vec2 ParametricSurface::ComputeDomain(float x, float y) const
+// Distance of p from the nearest point of the triangle abc: from its
+// plane when p lies over it, else from its nearest edge. A triangle that
+// has collapsed to a line, as at the poles of a sphere, is only edges.
+static float DistanceFromTriangle(const vec3& p, const vec3& a,
+                                  const vec3& b, const vec3& c)
 {
-    return vec2(x * m_upperBound.x / m_slices.x,
-                y * m_upperBound.y / m_slices.y);
+    vec3 n = (b - a).Cross(c - a);
+    float area = n.Dot(n);
+    if (area > 0 && n.Dot((b - a).Cross(p - a)) >= 0 &&
+        n.Dot((c - b).Cross(p - b)) >= 0 && n.Dot((a - c).Cross(p - c)) >= 0)
+        return fabs((p - a).Dot(n)) / sqrt(area);
+    return std::min(DistanceFromSegment(p, a, b),
+                    std::min(DistanceFromSegment(p, b, c),
+                             DistanceFromSegment(p, c, a)));
 }
 
-void ParametricSurface::GenerateVertices(vector<float>& vertices,
-                                         unsigned char flags) const
+// Distance of p from the nearer of the two triangles of a grid cell.
+static float DistanceFromCell(const vec3& p, const vec3& p00,
+                              const vec3& p10, const vec3& p01,
+                              const vec3& p11)
 {
-    // ﰢ ϱ  3 ŭ 뷮 ø.
-    int floatsPerVertex = 3;
+    return std::min(DistanceFromTriangle(p, p00, p10, p01),
+                    DistanceFromTriangle(p, p10, p11, p01));
+}
 
-    //  Normal vector ʿϴٸ ߰ 3 ŭ   ø.
-    if (flags & VertexFlagsNormals)
-        floatsPerVertex += 3;
+// Places lines along an axis so that the segments between them cover
+// equal shares of the integral of density, which is sampled at even steps
+// over the axis, with one segment for every scale units of it.
+static void PlaceGridLines(const vector<float>& density, float upperBound,
+                           float scale, vector<float>& lines)
+{
+    int samples = (int) density.size();
+    float step = upperBound / (samples - 1);
+    vector<float> integral(samples, 0);
+    for (int k = 1; k < samples; k++)
+        integral[k] = integral[k - 1] +
+                      (density[k - 1] + density[k]) * step * scale / 2;
 
-    vertices.resize(GetVertexCount() * floatsPerVertex);
-    float* attribute = (float*)&vertices[0];
+    int segments = (int) ceil(integral.back());
+    segments = std::max(1, std::min(segments, MaximumGridLines - 1));
+    lines.resize(segments + 1);
+    lines[0] = 0;
+    lines[segments] = upperBound;
+    for (int s = 1, k = 0; s < segments; s++) {
+        float target = integral.back() * s / segments;
+        while (integral[k + 1] < target)
+            ++k;
+        float t = (target - integral[k]) / (integral[k + 1] - integral[k]);
+        lines[s] = (k + t) * step;
+    }
+}
 
-    for (int j = 0; j < m_divisions.y; j++) {
-		for (int i = 0; i < m_divisions.x; i++) {
+void ParametricSurface::SetChordalTolerance(float tolerance)
+{
+    if (!(tolerance > 0))
+        return;
 
-            // ġ 
-			vec2 domain = ComputeDomain(i, j);
-			vec3 range = Evaluate(domain);
-            attribute = range.Write(attribute);
+    // A chord of length h strays about |P''| h^2 / 8 from a curve, where
+    // P'' is the part of its second derivative normal to it, so the lines
+    // along an axis need to be sqrt(|P''| / (8 tolerance)) to a unit of the
+    // domain. They span the whole domain, so take the largest |P''| across
+    // the other axis, measured from the sag of each sample below the chord
+    // of its neighbours.
+    const int n = CurvatureSamples;
+    vec2 step = m_upperBound / (float) (n - 1);
+    vector<vec3> points(n * n);
+    for (int j = 0; j < n; j++)
+        for (int i = 0; i < n; i++)
+            points[j * n + i] = Evaluate(vec2(i * step.x, j * step.y));
 
-            // Normal calcurate
-            if (flags & VertexFlagsNormals) {
-                float s = i, t = j;
+    vector<float> columnDensity(n, 0), rowDensity(n, 0);
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < n; i++) {
+            const vec3* p = &points[j * n + i];
+            if (i > 0 && i < n - 1) {
+                float sag = DistanceFromLine(*p, p[-1], p[1]);
+                columnDensity[i] = std::max(columnDensity[i], 2 * sag);
+            }
+            if (j > 0 && j < n - 1) {
+                float sag = DistanceFromLine(*p, p[-n], p[n]);
+                rowDensity[j] = std::max(rowDensity[j], 2 * sag);
+            }
+        }
+    }
+    for (int k = 1; k < n - 1; k++) {
+        columnDensity[k] = sqrt(columnDensity[k] /
+                                (8 * tolerance * step.x * step.x));
+        rowDensity[k] = sqrt(rowDensity[k] /
+                             (8 * tolerance * step.y * step.y));
+    }
+    columnDensity[0] = columnDensity[1];
+    columnDensity[n - 1] = columnDensity[n - 2];
+    rowDensity[0] = rowDensity[1];
+    rowDensity[n - 1] = rowDensity[n - 2];
 
-                //     ,  ణ Ų.
-                if (i == 0) s += 0.01f;
-                if (i == m_divisions.x - 1) s -= 0.01f;
-                if (j == 0) t += 0.01f;
-                if (j == m_divisions.y - 1) t -= 0.01f;
+    // The estimate leaves out the twist of the cells and anything finer
+    // than the samples, so add lines until the grid as a whole fits. Where
+    // the surface creases, as the Klein bottle does halfway, the error
+    // peaks between GridFits' samples; it falls off at most linearly to
+    // the cell's sides, so the nearest sample sees at least 1 - 1 /
+    // CellSamples of it, and the samples are held to that much less.
+    float measured = tolerance * (CellSamples - 1) / CellSamples;
+    for (float scale = 1; ; scale *= 1.25f) {
+        PlaceGridLines(columnDensity, m_upperBound.x, scale, m_columns);
+        PlaceGridLines(rowDensity, m_upperBound.y, scale, m_rows);
+        if ((int) m_columns.size() == MaximumGridLines ||
+            (int) m_rows.size() == MaximumGridLines || GridFits(measured))
+            break;
+    }
 
-                //    Ѵ.
-                vec3 p = Evaluate(ComputeDomain(s, t));
-                vec3 u = Evaluate(ComputeDomain(s + 0.01f, t)) - p;
-                vec3 v = Evaluate(ComputeDomain(s, t + 0.01f)) - p;
+    m_divisions = ivec2((int) m_columns.size(), (int) m_rows.size());
+    m_slices = m_divisions - ivec2(1, 1);
+}
+
+// Largest distance between the surface and the straight edge from pa to
+// pb standing in for it between the domain points a and b, sampled at
+// CellSamples steps.
+float ParametricSurface::EdgeError(const vec2& a, const vec2& b,
+                                  const vec3& pa, const vec3& pb) const
+{
+    float error = 0;
+    for (int k = 1; k < CellSamples; k++) {
+        vec3 p = Evaluate(a.Lerp((float) k / CellSamples, b));
+        error = std::max(error, DistanceFromLine(p, pa, pb));
+    }
+    return error;
+}
 
-                vec3 normal = u.Cross(v).Normalized();
-                if (InvertNormal(domain))
-                    normal = -normal;
+bool ParametricSurface::GridFits(float tolerance) const
+{
+    int width = (int) m_columns.size();
+    int height = (int) m_rows.size();
+    vector<vec3> points(width * height);
+    for (int j = 0; j < height; j++)
+        for (int i = 0; i < width; i++)
+            points[j * width + i] = Evaluate(vec2(m_columns[i], m_rows[j]));
 
-                attribute = normal.Write(attribute);
+    for (int j = 0; j < height - 1; j++) {
+        for (int i = 0; i < width - 1; i++) {
+            vec2 d00(m_columns[i], m_rows[j]);
+            vec2 d11(m_columns[i + 1], m_rows[j + 1]);
+            vec2 d10(d11.x, d00.y), d01(d00.x, d11.y);
+            const vec3& p00 = points[j * width + i];
+            const vec3& p10 = points[j * width + i + 1];
+            const vec3& p01 = points[(j + 1) * width + i];
+            const vec3& p11 = points[(j + 1) * width + i + 1];
+
+            // The bottom and left edges; the others belong to the cells
+            // above and to the right, or are the last row or column.
+            if (EdgeError(d00, d10, p00, p10) > tolerance ||
+                EdgeError(d00, d01, p00, p01) > tolerance)
+                return false;
+            if (j == height - 2 && EdgeError(d01, d11, p01, p11) > tolerance)
+                return false;
+            if (i == width - 2 && EdgeError(d10, d11, p10, p11) > tolerance)
+                return false;
+
+            // A twisted cell can have straight edges and still bulge away
+            // from its two triangles, which meet on the p10-p01 diagonal.
+            for (int t = 1; t < CellSamples; t++) {
+                for (int s = 1; s < CellSamples; s++) {
+                    vec2 d(d00.x + (d11.x - d00.x) * s / CellSamples,
+                           d00.y + (d11.y - d00.y) * t / CellSamples);
+                    if (DistanceFromCell(Evaluate(d), p00, p10, p01,
+                                         p11) > tolerance)
+                        return false;
+                }
             }
-		}
+        }
+    }
+    return true;
+}
+
+int ParametricSurface::GetVertexCount() const
+{
+    return m_divisions.x * m_divisions.y;
+}
+
+int ParametricSurface::GetLineIndexCount() const
+{
+    return 4 * m_slices.x * m_slices.y;
+}
+
+int ParametricSurface::GetTriangleIndexCount() const
+{
+	return 6 * m_slices.x * m_slices.y;
+}
+
+int ParametricSurface::GetTriangleStripIndexCount() const
+{
+    // Two indices per column for every row of quads, plus two to join
+    // each row to the one before, or one to start the first.
+    return m_slices.y * (2 * m_divisions.x + 2) - 1;
+}
+
+int ParametricSurface::GetIndexSize() const
+{
+    return GetVertexCount() > 65536 ? 4 : 2;
+}
+
+void ParametricSurface::GenerateVertices(vector<float>& vertices,
+                                         const VertexFormat& format) const
+{
+    // Surfaces deriving from ParametricSurfaceT have their own, inlined
+    // meshers; this one calls the equation through the vtable.
+    GenerateParametricVertices(*this, GetInterval(), format, vertices);
+}
+
+void ParametricSurface::EvaluateBatch(const float* u, const float* v,
+                                      int count, float* range) const
+{
+    for (int i = 0; i < count; i++) {
+        vec3 p = Evaluate(vec2(u[i], v[i]));
+        range[i] = p.x;
+        range[count + i] = p.y;
+        range[2 * count + i] = p.z;
     }
 }
 
+bool ParametricSurface::EvaluateBatchWithDerivatives(const float* u,
+                                                     const float* v,
+                                                     int count, float* range,
+                                                     float* dx,
+                                                     float* dy) const
+{
+    for (int i = 0; i < count; i++) {
+        vec3 p, pdx, pdy;
+        if (!EvaluateWithDerivatives(vec2(u[i], v[i]), p, pdx, pdy))
+            return false;
+        const vec3* sources[3] = { &p, &pdx, &pdy };
+        float* targets[3] = { range, dx, dy };
+        for (int o = 0; o < 3; o++) {
+            targets[o][i] = sources[o]->x;
+            targets[o][count + i] = sources[o]->y;
+            targets[o][2 * count + i] = sources[o]->z;
+        }
+    }
+    return true;
+}
+
 void ParametricSurface::GenerateLineIndices(vector<unsigned short>& indices) const
 {
     indices.resize(GetLineIndexCount());
-    vector<unsigned short>::iterator index = indices.begin();
-    for (int j = 0, vertex = 0; j < m_slices.y; j++) {
-        for (int i = 0; i < m_slices.x; i++) {
-            *index++ = vertex + i;
-            *index++ = vertex + i+1;
-            *index++ = vertex + i;
-            *index++ = vertex + i + m_divisions.x;
+    int slices = m_slices.x, columns = m_divisions.x;
+    ForEachRowBand(m_slices.y, columns, [&] (int begin, int end) {
+        vector<unsigned short>::iterator index =
+            indices.begin() + 4 * slices * begin;
+        for (int j = begin; j < end; j++) {
+            int vertex = j * columns;
+            for (int i = 0; i < slices; i++) {
+                *index++ = vertex + i;
+                *index++ = vertex + i+1;
+                *index++ = vertex + i;
+                *index++ = vertex + i + columns;
+            }
         }
-        vertex += m_divisions.x;
-    }
+    });
 }
 
 void ParametricSurface::GenerateTriangleIndices(vector<unsigned short>& indices)
 																		const
+{
+	WriteTriangleIndices(indices);
+}
+
+void ParametricSurface::GenerateTriangleIndices(vector<unsigned int>& indices)
+																		const
+{
+	WriteTriangleIndices(indices);
+}
+
+template <typename Index>
+void ParametricSurface::WriteTriangleIndices(vector<Index>& indices) const
 {
 	indices.resize(GetTriangleIndexCount());
-	vector<unsigned short>::iterator index = indices.begin();
-	for (int j = 0, vertex = 0; j < m_slices.y; j++) {
-		for (int i = 0; i < m_slices.x; i++) {
-			int next = (i + 1) % m_divisions.x;
-            *index++ = vertex + i;
-            *index++ = vertex + next;
-            *index++ = vertex + i + m_divisions.x;
-            *index++ = vertex + next;
-            *index++ = vertex + next + m_divisions.x;
-            *index++ = vertex + i + m_divisions.x;
+	int slices = m_slices.x, columns = m_divisions.x;
+	ForEachRowBand(m_slices.y, columns, [&] (int begin, int end) {
+		typename vector<Index>::iterator index =
+			indices.begin() + 6 * slices * begin;
+		for (int j = begin; j < end; j++) {
+			int vertex = j * columns;
+			for (int i = 0; i < slices; i++) {
+				int next = (i + 1) % columns;
+				*index++ = vertex + i;
+				*index++ = vertex + next;
+				*index++ = vertex + i + columns;
+				*index++ = vertex + next;
+				*index++ = vertex + next + columns;
+				*index++ = vertex + i + columns;
+			}
 		}
-		vertex += m_divisions.x;
-	}
+	});
 }
 
+void ParametricSurface::GenerateTriangleStripIndices(vector<unsigned int>& indices)
+                                                                        const
+{
+    indices.resize(GetTriangleStripIndexCount());
+    int columns = m_divisions.x;
+    int rowSize = 2 * columns + 2;
+    ForEachRowBand(m_slices.y, columns, [&] (int begin, int end) {
+        vector<unsigned int>::iterator index =
+            indices.begin() + std::max(0, begin * rowSize - 1);
+        for (int j = begin; j < end; j++) {
+            int vertex = j * columns;
+            // GL reverses every other triangle of a strip, so each row
+            // starts its first triangle at an odd position, which gives
+            // the winding of GenerateTriangleIndices. Repeating the last
+            // vertex of the row before and the first of this one joins
+            // them with triangles that have no area.
+            if (j > 0)
+                *index++ = vertex + columns - 1;
+            *index++ = vertex;
+            for (int i = 0; i < columns; i++) {
+                *index++ = vertex + i;
+                *index++ = vertex + i + columns;
+            }
+        }
+    });
+}
+
+bool ParametricSurface::GetShaderEquation(ShaderEquation& equation) const
+{
+    equation.Source = GetShaderSource(equation.Parameters);
+    if (!equation.Source)
+        return false;
+    equation.UpperBound = m_upperBound;
+
+    // Scaled to [0, 1], surfaces of the same divisions get the same grid
+    // whatever their domain.
+    equation.Grid.resize(2 * GetVertexCount());
+    vector<float>::iterator coordinate = equation.Grid.begin();
+    for (int j = 0; j < m_divisions.y; j++) {
+        for (int i = 0; i < m_divisions.x; i++) {
+            *coordinate++ = m_columns.empty() ? (float) i / m_slices.x
+                                              : m_columns[i] / m_upperBound.x;
+            *coordinate++ = m_rows.empty() ? (float) j / m_slices.y
+                                           : m_rows[j] / m_upperBound.y;
+        }
+    }
+    return true;
+}
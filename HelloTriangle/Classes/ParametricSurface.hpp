@@ -1,8 +1,58 @@
+#pragma once
 #include "Interfaces.hpp"
 
 struct ParametricInterval {
     ivec2 Divisions;
     vec2 UpperBound;
+    // Domain coordinates of the grid's columns and rows, when they are not
+    // evenly spaced; see ParametricSurface::SetChordalTolerance.
+    vector<float> Columns;
+    vector<float> Rows;
+};
+
+static const int MaxLatticeAngles = 4;
+
+// The angles an equation takes the sine and cosine of, each Scale times
+// domain.x (a column angle) or domain.y (a row angle), plus Offset.
+struct LatticeAngle {
+    float Scale;
+    float Offset;
+};
+
+struct LatticeAngles {
+    LatticeAngles() : ColumnCount(0), RowCount(0) {}
+    void AddColumn(float scale, float offset)
+    {
+        LatticeAngle angle = { scale, offset };
+        Columns[ColumnCount++] = angle;
+    }
+    void AddRow(float scale, float offset)
+    {
+        LatticeAngle angle = { scale, offset };
+        Rows[RowCount++] = angle;
+    }
+    int ColumnCount;
+    int RowCount;
+    LatticeAngle Columns[MaxLatticeAngles];
+    LatticeAngle Rows[MaxLatticeAngles];
+};
+
+// The sines and cosines of an equation's angles over a grid. Its columns
+// and rows take only Columns + Rows distinct values of them, so they are
+// computed once into tables rather than at every point. The column tables
+// are padded to a multiple of four with copies of the last column.
+struct TrigLattice {
+    LatticeAngles Angles;
+    int Columns;
+    int Rows;
+    int Stride;
+    vector<float> X;
+    vector<float> Y;
+    // Angle k of column i is at k * Stride + i, of row j at k * Rows + j.
+    vector<float> ColumnSin;
+    vector<float> ColumnCos;
+    vector<float> RowSin;
+    vector<float> RowCos;
 };
 
 class ParametricSurface : public ISurface {
@@ -10,19 +60,73 @@ public:
     int GetVertexCount() const;
     int GetLineIndexCount() const;
 	int GetTriangleIndexCount() const;
-    void GenerateVertices(vector<float>& vertices, unsigned char flags) const;
+    int GetIndexSize() const;
+    void GenerateVertices(vector<float>& vertices,
+                          const VertexFormat& format) const;
     void GenerateLineIndices(vector<unsigned short>& indices) const;
 	void GenerateTriangleIndices(vector<unsigned short>& indices) const;
+	void GenerateTriangleIndices(vector<unsigned int>& indices) const;
+    int GetTriangleStripIndexCount() const;
+    void GenerateTriangleStripIndices(vector<unsigned int>& indices) const;
+    bool GetShaderEquation(ShaderEquation& equation) const;
+    // Replaces the even grid with one whose columns and rows are placed
+    // where the surface bends, so that no triangle strays more than
+    // tolerance from the surface. The grid stays a full tensor product,
+    // so neighbouring triangles always share their edges. No grid meets a
+    // tolerance of 0 or less, so that leaves the grid as it is.
+    void SetChordalTolerance(float tolerance);
 
 protected:
+    template <typename Equation> friend struct EquationCalls;
     void SetInterval(const ParametricInterval& interval);
+    ParametricInterval GetInterval() const;
     virtual vec3 Evaluate(const vec2& domain) const = 0;
+    // Optional: the point along with its partial derivatives along
+    // domain.x and domain.y, for exact normals. Returns false when the
+    // surface does not implement it.
+    virtual bool EvaluateWithDerivatives(const vec2& domain, vec3& range,
+                                         vec3& dx, vec3& dy) const
+    {
+        return false;
+    }
     virtual bool InvertNormal(const vec2& domain) const { return false; }
+    // Optional: Evaluate in GLSL, as described by ShaderEquation, with its
+    // InvertNormal folded in; parameters receives what it reads from
+    // Parameters. Returns 0 when the surface has none.
+    virtual const char* GetShaderSource(vec4& parameters) const { return 0; }
+    // Batch versions of the two above for count points in structure of
+    // arrays form: range, dx and dy receive all the x values, then all
+    // the y, then all the z. The defaults loop over the scalar functions,
+    // which stay the reference for the SIMD overrides.
+    virtual void EvaluateBatch(const float* u, const float* v, int count,
+                               float* range) const;
+    virtual bool EvaluateBatchWithDerivatives(const float* u, const float* v,
+                                              int count, float* range,
+                                              float* dx, float* dy) const;
+    // Optional: the angles the equation is made of, and one row of the
+    // batch functions above for a grid, with the sines and cosines looked
+    // up in lattice; dx and dy may be 0. Both return false when the
+    // surface does not implement them.
+    virtual bool GetLatticeAngles(LatticeAngles& angles) const
+    {
+        return false;
+    }
+    virtual bool EvaluateLatticeRow(const TrigLattice& lattice, int row,
+                                    float* range, float* dx, float* dy) const
+    {
+        return false;
+    }
 
 private:
-    vec2 ComputeDomain(float i, float j) const;
+    template <typename Index>
+    void WriteTriangleIndices(vector<Index>& indices) const;
+    float EdgeError(const vec2& a, const vec2& b,
+                    const vec3& pa, const vec3& pb) const;
+    bool GridFits(float tolerance) const;
     vec2 m_upperBound;
     ivec2 m_slices;
     ivec2 m_divisions;
+    vector<float> m_columns;
+    vector<float> m_rows;
 };
 
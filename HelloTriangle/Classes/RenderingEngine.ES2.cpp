@@ -2,8 +2,18 @@
 #include <GLES2/gl2ext.h>
 #include "Interfaces.hpp"
 #include "Matrix.hpp"
+#include "MeshSplitter.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshSimplifier.hpp"
+#include "MeshCache.hpp"
+#include "GLStateCache.hpp"
 #include <iostream>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 
 namespace ES2 {
 
@@ -13,6 +23,10 @@ namespace ES2 {
 #include "../Shaders/PixelLighting.frag"
 #include "../Shaders/Simple.vert"
 #include "../Shaders/Simple.frag"
+#include "../Shaders/ParametricSurface.vert"
+#include "../Shaders/InstancedLighting.vert"
+#include "../Shaders/Thumbnail.vert"
+#include "../Shaders/Thumbnail.frag"
 
 struct AttributeHandle
 {
@@ -28,8 +42,12 @@ struct AttributeLineHandle
     GLuint Color;
 };
 
+// Programs take either ModelviewProjection, which saves the vertex shader
+// a matrix product, or Projection and Modelview; the other locations are
+// -1.
 struct UniformHandle
 {
+    GLint ModelviewProjection;
     GLint Projection;
     GLint Modelview;
     GLint NormalMatrix;
@@ -40,30 +58,276 @@ struct UniformHandle
 
 struct UniformLineHandle
 {
+    GLint ModelviewProjection;
     GLint Projection;
     GLint Modelview;
 };
 
+// ParametricSurfaceVertexShader built with one ShaderEquation's source;
+// the lighting is the same as for the other triangles.
+struct EquationProgram {
+    const char* Source;
+    GLuint Program;
+    GLuint Grid;
+    GLuint DiffuseMaterial;
+    UniformHandle Uniform;
+    GLint UpperBound;
+    GLint Parameters;
+};
+
+// Part of a surface that was too large for 16-bit indices on a device
+// without OES_element_index_uint; it has its own copy of the vertices.
+struct Submesh {
+    GLuint VertexBuffer;
+    int VertexCount;
+    GLuint TriangleIndexBuffer;
+    int TriangleIndexCount;
+    GLuint VertexArray;
+};
+
+// A simplified triangle list over the vertices of its drawable; a range
+// of the drawable's LodIndexBuffer.
+struct LodLevel {
+    int FirstIndex;
+    int TriangleIndexCount;
+    // Geometric error in model units.
+    float Error;
+};
+
+// Fractions of the triangles kept by each level of detail.
+static const float LodRatios[] = { 0.5f, 0.25f, 0.1f };
+static const int LodCount = sizeof(LodRatios) / sizeof(LodRatios[0]);
+
+// The largest error, in pixels, a level of detail may show on screen.
+static const float LodPixelError = 2.0f;
+
+// A coarser level is only taken once its error is this far below the
+// limit, so a viewport hovering around a switch does not keep popping.
+static const float LodHysteresis = 0.75f;
+
+// Copies of a drawable BatchedLightingVertexShader draws at once; its
+// uniform arrays have this many elements, which fits them in the 128
+// vectors every device has.
+static const int MaxBatchInstances = 32;
+
+// The most vertices the copies of a batch may have together, which keeps
+// their indices 16-bit. Surfaces too large for two copies go without.
+static const int BatchVertexLimit = 16384;
+
+// PixelLighting for many copies of a drawable. InstancedLighting takes
+// each copy's orientation, viewport and color as instanced arrays;
+// BatchedLighting takes them from uniform arrays, indexed by the copy of
+// the vertices drawn. Locations the program does not have are -1.
+struct InstanceProgram {
+    GLuint Program;
+    GLuint Position;
+    GLuint Normal;
+    GLuint InstanceOrientation;
+    GLuint InstanceViewport;
+    GLuint DiffuseMaterial;
+    GLuint InstanceIndex;
+    GLint Projection;
+    GLint Translation;
+    GLint InstanceOrientations;
+    GLint InstanceViewports;
+    GLint InstanceColors;
+};
+
+// What the instance buffer holds for each copy. Viewport scales and
+// offsets clip space, from the viewport around all the copies to the
+// copy's own.
+struct Instance {
+    vec4 Orientation;
+    vec4 Viewport;
+    vec3 Color;
+};
+
+// Width and height of the texture static visuals are drawn into.
+static const int ThumbnailAtlasSize = 512;
+
+// A static visual drawn into the atlas, with its lower left corner at
+// LowerLeft there. It can be copied for as long as the visual looks the
+// same: the same drawable, color, orientation and size. Place is the part
+// of the atlas it holds, which may be larger than Size when it took over
+// the place of another; Drawable is -1 while the place is free.
+struct Thumbnail {
+    int Drawable;
+    vec3 Color;
+    Quaternion Orientation;
+    ivec2 Size;
+    ivec2 LowerLeft;
+    ivec2 Place;
+    // The last frame that drew or copied it, and the one that drew it.
+    int LastUsed;
+    int Drawn;
+    // The pixels the visual covered, which a later copy need not light.
+    int Fragments;
+};
+
 struct Drawable {
     GLuint VertexBuffer;
+    int VertexCount;
     GLuint TriangleIndexBuffer;
     int TriangleIndexCount;
+    GLenum TriangleIndexType;
+    // GL_TRIANGLE_STRIP when the surface is drawn as one strip.
+    GLenum TrianglePrimitive;
 	GLuint LineIndexBuffer;
 	int LineIndexCount;
+	// When non-empty, these are drawn instead of the buffers above.
+	vector<Submesh> Submeshes;
+	// Coarser triangle lists, finest first, for small viewports.
+	GLuint LodIndexBuffer;
+	vector<LodLevel> Lods;
+	// The level drawn last frame, or -1 for full detail.
+	mutable int CurrentLod;
+	// Bounding sphere of the vertices, in model space.
+	vec3 BoundsCenter;
+	float BoundsRadius;
+	// For surfaces evaluated by the vertex shader, the program in
+	// m_equations and its uniforms; VertexBuffer is then the shared grid.
+	// -1 for the others.
+	int Equation;
+	vec4 Parameters;
+	vec2 UpperBound;
+	// Hash of the surface's triangle indices and its vertex and index
+	// counts, or of its grid when the vertex shader evaluates it; a
+	// surface with the same one fits the buffers. VertexRemap moves its
+	// vertices to where PrepareMesh put them, or is empty when they
+	// stayed in place.
+	unsigned long long Topology;
+	vector<GLuint> VertexRemap;
+	// With OES_vertex_array_object, the attribute arrays and index buffer
+	// of each draw, recorded once; 0 for draws that set them up anew.
+	GLuint TriangleVertexArray;
+	GLuint LodVertexArray;
+	GLuint LineVertexArray;
+	// Without instanced arrays, BatchSize copies of the vertices, followed
+	// by the index of the copy each one is in, and copies of the triangle
+	// lists. BatchFirstIndices has where the copies of the full detail list
+	// start, then those of each level, then the end. BatchSize is 0 for
+	// drawables RenderInstances draws one copy at a time.
+	int BatchSize;
+	GLuint BatchVertexBuffer;
+	GLuint BatchIndexBuffer;
+	vector<int> BatchFirstIndices;
 };
 
+// A buffer CreateBuffer made, for as long as a drawable uses it. Another
+// with the same target, size and 64-bit hash of its contents shares it;
+// the contents themselves are not kept.
+struct SharedBuffer {
+    GLenum Target;
+    int Size;
+    unsigned long long Hash;
+    int References;
+};
+
+// Points the attribute at location to its floats in the buffer bound to
+// GL_ARRAY_BUFFER, wherever the vertex format puts them.
+static void SetVertexAttribPointer(GLuint location,
+                                   const VertexAttribute& attribute)
+{
+    glVertexAttribPointer(location, attribute.Size, GL_FLOAT, GL_FALSE,
+                          attribute.Stride * sizeof(float),
+                          (const GLvoid*) (attribute.Offset * sizeof(float)));
+}
+
 class RenderingEngine : public IRenderingEngine {
 public:
-    RenderingEngine();
+    RenderingEngine(unsigned char flags);
     void Initialize(const vector<ISurface*>& surfaces);
+    void UpdateSurface(int index, ISurface* surface);
     void Render(const vector<Visual>& visuals) const;
+    void RenderInstances(int index, const vector<Visual>& instances) const;
+    RenderStatistics GetStatistics() const;
 private:
     GLuint BuildShader(const char* source, GLenum shaderType) const;
     GLuint BuildProgram(const char* vShader, const char* fShader) const;
-	void RenderTriangles(mat4& modelview, mat4& projectionMatrix, const vec3& color, const Drawable& drawable) const;
+    bool HasExtension(const char* name) const;
+    bool LoadInstancedArrays();
+    void CreateInstanceProgram();
+    void CreateThumbnailAtlas();
+    void CreateDrawable(const ISurface& surface, Drawable& drawable);
+    void ReleaseDrawable(const Drawable& drawable);
+    void CreateVertexArrays(Drawable& drawable);
+    void ReleaseVertexArrays(const Drawable& drawable);
+    unsigned long long ComputeTopology(const ISurface& surface);
+    void PrepareMesh(const ISurface& surface, vector<float>& vertices,
+                     vector<GLuint>& indices, vector<GLuint>& vertexRemap) const;
+    void PrepareStrip(const ISurface& surface, const vector<GLuint>& indices,
+                      const vector<GLuint>& vertexRemap,
+                      vector<GLuint>& strip) const;
+    GLuint CreateBuffer(GLenum target, const void* data, int size);
+    void ReleaseBuffer(GLuint buffer, int& bufferBytes);
+    void DeleteBuffer(GLuint buffer, int& bufferBytes);
+    int FindEquationProgram(const char* source);
+    void CreateEquationBuffers(const ISurface& surface,
+                               const ShaderEquation& equation,
+                               Drawable& drawable);
+    void CreateSplitTriangleBuffers(const vector<GLuint>& indices,
+                                    const vector<float>& vertices,
+                                    Drawable& drawable);
+    void CreateLodBuffers(const vector<GLuint>& indices,
+                          const vector<float>& vertices,
+                          Drawable& drawable,
+                          vector<GLuint>& lodIndices);
+    void CreateBatchBuffers(const vector<GLuint>& indices,
+                            const vector<GLuint>& lodIndices,
+                            const vector<float>& vertices,
+                            Drawable& drawable);
+    void FillBatchVertices(const vector<float>& vertices, int batchSize,
+                           vector<float>& batchVertices) const;
+    void ComputeBounds(const vector<float>& vertices, Drawable& drawable) const;
+    float ComputeProjectedRadius(const Drawable& drawable,
+                                 const mat4& modelview,
+                                 const mat4& projectionMatrix,
+                                 const ivec2& size) const;
+    int SelectLod(const Drawable& drawable, float projectedRadius) const;
+	void RenderVisual(const Visual& visual, const Drawable& drawable) const;
+	int FindThumbnail(const Visual& visual, int index) const;
+	int AllocateThumbnail(const ivec2& size) const;
+	int FindFreeThumbnail(const ivec2& size) const;
+	void CopyThumbnails(const vector<Visual>& visuals) const;
+	void DrawInstances(const Drawable& drawable, int lod) const;
+	void DrawBatches(const Drawable& drawable, int lod) const;
+	void RenderTriangles(mat4& modelview, mat4& projectionMatrix, const vec3& color, const Drawable& drawable, int lod) const;
+	void RenderEquation(mat4& modelview, mat4& projectionMatrix, const vec3& color, const Drawable& drawable) const;
 	void RenderLines(mat4& modelview, mat4& projectionMatrix, const Drawable& drawable) const;
+	void DrawTriangleBuffers(GLuint vertexArray, GLuint vertexBuffer,
+							 int vertexCount, GLuint indexBuffer,
+							 GLenum primitive, int firstIndex, int indexCount,
+							 GLenum indexType) const;
+	void DrawIndices(GLenum primitive, int firstIndex, int indexCount,
+					 GLenum indexType) const;
+	bool BindVertexArray(GLuint vertexArray) const;
+	void SetTransformUniforms(GLint modelviewProjectionUniform,
+							  GLint modelviewUniform,
+							  GLint projectionUniform,
+							  const mat4& modelview,
+							  const mat4& projectionMatrix) const;
+	void SetTriangleAttributes(GLuint vertexBuffer, int vertexCount) const;
+	void SetGridAttributes(const Drawable& drawable) const;
+	void SetLineAttributes(const Drawable& drawable) const;
 
+    unsigned char m_flags;
+    // The layout of every vertex buffer. Interleaved, since the passes
+    // that reorder, split and simplify meshes move whole vertices.
+    VertexFormat m_vertexFormat;
     vector<Drawable> m_drawables;
+    vector<EquationProgram> m_equations;
+    // Every live buffer CreateBuffer made, and the same by the hash of
+    // its contents, so that surfaces of the same topology share one
+    // whether Initialize or UpdateSurface creates them.
+    std::map<GLuint, SharedBuffer> m_sharedBuffers;
+    std::multimap<unsigned long long, GLuint> m_bufferHashes;
+    // Kept between calls to UpdateSurface so that they do not allocate.
+    vector<float> m_stagingVertices;
+    vector<float> m_remappedVertices;
+    vector<GLuint> m_stagingIndices;
+    vector<float> m_batchVertices;
+    // Every program, buffer binding and capability goes through here.
+    mutable GLStateCache m_state;
     // GLuint m_colorRenderbuffer;
 
     UniformHandle m_uniform;
@@ -77,87 +341,79 @@ private:
 
 	GLuint m_triangle_program; 
 	GLuint m_line_program;
+
+	bool m_indexUintSupported;
+	bool m_vertexArraysSupported;
+	bool m_instancedArraysSupported;
+
+	// RenderInstances streams the copies through m_instanceBuffer, or
+	// through uniform arrays in batches.
+	InstanceProgram m_instanceProgram;
+	GLuint m_instanceBuffer;
+	mutable vector<Instance> m_instances;
+	mutable vector<float> m_batchUniforms;
+
+	// Static visuals are drawn once into the atlas, a texture with a
+	// framebuffer of its own, and copied from there with a quad.
+	GLuint m_thumbnailTexture;
+	GLuint m_thumbnailDepthbuffer;
+	GLuint m_thumbnailFramebuffer;
+	GLuint m_thumbnailProgram;
+	GLuint m_thumbnailCorner;
+	GLint m_thumbnailTextureRect;
+	GLuint m_cornerBuffer;
+	mutable vector<Thumbnail> m_thumbnails;
+	// Thumbnails go in rows from the bottom; the next one goes at
+	// m_shelfCorner, and the next row above the highest of this one.
+	mutable ivec2 m_shelfCorner;
+	mutable int m_shelfHeight;
+	// Counts the calls to Render, for Thumbnail::LastUsed.
+	mutable int m_frame;
+	// The thumbnail and the index of each visual to copy this frame.
+	mutable vector<ivec2> m_thumbnailCopies;
+	// A thumbnail read back, to count the pixels it covers.
+	mutable vector<unsigned char> m_thumbnailPixels;
+
+	mutable RenderStatistics m_statistics;
 };
 
-IRenderingEngine* CreateRenderingEngine()
+IRenderingEngine* CreateRenderingEngine(unsigned char flags)
 {
-    return new RenderingEngine();
+    return new RenderingEngine(flags);
 }
 
-RenderingEngine::RenderingEngine()
+RenderingEngine::RenderingEngine(unsigned char flags) :
+    m_flags(flags),
+    m_vertexFormat(VertexFlagsNormals, VertexLayoutInterleaved)
 {
+    m_statistics.DrawCalls = 0;
+    m_statistics.TrianglesDrawn = 0;
+    m_statistics.IndexBytesDrawn = 0;
+    m_statistics.VertexBufferBytes = 0;
+    m_statistics.IndexBufferBytes = 0;
+    m_statistics.IndexBytesShared = 0;
+    m_statistics.StateCallsIssued = 0;
+    m_statistics.StateCallsElided = 0;
+    m_statistics.UniformBytesUploaded = 0;
+    m_statistics.ThumbnailsCopied = 0;
+    m_statistics.ThumbnailsRendered = 0;
+    m_statistics.FragmentsSaved = 0;
     // glGenRenderbuffers(1, &m_colorRenderbuffer);
     // glBindRenderbuffer(GL_RENDERBUFFER, m_colorRenderbuffer);
 }
 
 void RenderingEngine::Initialize(const vector<ISurface*>& surfaces)
 {
-    vector<ISurface*>::const_iterator surface;
-    for (surface = surfaces.begin(); 
-         surface != surfaces.end(); ++surface) {
-
-        // Create the VBO for the vertices.
-        vector<float> vertices;
-        (*surface)->GenerateVertices(vertices, VertexFlagsNormals);
-        GLuint vertexBuffer;
-        glGenBuffers(1, &vertexBuffer);
-        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-        glBufferData(GL_ARRAY_BUFFER,
-                     vertices.size() * sizeof(vertices[0]),
-                     &vertices[0],
-                     GL_STATIC_DRAW);
-
-		GLenum error = glGetError();
-		if (error == GL_INVALID_ENUM) {
-			int i = 0;
-		}
-        
-        // Create a new VBO for the trinagle indices if needed.
-        int TriangleIndexCount = (*surface)->GetTriangleIndexCount();
-        GLuint TriangleIndexBuffer;
-        if (!m_drawables.empty() 
-		 && TriangleIndexCount == m_drawables[0].TriangleIndexCount) {
-            TriangleIndexBuffer = m_drawables[0].TriangleIndexBuffer;
-        } else {
-            vector<GLushort> indices(TriangleIndexCount);
-            (*surface)->GenerateTriangleIndices(indices);
-            glGenBuffers(1, &TriangleIndexBuffer);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, TriangleIndexBuffer);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                         TriangleIndexCount * sizeof(GLushort),
-                         &indices[0],
-                         GL_STATIC_DRAW);
-        }
+    // Whatever set up the context may have left any state behind.
+    m_state.Reset();
+    m_indexUintSupported = HasExtension("GL_OES_element_index_uint");
+    m_vertexArraysSupported = !(m_flags & RenderingFlagsNoVertexArrays) &&
+                              HasExtension("GL_OES_vertex_array_object") &&
+                              m_state.LoadVertexArrays();
+    m_instancedArraysSupported =
+        !(m_flags & RenderingFlagsNoInstancedArrays) && LoadInstancedArrays();
         
-        // Create a new VBO for the trinagle indices if needed.
-        int LineIndexCount = (*surface)->GetLineIndexCount();
-		GLuint LineIndexBuffer = 0;
-		if (LineIndexCount != 0) {
-			if (!m_drawables.empty() 
-				&& LineIndexCount == m_drawables[0].LineIndexCount) {
-					LineIndexBuffer = m_drawables[0].LineIndexBuffer;
-			} else {
-				vector<GLushort> indices(LineIndexCount);
-				(*surface)->GenerateLineIndices(indices);
-				glGenBuffers(1, &LineIndexBuffer);
-				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, LineIndexBuffer);
-				glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-					LineIndexCount * sizeof(GLushort),
-					&indices[0],
-					GL_STATIC_DRAW);
-			}
-        }
-
-        Drawable drawable = { vertexBuffer,
-							  TriangleIndexBuffer,
-							  TriangleIndexCount,
-							  LineIndexBuffer,
-							  LineIndexCount };
-
-        m_drawables.push_back(drawable);
-    }
-    
-	glEnable(GL_DEPTH_TEST);
+	m_state.Enable(GL_DEPTH_TEST);
 	glPolygonOffset(4, 8);
 
 	//  ۿ ̿ ̸ Ѵ.
@@ -187,6 +443,7 @@ void RenderingEngine::Initialize(const vector<ISurface*>& surfaces)
     m_attribute.AmbientMaterial = glGetUniformLocation(program, "AmbientMaterial");
 
     // Set up some matrices.
+    m_uniform.ModelviewProjection = glGetUniformLocation(program, "ModelviewProjection");
     m_uniform.Projection = glGetUniformLocation(program, "Projection");
     m_uniform.Modelview = glGetUniformLocation(program, "Modelview");
     m_uniform.NormalMatrix = glGetUniformLocation(program, "NormalMatrix");
@@ -195,13 +452,13 @@ void RenderingEngine::Initialize(const vector<ISurface*>& surfaces)
     m_uniform.Shininess = glGetUniformLocation(program, "Shininess");
 	m_triangle_program = program;
 
-	glUseProgram(m_triangle_program);
+	m_state.UseProgram(m_triangle_program);
 
     // Set Light settings.
     glVertexAttrib3f(m_attribute.AmbientMaterial, 0.04f, 0.04f, 0.04f); 
-    glUniform3f(m_uniform.LightPosition, 0.25, 0.25, 0.25);
-    glUniform3f(m_uniform.SpecularMaterial, 0.5, 0.5, 0.5);
-    glUniform1f(m_uniform.Shininess, 50);
+    m_state.Uniform3f(m_uniform.LightPosition, 0.25, 0.25, 0.25);
+    m_state.Uniform3f(m_uniform.SpecularMaterial, 0.5, 0.5, 0.5);
+    m_state.Uniform1f(m_uniform.Shininess, 50);
 
     program = BuildProgram(SimpleVertexShader, SimpleFragmentShader);
 
@@ -209,10 +466,11 @@ void RenderingEngine::Initialize(const vector<ISurface*>& surfaces)
     m_attributeLine.Position = glGetAttribLocation(program, "Position");
     m_attributeLine.Color = glGetAttribLocation(program, "SourceColor");
 
+    m_uniformLine.ModelviewProjection = glGetUniformLocation(program, "ModelviewProjection");
     m_uniformLine.Projection = glGetUniformLocation(program, "Projection");
     m_uniformLine.Modelview = glGetUniformLocation(program, "Modelview");
 
-	glUseProgram(program);
+	m_state.UseProgram(program);
 
     // glEnableVertexAttribArray(m_attributeLine.Position);
 
@@ -220,98 +478,1388 @@ void RenderingEngine::Initialize(const vector<ISurface*>& surfaces)
 
     // set translation.
     m_translation = mat4::Translate(0, 0, -7);
+
+    CreateInstanceProgram();
+    CreateThumbnailAtlas();
+
+    // The vertex arrays of the drawables need the attribute locations
+    // of the programs above.
+    vector<ISurface*>::const_iterator surface;
+    for (surface = surfaces.begin(); 
+         surface != surfaces.end(); ++surface) {
+        Drawable drawable;
+        CreateDrawable(**surface, drawable);
+        m_drawables.push_back(drawable);
+    }
+}
+
+void RenderingEngine::CreateDrawable(const ISurface& surface,
+									 Drawable& drawable)
+{
+    // Surfaces beyond the reach of 16-bit indices are split into
+    // submeshes when the device cannot draw with 32-bit ones.
+    bool wideIndices = surface.GetIndexSize() > 2;
+    bool split = wideIndices && !m_indexUintSupported;
+
+    drawable.Topology = ComputeTopology(surface);
+    drawable.BatchSize = 0;
+    drawable.BatchVertexBuffer = 0;
+    drawable.BatchIndexBuffer = 0;
+
+    // The index buffers bound below would otherwise end up in the vertex
+    // array of the last draw.
+    BindVertexArray(0);
+
+    // Surfaces the vertex shader evaluates need only indices and the
+    // grid, which is shared.
+    ShaderEquation equation;
+    if ((m_flags & RenderingFlagsShaderSurfaces) && !split &&
+        surface.GetShaderEquation(equation)) {
+        CreateEquationBuffers(surface, equation, drawable);
+        CreateVertexArrays(drawable);
+        return;
+    }
+
+    // Generate the mesh, reordered for the GPU's caches.
+    vector<float> vertices;
+    vector<GLuint> indices;
+    vector<GLuint> vertexRemap;
+    PrepareMesh(surface, vertices, indices, vertexRemap);
+    drawable.VertexRemap = vertexRemap;
+
+    // Grids can be drawn as one strip instead; the levels of detail
+    // stay lists.
+    vector<GLuint> strip;
+    if (!split)
+        PrepareStrip(surface, indices, vertexRemap, strip);
+    const vector<GLuint>& drawnIndices = strip.empty() ? indices : strip;
+
+    // Create the VBO for the vertices; submeshes get their own.
+    GLuint vertexBuffer = 0;
+    if (!split) {
+        glGenBuffers(1, &vertexBuffer);
+        m_state.BindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        glBufferData(GL_ARRAY_BUFFER,
+                     vertices.size() * sizeof(vertices[0]),
+                     &vertices[0],
+                     GL_STATIC_DRAW);
+        m_statistics.VertexBufferBytes +=
+            vertices.size() * sizeof(vertices[0]);
+    }
+
+	GLenum error = glGetError();
+	if (error == GL_INVALID_ENUM) {
+		int i = 0;
+	}
+    
+    drawable.VertexBuffer = vertexBuffer;
+    drawable.VertexCount = surface.GetVertexCount();
+    drawable.TriangleIndexBuffer = 0;
+    drawable.TriangleIndexCount = drawnIndices.size();
+    drawable.TriangleIndexType = GL_UNSIGNED_SHORT;
+    drawable.TrianglePrimitive = strip.empty() ? GL_TRIANGLES
+                                               : GL_TRIANGLE_STRIP;
+    drawable.LodIndexBuffer = 0;
+    drawable.CurrentLod = -1;
+    drawable.Equation = -1;
+    ComputeBounds(vertices, drawable);
+
+    // Create a new VBO for the trinagle indices if needed.
+    int TriangleIndexCount = drawable.TriangleIndexCount;
+    if (split) {
+        CreateSplitTriangleBuffers(indices, vertices, drawable);
+    } else if (wideIndices) {
+        drawable.TriangleIndexBuffer = CreateBuffer(
+            GL_ELEMENT_ARRAY_BUFFER, &drawnIndices[0],
+            TriangleIndexCount * sizeof(GLuint));
+        drawable.TriangleIndexType = GL_UNSIGNED_INT;
+    } else {
+        vector<GLushort> shortIndices(drawnIndices.begin(), drawnIndices.end());
+        drawable.TriangleIndexBuffer = CreateBuffer(
+            GL_ELEMENT_ARRAY_BUFFER, &shortIndices[0],
+            TriangleIndexCount * sizeof(GLushort));
+    }
+
+    // Submeshes have vertex buffers of their own, so no levels, and they
+    // are too large to batch.
+    if (!split) {
+        vector<GLuint> lodIndices;
+        CreateLodBuffers(indices, vertices, drawable, lodIndices);
+        if (!m_instancedArraysSupported)
+            CreateBatchBuffers(indices, lodIndices, vertices, drawable);
+    }
+    
+    // Create a new VBO for the trinagle indices if needed.
+    // Line indices are 16-bit only, so large surfaces go without.
+    int LineIndexCount = wideIndices ? 0 : surface.GetLineIndexCount();
+	GLuint LineIndexBuffer = 0;
+	if (LineIndexCount != 0) {
+		vector<GLushort> lineIndices(LineIndexCount);
+		surface.GenerateLineIndices(lineIndices);
+		if (!vertexRemap.empty())
+			for (size_t i = 0; i < lineIndices.size(); i++)
+				lineIndices[i] = vertexRemap[lineIndices[i]];
+		LineIndexBuffer = CreateBuffer(
+			GL_ELEMENT_ARRAY_BUFFER, &lineIndices[0],
+			LineIndexCount * sizeof(GLushort));
+    }
+
+    drawable.LineIndexBuffer = LineIndexBuffer;
+    drawable.LineIndexCount = LineIndexCount;
+
+    CreateVertexArrays(drawable);
+}
+
+void RenderingEngine::UpdateSurface(int index, ISurface* surface)
+{
+	const int floatsPerVertex = m_vertexFormat.GetFloatsPerVertex();
+	Drawable& drawable = m_drawables[index];
+
+	// The thumbnails show the old surface; their places are free.
+	for (size_t i = 0; i < m_thumbnails.size(); i++)
+		if (m_thumbnails[i].Drawable == index)
+			m_thumbnails[i].Drawable = -1;
+
+	// A new topology needs new index buffers, and new levels of detail;
+	// only then is the drawable made over.
+	if (ComputeTopology(*surface) != drawable.Topology ||
+		!drawable.Submeshes.empty()) {
+		ReleaseDrawable(drawable);
+		Drawable replacement;
+		CreateDrawable(*surface, replacement);
+		drawable = replacement;
+		return;
+	}
+
+	// For the vertex shader the equation and its parameters are all
+	// there is to update.
+	if (drawable.Equation >= 0) {
+		ShaderEquation equation;
+		surface->GetShaderEquation(equation);
+		drawable.Parameters = equation.Parameters;
+		drawable.UpperBound = equation.UpperBound;
+
+		// Another program may have the grid at another location.
+		int program = FindEquationProgram(equation.Source);
+		if (program != drawable.Equation) {
+			drawable.Equation = program;
+			ReleaseVertexArrays(drawable);
+			CreateVertexArrays(drawable);
+		}
+		return;
+	}
+
+	surface->GenerateVertices(m_stagingVertices, m_vertexFormat);
+	vector<float>& vertices = drawable.VertexRemap.empty() ?
+		m_stagingVertices : m_remappedVertices;
+	if (!drawable.VertexRemap.empty()) {
+		m_remappedVertices.resize(m_stagingVertices.size());
+		for (size_t i = 0; i < drawable.VertexRemap.size(); i++)
+			std::copy(&m_stagingVertices[i * floatsPerVertex],
+					  &m_stagingVertices[(i + 1) * floatsPerVertex],
+					  &m_remappedVertices[drawable.VertexRemap[i] * floatsPerVertex]);
+	}
+
+	// Orphan the old storage first, so a frame the GPU is still drawing
+	// from it does not hold up the upload. The buffer is dynamic from the
+	// first update on.
+	int size = vertices.size() * sizeof(vertices[0]);
+	m_state.BindBuffer(GL_ARRAY_BUFFER, drawable.VertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, size, 0, GL_DYNAMIC_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, size, &vertices[0]);
+	if (drawable.BatchVertexBuffer) {
+		FillBatchVertices(vertices, drawable.BatchSize, m_batchVertices);
+		size = m_batchVertices.size() * sizeof(m_batchVertices[0]);
+		m_state.BindBuffer(GL_ARRAY_BUFFER, drawable.BatchVertexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, size, 0, GL_DYNAMIC_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, size, &m_batchVertices[0]);
+	}
+
+	// The levels keep their triangles, and their errors grow and shrink
+	// with the surface.
+	float radius = drawable.BoundsRadius;
+	ComputeBounds(vertices, drawable);
+	if (radius > 0)
+		for (size_t i = 0; i < drawable.Lods.size(); i++)
+			drawable.Lods[i].Error *= drawable.BoundsRadius / radius;
+}
+
+void RenderingEngine::ReleaseDrawable(const Drawable& drawable)
+{
+	int& vertexBytes = m_statistics.VertexBufferBytes;
+	int& indexBytes = m_statistics.IndexBufferBytes;
+
+	ReleaseVertexArrays(drawable);
+
+	// The grid of an equation is shared; other vertex buffers are not.
+	if (drawable.Equation >= 0)
+		ReleaseBuffer(drawable.VertexBuffer, vertexBytes);
+	else if (drawable.VertexBuffer)
+		DeleteBuffer(drawable.VertexBuffer, vertexBytes);
+	if (drawable.TriangleIndexBuffer)
+		ReleaseBuffer(drawable.TriangleIndexBuffer, indexBytes);
+	if (drawable.LineIndexBuffer)
+		ReleaseBuffer(drawable.LineIndexBuffer, indexBytes);
+	if (drawable.LodIndexBuffer)
+		ReleaseBuffer(drawable.LodIndexBuffer, indexBytes);
+	for (size_t i = 0; i < drawable.Submeshes.size(); i++) {
+		DeleteBuffer(drawable.Submeshes[i].VertexBuffer, vertexBytes);
+		ReleaseBuffer(drawable.Submeshes[i].TriangleIndexBuffer, indexBytes);
+	}
+	if (drawable.BatchVertexBuffer) {
+		DeleteBuffer(drawable.BatchVertexBuffer, vertexBytes);
+		ReleaseBuffer(drawable.BatchIndexBuffer, indexBytes);
+	}
+}
+
+void RenderingEngine::CreateVertexArrays(Drawable& drawable)
+{
+	drawable.TriangleVertexArray = 0;
+	drawable.LodVertexArray = 0;
+	drawable.LineVertexArray = 0;
+	for (size_t i = 0; i < drawable.Submeshes.size(); i++)
+		drawable.Submeshes[i].VertexArray = 0;
+	if (!m_vertexArraysSupported)
+		return;
+
+	// Each one records what its draw would set up without it.
+	auto recordTriangles = [&] (GLuint vertexBuffer, int vertexCount,
+								GLuint indexBuffer) -> GLuint {
+		GLuint vertexArray = m_state.CreateVertexArray();
+		SetTriangleAttributes(vertexBuffer, vertexCount);
+		m_state.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+		return vertexArray;
+	};
+
+	if (drawable.Equation >= 0) {
+		drawable.TriangleVertexArray = m_state.CreateVertexArray();
+		SetGridAttributes(drawable);
+		m_state.BindBuffer(GL_ELEMENT_ARRAY_BUFFER,
+						   drawable.TriangleIndexBuffer);
+	} else if (drawable.Submeshes.empty()) {
+		drawable.TriangleVertexArray = recordTriangles(
+			drawable.VertexBuffer, drawable.VertexCount,
+			drawable.TriangleIndexBuffer);
+		if (drawable.LodIndexBuffer)
+			drawable.LodVertexArray = recordTriangles(
+				drawable.VertexBuffer, drawable.VertexCount,
+				drawable.LodIndexBuffer);
+		drawable.LineVertexArray = m_state.CreateVertexArray();
+		SetLineAttributes(drawable);
+		m_state.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, drawable.LineIndexBuffer);
+	}
+
+	for (size_t i = 0; i < drawable.Submeshes.size(); i++) {
+		Submesh& submesh = drawable.Submeshes[i];
+		submesh.VertexArray = recordTriangles(submesh.VertexBuffer,
+											  submesh.VertexCount,
+											  submesh.TriangleIndexBuffer);
+	}
+	m_state.BindVertexArray(0);
+}
+
+void RenderingEngine::ReleaseVertexArrays(const Drawable& drawable)
+{
+	GLuint vertexArrays[] = { drawable.TriangleVertexArray,
+							  drawable.LodVertexArray,
+							  drawable.LineVertexArray };
+	for (int i = 0; i < 3; i++)
+		if (vertexArrays[i])
+			m_state.DeleteVertexArray(vertexArrays[i]);
+	for (size_t i = 0; i < drawable.Submeshes.size(); i++)
+		if (drawable.Submeshes[i].VertexArray)
+			m_state.DeleteVertexArray(drawable.Submeshes[i].VertexArray);
+}
+
+unsigned long long RenderingEngine::ComputeTopology(const ISurface& surface)
+{
+	// The grid decides the indices of a surface the vertex shader
+	// evaluates, and tells apart grids of the same size.
+	ShaderEquation equation;
+	if ((m_flags & RenderingFlagsShaderSurfaces) &&
+		surface.GetShaderEquation(equation))
+		return HashBytes(equation.Grid.data(),
+						 equation.Grid.size() * sizeof(equation.Grid[0]));
+
+	// The same indices over more or fewer vertices, some of them unused,
+	// do not fit: UpdateSurface copies VertexRemap.size() vertices and
+	// the batches hold VertexCount of them. So the counts are hashed too.
+	surface.GenerateTriangleIndices(m_stagingIndices);
+	unsigned long long counts[2] = {
+		(unsigned long long) surface.GetVertexCount(),
+		(unsigned long long) m_stagingIndices.size()
+	};
+	return HashBytes(m_stagingIndices.data(),
+					 m_stagingIndices.size() * sizeof(m_stagingIndices[0])) ^
+		   HashBytes(counts, sizeof(counts));
+}
+
+void RenderingEngine::PrepareMesh(const ISurface& surface,
+								  vector<float>& vertices,
+								  vector<GLuint>& indices,
+								  vector<GLuint>& vertexRemap) const
+{
+	const int floatsPerVertex = m_vertexFormat.GetFloatsPerVertex();
+
+	surface.GenerateVertices(vertices, m_vertexFormat);
+	surface.GenerateTriangleIndices(indices);
+	int vertexCount = surface.GetVertexCount();
+
+	// Put the triangles in post-transform cache friendly order.
+	OptimizeVertexCache(indices, vertexCount);
+
+	// Draw the outward facing clusters first so that fewer fragments get
+	// shaded and then covered. A coarse count decides whether it paid off.
+	const int overdrawResolution = 64;
+	vector<GLuint> overdrawIndices(indices);
+	OptimizeOverdraw(overdrawIndices, vertices, floatsPerVertex);
+	if (AnalyzeOverdraw(overdrawIndices, vertices, floatsPerVertex,
+						overdrawResolution).Overdraw <
+		AnalyzeOverdraw(indices, vertices, floatsPerVertex,
+						overdrawResolution).Overdraw)
+		indices.swap(overdrawIndices);
+
+	// Then lay the vertices out in the order they are fetched, but only
+	// when that really moves fewer bytes; grids are often better as is.
+	vector<GLuint> fetchIndices(indices);
+	vector<float> fetchVertices(vertices);
+	OptimizeVertexFetch(fetchIndices, fetchVertices, floatsPerVertex, vertexRemap);
+
+	const int vertexSize = floatsPerVertex * sizeof(float);
+	VertexFetchStatistics before = AnalyzeVertexFetch(indices, vertexCount, vertexSize);
+	VertexFetchStatistics after = AnalyzeVertexFetch(fetchIndices, vertexCount, vertexSize);
+	if (after.BytesPerTriangle < before.BytesPerTriangle) {
+		indices.swap(fetchIndices);
+		vertices.swap(fetchVertices);
+	} else {
+		vertexRemap.clear();
+	}
+}
+
+void RenderingEngine::PrepareStrip(const ISurface& surface,
+								   const vector<GLuint>& indices,
+								   const vector<GLuint>& vertexRemap,
+								   vector<GLuint>& strip) const
+{
+	const int floatsPerVertex = m_vertexFormat.GetFloatsPerVertex();
+
+	if (surface.GetTriangleStripIndexCount() == 0 ||
+		(m_flags & RenderingFlagsTriangleLists))
+		return;
+	surface.GenerateTriangleStripIndices(strip);
+	if (!vertexRemap.empty())
+		for (size_t i = 0; i < strip.size(); i++)
+			strip[i] = vertexRemap[strip[i]];
+	if (m_flags & RenderingFlagsTriangleStrips)
+		return;
+
+	// A strip reads about a third of the index bytes of the list, but it
+	// sweeps whole rows through the post-transform cache, where the list
+	// was ordered to keep reusing it. Keep the strip only when it moves
+	// fewer bytes, counting the vertex fetches that miss the cache.
+	vector<GLuint> stripTriangles;
+	UnpackTriangleStrip(strip, stripTriangles);
+	int vertexCount = surface.GetVertexCount();
+	int vertexSize = floatsPerVertex * sizeof(float);
+	int indexSize = surface.GetIndexSize();
+	float listBytes = indices.size() * indexSize +
+		AnalyzeVertexFetch(indices, vertexCount, vertexSize).BytesPerTriangle *
+		indices.size() / 3;
+	float stripBytes = strip.size() * indexSize +
+		AnalyzeVertexFetch(stripTriangles, vertexCount, vertexSize).BytesPerTriangle *
+		stripTriangles.size() / 3;
+	if (stripBytes >= listBytes)
+		strip.clear();
+}
+
+GLuint RenderingEngine::CreateBuffer(GLenum target, const void* data, int size)
+{
+	// Grids of the same divisions, and anything else that came out of
+	// the reordering passes the same way, get one buffer between them.
+	bool indices = target == GL_ELEMENT_ARRAY_BUFFER;
+	unsigned long long hash = HashBytes(data, size);
+	typedef std::multimap<unsigned long long, GLuint>::iterator Iterator;
+	std::pair<Iterator, Iterator> matches = m_bufferHashes.equal_range(hash);
+	for (Iterator match = matches.first; match != matches.second; ++match) {
+		SharedBuffer& shared = m_sharedBuffers[match->second];
+		if (shared.Target == target && shared.Size == size) {
+			if (indices)
+				m_statistics.IndexBytesShared += size;
+			++shared.References;
+			return match->second;
+		}
+	}
+
+	GLuint buffer;
+	glGenBuffers(1, &buffer);
+	m_state.BindBuffer(target, buffer);
+	glBufferData(target, size, data, GL_STATIC_DRAW);
+	if (indices)
+		m_statistics.IndexBufferBytes += size;
+	else
+		m_statistics.VertexBufferBytes += size;
+
+	SharedBuffer shared;
+	shared.Target = target;
+	shared.Size = size;
+	shared.Hash = hash;
+	shared.References = 1;
+	m_sharedBuffers[buffer] = shared;
+	m_bufferHashes.insert(std::make_pair(hash, buffer));
+	return buffer;
+}
+
+void RenderingEngine::ReleaseBuffer(GLuint buffer, int& bufferBytes)
+{
+	// Every reference but the first was counted as shared.
+	std::map<GLuint, SharedBuffer>::iterator shared =
+		m_sharedBuffers.find(buffer);
+	if (--shared->second.References > 0) {
+		if (shared->second.Target == GL_ELEMENT_ARRAY_BUFFER)
+			m_statistics.IndexBytesShared -= shared->second.Size;
+		return;
+	}
+
+	typedef std::multimap<unsigned long long, GLuint>::iterator Iterator;
+	std::pair<Iterator, Iterator> matches =
+		m_bufferHashes.equal_range(shared->second.Hash);
+	for (Iterator match = matches.first; match != matches.second; ++match) {
+		if (match->second == buffer) {
+			m_bufferHashes.erase(match);
+			break;
+		}
+	}
+	m_sharedBuffers.erase(shared);
+	DeleteBuffer(buffer, bufferBytes);
+}
+
+void RenderingEngine::DeleteBuffer(GLuint buffer, int& bufferBytes)
+{
+	// Any binding point can tell the size, index buffers included.
+	GLint size = 0;
+	m_state.BindBuffer(GL_ARRAY_BUFFER, buffer);
+	glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
+	m_state.DeleteBuffer(buffer);
+	bufferBytes -= size;
+}
+
+int RenderingEngine::FindEquationProgram(const char* source)
+{
+	for (size_t i = 0; i < m_equations.size(); i++)
+		if (strcmp(m_equations[i].Source, source) == 0)
+			return i;
+
+	// The vertex shader declares Evaluate, and the equation follows it.
+	string vertexShader = string(ParametricSurfaceVertexShader) + source;
+	GLuint program = BuildProgram(vertexShader.c_str(),
+								  PixelLightingFragmentShader);
+
+	EquationProgram equation;
+	equation.Source = source;
+	equation.Program = program;
+	equation.Grid = glGetAttribLocation(program, "Grid");
+	equation.DiffuseMaterial = glGetAttribLocation(program, "DiffuseMaterial");
+	equation.Uniform.ModelviewProjection = glGetUniformLocation(program, "ModelviewProjection");
+	equation.Uniform.Projection = glGetUniformLocation(program, "Projection");
+	equation.Uniform.Modelview = glGetUniformLocation(program, "Modelview");
+	equation.Uniform.NormalMatrix = glGetUniformLocation(program, "NormalMatrix");
+	equation.Uniform.LightPosition = glGetUniformLocation(program, "LightPosition");
+	equation.Uniform.SpecularMaterial = glGetUniformLocation(program, "SpecularMaterial");
+	equation.Uniform.Shininess = glGetUniformLocation(program, "Shininess");
+	equation.UpperBound = glGetUniformLocation(program, "UpperBound");
+	equation.Parameters = glGetUniformLocation(program, "Parameters");
+
+	m_state.UseProgram(program);
+	m_state.Uniform3f(equation.Uniform.LightPosition, 0.25, 0.25, 0.25);
+	m_state.Uniform3f(equation.Uniform.SpecularMaterial, 0.5, 0.5, 0.5);
+	m_state.Uniform1f(equation.Uniform.Shininess, 50);
+
+	m_equations.push_back(equation);
+	return m_equations.size() - 1;
+}
+
+void RenderingEngine::CreateEquationBuffers(const ISurface& surface,
+											const ShaderEquation& equation,
+											Drawable& drawable)
+{
+	drawable.Equation = FindEquationProgram(equation.Source);
+	drawable.Parameters = equation.Parameters;
+	drawable.UpperBound = equation.UpperBound;
+	drawable.VertexBuffer = CreateBuffer(
+		GL_ARRAY_BUFFER, &equation.Grid[0],
+		equation.Grid.size() * sizeof(equation.Grid[0]));
+	drawable.VertexCount = equation.Grid.size() / 2;
+
+	// The vertices are never on the CPU to be reordered, so a strip in
+	// grid order is the best there is.
+	vector<GLuint> indices;
+	drawable.TrianglePrimitive = GL_TRIANGLE_STRIP;
+	if (surface.GetTriangleStripIndexCount() > 0 &&
+		!(m_flags & RenderingFlagsTriangleLists)) {
+		surface.GenerateTriangleStripIndices(indices);
+	} else {
+		surface.GenerateTriangleIndices(indices);
+		drawable.TrianglePrimitive = GL_TRIANGLES;
+	}
+
+	drawable.TriangleIndexCount = indices.size();
+	if (surface.GetIndexSize() > 2) {
+		drawable.TriangleIndexBuffer = CreateBuffer(
+			GL_ELEMENT_ARRAY_BUFFER, &indices[0],
+			indices.size() * sizeof(GLuint));
+		drawable.TriangleIndexType = GL_UNSIGNED_INT;
+	} else {
+		vector<GLushort> shortIndices(indices.begin(), indices.end());
+		drawable.TriangleIndexBuffer = CreateBuffer(
+			GL_ELEMENT_ARRAY_BUFFER, &shortIndices[0],
+			shortIndices.size() * sizeof(GLushort));
+		drawable.TriangleIndexType = GL_UNSIGNED_SHORT;
+	}
+
+	// Without vertices there is nothing to simplify or bound, so these
+	// draw at full detail and without the wireframe.
+	drawable.LineIndexBuffer = 0;
+	drawable.LineIndexCount = 0;
+	drawable.LodIndexBuffer = 0;
+	drawable.CurrentLod = -1;
+	drawable.BoundsCenter = vec3(0, 0, 0);
+	drawable.BoundsRadius = 0;
+}
+
+void RenderingEngine::CreateSplitTriangleBuffers(const vector<GLuint>& indices,
+												 const vector<float>& vertices,
+												 Drawable& drawable)
+{
+	const int floatsPerVertex = m_vertexFormat.GetFloatsPerVertex();
+
+	vector<MeshPart> parts;
+	SplitMesh(indices, vertices.size() / floatsPerVertex, 65536, parts);
+
+	for (size_t i = 0; i < parts.size(); i++) {
+		vector<float> partVertices;
+		GatherVertices(vertices, floatsPerVertex, parts[i].VertexRemap,
+					   partVertices);
+
+		Submesh submesh;
+		submesh.VertexCount = parts[i].VertexRemap.size();
+		glGenBuffers(1, &submesh.VertexBuffer);
+		m_state.BindBuffer(GL_ARRAY_BUFFER, submesh.VertexBuffer);
+		glBufferData(GL_ARRAY_BUFFER,
+					 partVertices.size() * sizeof(partVertices[0]),
+					 &partVertices[0],
+					 GL_STATIC_DRAW);
+		m_statistics.VertexBufferBytes +=
+			partVertices.size() * sizeof(partVertices[0]);
+
+		submesh.TriangleIndexCount = parts[i].Indices.size();
+		submesh.TriangleIndexBuffer = CreateBuffer(
+			GL_ELEMENT_ARRAY_BUFFER, &parts[i].Indices[0],
+			submesh.TriangleIndexCount * sizeof(GLushort));
+
+		drawable.Submeshes.push_back(submesh);
+	}
+}
+
+// lodIndices gets the contents of the buffer.
+void RenderingEngine::CreateLodBuffers(const vector<GLuint>& indices,
+									   const vector<float>& vertices,
+									   Drawable& drawable,
+									   vector<GLuint>& lodIndices)
+{
+	const int floatsPerVertex = m_vertexFormat.GetFloatsPerVertex();
+
+	vector<MeshLod> levels;
+	BuildLodChain(indices, vertices, floatsPerVertex, LodRatios, LodCount,
+				  levels);
+
+	// All the levels go into one buffer, one range each.
+	lodIndices.clear();
+	int previousCount = indices.size();
+	for (size_t i = 0; i < levels.size(); i++) {
+		// The simplifier got stuck; another copy would not help.
+		vector<GLuint>& levelIndices = levels[i].Indices;
+		if (levelIndices.empty() || (int) levelIndices.size() == previousCount)
+			break;
+		previousCount = levelIndices.size();
+
+		OptimizeVertexCache(levelIndices, vertices.size() / floatsPerVertex);
+
+		LodLevel lod;
+		lod.FirstIndex = lodIndices.size();
+		lod.TriangleIndexCount = levelIndices.size();
+		lod.Error = levels[i].Error;
+		lodIndices.insert(lodIndices.end(), levelIndices.begin(),
+						  levelIndices.end());
+		drawable.Lods.push_back(lod);
+	}
+	if (lodIndices.empty())
+		return;
+
+	if (drawable.TriangleIndexType == GL_UNSIGNED_INT) {
+		drawable.LodIndexBuffer = CreateBuffer(
+			GL_ELEMENT_ARRAY_BUFFER, &lodIndices[0],
+			lodIndices.size() * sizeof(GLuint));
+	} else {
+		vector<GLushort> shortIndices(lodIndices.begin(), lodIndices.end());
+		drawable.LodIndexBuffer = CreateBuffer(
+			GL_ELEMENT_ARRAY_BUFFER, &shortIndices[0],
+			shortIndices.size() * sizeof(GLushort));
+	}
+}
+
+// The copies follow one another, and then the index of the copy each
+// vertex is in; whole vertices can be copied since the layout is
+// interleaved.
+void RenderingEngine::FillBatchVertices(const vector<float>& vertices,
+										int batchSize,
+										vector<float>& batchVertices) const
+{
+	int vertexCount = vertices.size() / m_vertexFormat.GetFloatsPerVertex();
+	batchVertices.resize((vertices.size() + vertexCount) * batchSize);
+	vector<float>::iterator copy = batchVertices.begin();
+	for (int i = 0; i < batchSize; i++)
+		copy = std::copy(vertices.begin(), vertices.end(), copy);
+	for (int i = 0; i < batchSize; i++) {
+		std::fill(copy, copy + vertexCount, (float) i);
+		copy += vertexCount;
+	}
+}
+
+void RenderingEngine::CreateBatchBuffers(const vector<GLuint>& indices,
+										 const vector<GLuint>& lodIndices,
+										 const vector<float>& vertices,
+										 Drawable& drawable)
+{
+	int vertexCount = drawable.VertexCount;
+	int batchSize = vertexCount > 0 ?
+		std::min(MaxBatchInstances, BatchVertexLimit / vertexCount) : 0;
+	if (batchSize < 2)
+		return;
+
+	vector<float> batchVertices;
+	FillBatchVertices(vertices, batchSize, batchVertices);
+	int vertexBytes = batchVertices.size() * sizeof(batchVertices[0]);
+	glGenBuffers(1, &drawable.BatchVertexBuffer);
+	m_state.BindBuffer(GL_ARRAY_BUFFER, drawable.BatchVertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, vertexBytes, &batchVertices[0],
+				 GL_STATIC_DRAW);
+	m_statistics.VertexBufferBytes += vertexBytes;
+
+	// The full detail list, then each level, copied for each copy of the
+	// vertices.
+	vector<GLushort> batchIndices;
+	for (int lod = -1; lod < (int) drawable.Lods.size(); lod++) {
+		const GLuint* levelIndices = lod < 0 ? &indices[0] :
+			&lodIndices[drawable.Lods[lod].FirstIndex];
+		int indexCount = lod < 0 ? indices.size() :
+			drawable.Lods[lod].TriangleIndexCount;
+		drawable.BatchFirstIndices.push_back(batchIndices.size());
+		for (int copy = 0; copy < batchSize; copy++)
+			for (int i = 0; i < indexCount; i++)
+				batchIndices.push_back(levelIndices[i] + copy * vertexCount);
+	}
+	drawable.BatchFirstIndices.push_back(batchIndices.size());
+	drawable.BatchIndexBuffer = CreateBuffer(
+		GL_ELEMENT_ARRAY_BUFFER, &batchIndices[0],
+		batchIndices.size() * sizeof(GLushort));
+	drawable.BatchSize = batchSize;
+}
+
+void RenderingEngine::ComputeBounds(const vector<float>& vertices,
+									Drawable& drawable) const
+{
+	int vertexCount = vertices.size() / m_vertexFormat.GetFloatsPerVertex();
+	VertexAttribute position = m_vertexFormat.GetPosition(vertexCount);
+
+	// A sphere around the middle of the bounding box; not the smallest,
+	// but close enough to judge the size on screen.
+	vec3 boundsMin(0, 0, 0), boundsMax(0, 0, 0);
+	for (int i = 0; i < vertexCount; i++) {
+		const float* v = &vertices[position.Offset + i * position.Stride];
+		vec3 p(v[0], v[1], v[2]);
+		if (i == 0)
+			boundsMin = boundsMax = p;
+		boundsMin = vec3(std::min(boundsMin.x, p.x), std::min(boundsMin.y, p.y),
+						 std::min(boundsMin.z, p.z));
+		boundsMax = vec3(std::max(boundsMax.x, p.x), std::max(boundsMax.y, p.y),
+						 std::max(boundsMax.z, p.z));
+	}
+	drawable.BoundsCenter = (boundsMin + boundsMax) / 2;
+
+	float radiusSquared = 0;
+	for (int i = 0; i < vertexCount; i++) {
+		const float* v = &vertices[position.Offset + i * position.Stride];
+		vec3 offset = vec3(v[0], v[1], v[2]) - drawable.BoundsCenter;
+		radiusSquared = std::max(radiusSquared, offset.Dot(offset));
+	}
+	drawable.BoundsRadius = std::sqrt(radiusSquared);
+}
+
+// Projects the bounding sphere with the frustum, in pixels of a viewport
+// of size; its depth is clamped to the near plane for spheres reaching
+// past it.
+float RenderingEngine::ComputeProjectedRadius(const Drawable& drawable,
+											  const mat4& modelview,
+											  const mat4& projectionMatrix,
+											  const ivec2& size) const
+{
+	const vec3& center = drawable.BoundsCenter;
+	float depth = -(center.x * modelview.x.z + center.y * modelview.y.z +
+					center.z * modelview.z.z + modelview.w.z);
+	return drawable.BoundsRadius *
+		projectionMatrix.y.y / std::max(depth, 5.0f) * size.y / 2;
+}
+
+int RenderingEngine::SelectLod(const Drawable& drawable,
+							   float projectedRadius) const
+{
+	if (drawable.BoundsRadius <= 0)
+		return -1;
+	float pixelsPerUnit = projectedRadius / drawable.BoundsRadius;
+
+	// Refine as soon as the current level shows too much error, but only
+	// coarsen once the next level is comfortably below the limit.
+	int lod = drawable.CurrentLod;
+	while (lod >= 0 &&
+		   drawable.Lods[lod].Error * pixelsPerUnit > LodPixelError)
+		--lod;
+	while (lod + 1 < (int) drawable.Lods.size() &&
+		   drawable.Lods[lod + 1].Error * pixelsPerUnit <=
+		   LodPixelError * LodHysteresis)
+		++lod;
+
+	drawable.CurrentLod = lod;
+	return lod;
 }
 
 void RenderingEngine::RenderTriangles(mat4& modelview,
 									  mat4& projectionMatrix,
 									  const vec3& Color,
-									  const Drawable& drawable) const
+									  const Drawable& drawable,
+									  int lod) const
 {
-	glEnable(GL_POLYGON_OFFSET_FILL);
-
-	int stride = 2*sizeof(vec3);
-	const GLvoid* offset = (const GLvoid*)sizeof(vec3);
+	m_state.Enable(GL_POLYGON_OFFSET_FILL);
 
-	glUseProgram(m_triangle_program);
-	glUniformMatrix4fv(m_uniform.Modelview, 1, 0, modelview.Pointer());
-	glUniformMatrix4fv(m_uniform.Projection, 1, 0, projectionMatrix.Pointer());
+	m_state.UseProgram(m_triangle_program);
+	SetTransformUniforms(m_uniform.ModelviewProjection,
+						 m_uniform.Modelview,
+						 m_uniform.Projection,
+						 modelview,
+						 projectionMatrix);
 
 	// Set the normal matrix
 	// It's orthogoal, so Its Inverse-Transpose matrix is itself!
 	mat3 normalMatrix = modelview.ToMat3();
-	glUniformMatrix3fv(m_uniform.NormalMatrix, 1, 0, normalMatrix.Pointer());
+	m_state.UniformMatrix3fv(m_uniform.NormalMatrix, normalMatrix.Pointer());
 
 	// Set the color.
 	vec3 color = Color * 0.75f;
 	glVertexAttrib3f(m_attribute.DiffuseMaterial,
 		color.x, color.y, color.z);
 
-	glEnableVertexAttribArray(m_attribute.Position);
-	glEnableVertexAttribArray(m_attribute.Normal);
+	if (lod >= 0) {
+		DrawTriangleBuffers(drawable.LodVertexArray,
+							drawable.VertexBuffer,
+							drawable.VertexCount,
+							drawable.LodIndexBuffer,
+							GL_TRIANGLES,
+							drawable.Lods[lod].FirstIndex,
+							drawable.Lods[lod].TriangleIndexCount,
+							drawable.TriangleIndexType);
+	} else if (drawable.Submeshes.empty()) {
+		DrawTriangleBuffers(drawable.TriangleVertexArray,
+							drawable.VertexBuffer,
+							drawable.VertexCount,
+							drawable.TriangleIndexBuffer,
+							drawable.TrianglePrimitive,
+							0,
+							drawable.TriangleIndexCount,
+							drawable.TriangleIndexType);
+	}
+
+	for (size_t i = 0; i < drawable.Submeshes.size(); i++) {
+		const Submesh& submesh = drawable.Submeshes[i];
+		DrawTriangleBuffers(submesh.VertexArray,
+							submesh.VertexBuffer,
+							submesh.VertexCount,
+							submesh.TriangleIndexBuffer,
+							GL_TRIANGLES,
+							0,
+							submesh.TriangleIndexCount,
+							GL_UNSIGNED_SHORT);
+	}
+
+}
+
+void RenderingEngine::DrawTriangleBuffers(GLuint vertexArray,
+										  GLuint vertexBuffer,
+										  int vertexCount,
+										  GLuint indexBuffer,
+										  GLenum primitive,
+										  int firstIndex,
+										  int indexCount,
+										  GLenum indexType) const
+{
+	if (!BindVertexArray(vertexArray)) {
+		SetTriangleAttributes(vertexBuffer, vertexCount);
+		m_state.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	}
+	DrawIndices(primitive, firstIndex, indexCount, indexType);
+}
+
+// Binds vertexArray, or the default one for 0 so that the attributes and
+// index buffer set up next do not go into another; false for 0.
+bool RenderingEngine::BindVertexArray(GLuint vertexArray) const
+{
+	if (m_vertexArraysSupported)
+		m_state.BindVertexArray(vertexArray);
+	return vertexArray != 0;
+}
+
+void RenderingEngine::SetTriangleAttributes(GLuint vertexBuffer,
+											int vertexCount) const
+{
+	m_state.SetVertexAttribArrays(AttributeBit(m_attribute.Position) |
+								  AttributeBit(m_attribute.Normal));
+	m_state.BindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	SetVertexAttribPointer(m_attribute.Position,
+						   m_vertexFormat.GetPosition(vertexCount));
+	SetVertexAttribPointer(m_attribute.Normal,
+						   m_vertexFormat.GetNormal(vertexCount));
+}
+
+void RenderingEngine::SetGridAttributes(const Drawable& drawable) const
+{
+	const EquationProgram& equation = m_equations[drawable.Equation];
+	m_state.SetVertexAttribArrays(AttributeBit(equation.Grid));
+	m_state.BindBuffer(GL_ARRAY_BUFFER, drawable.VertexBuffer);
+	glVertexAttribPointer(equation.Grid, 2, GL_FLOAT,
+		GL_FALSE, sizeof(vec2), 0);
+}
 
-	glBindBuffer(GL_ARRAY_BUFFER, drawable.VertexBuffer);
-	glVertexAttribPointer(m_attribute.Position, 3, GL_FLOAT, 
-		GL_FALSE, stride, 0);
-	glVertexAttribPointer(m_attribute.Normal, 3, GL_FLOAT,
-		GL_FALSE, stride, offset);
+void RenderingEngine::SetLineAttributes(const Drawable& drawable) const
+{
+	m_state.SetVertexAttribArrays(AttributeBit(m_attributeLine.Position));
+	m_state.BindBuffer(GL_ARRAY_BUFFER, drawable.VertexBuffer);
+	SetVertexAttribPointer(m_attributeLine.Position,
+						   m_vertexFormat.GetPosition(drawable.VertexCount));
+}
+
+// Uploads the transform to the program in use, premultiplied when the
+// program takes it that way. The cache drops the uploads that would not
+// change anything, such as the projection shared by same-sized viewports.
+void RenderingEngine::SetTransformUniforms(GLint modelviewProjectionUniform,
+										   GLint modelviewUniform,
+										   GLint projectionUniform,
+										   const mat4& modelview,
+										   const mat4& projectionMatrix) const
+{
+	if (modelviewProjectionUniform >= 0) {
+		mat4 modelviewProjection = modelview * projectionMatrix;
+		m_state.UniformMatrix4fv(modelviewProjectionUniform,
+								 modelviewProjection.Pointer());
+		return;
+	}
+	m_state.UniformMatrix4fv(modelviewUniform, modelview.Pointer());
+	m_state.UniformMatrix4fv(projectionUniform, projectionMatrix.Pointer());
+}
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, drawable.TriangleIndexBuffer);
-	glDrawElements(GL_TRIANGLES, drawable.TriangleIndexCount, GL_UNSIGNED_SHORT, 0);
+void RenderingEngine::DrawIndices(GLenum primitive,
+								  int firstIndex,
+								  int indexCount,
+								  GLenum indexType) const
+{
+	int indexSize = indexType == GL_UNSIGNED_INT ? sizeof(GLuint)
+												 : sizeof(GLushort);
+	const GLvoid* indices = (const GLvoid*) (size_t) (firstIndex * indexSize);
 
-	glDisableVertexAttribArray(m_attribute.Position);
-	glDisableVertexAttribArray(m_attribute.Normal);
-	glDisable(GL_POLYGON_OFFSET_FILL);
+	glDrawElements(primitive, indexCount, indexType, indices);
+	m_statistics.DrawCalls++;
+	// A strip's count takes in the degenerate triangles joining its rows.
+	m_statistics.TrianglesDrawn += primitive == GL_TRIANGLE_STRIP ?
+								   indexCount - 2 : indexCount / 3;
+	m_statistics.IndexBytesDrawn += indexCount * indexSize;
+}
+
+void RenderingEngine::RenderEquation(mat4& modelview,
+									 mat4& projectionMatrix,
+									 const vec3& Color,
+									 const Drawable& drawable) const
+{
+	const EquationProgram& equation = m_equations[drawable.Equation];
+
+	m_state.Enable(GL_POLYGON_OFFSET_FILL);
+
+	m_state.UseProgram(equation.Program);
+	SetTransformUniforms(equation.Uniform.ModelviewProjection,
+						 equation.Uniform.Modelview,
+						 equation.Uniform.Projection,
+						 modelview,
+						 projectionMatrix);
+	mat3 normalMatrix = modelview.ToMat3();
+	m_state.UniformMatrix3fv(equation.Uniform.NormalMatrix, normalMatrix.Pointer());
+
+	// The surface's own parameters; changing them costs nothing more.
+	m_state.Uniform2f(equation.UpperBound,
+		drawable.UpperBound.x, drawable.UpperBound.y);
+	m_state.Uniform4f(equation.Parameters,
+		drawable.Parameters.x, drawable.Parameters.y,
+		drawable.Parameters.z, drawable.Parameters.w);
+
+	vec3 color = Color * 0.75f;
+	glVertexAttrib3f(equation.DiffuseMaterial,
+		color.x, color.y, color.z);
+
+	if (!BindVertexArray(drawable.TriangleVertexArray)) {
+		SetGridAttributes(drawable);
+		m_state.BindBuffer(GL_ELEMENT_ARRAY_BUFFER,
+						   drawable.TriangleIndexBuffer);
+	}
+	DrawIndices(drawable.TrianglePrimitive,
+				0,
+				drawable.TriangleIndexCount,
+				drawable.TriangleIndexType);
 }
 
 void RenderingEngine::RenderLines(mat4& modelview, 
 								  mat4& projectionMatrix, 
 								  const Drawable& drawable) const
 {
-	glUseProgram(m_line_program);
+	// Without line indices there is nothing to draw, and an empty draw
+	// would still switch programs and count as a call.
+	if (drawable.LineIndexCount == 0)
+		return;
 
-	int stride = 2*sizeof(vec3);
+	m_state.Disable(GL_POLYGON_OFFSET_FILL);
+	m_state.UseProgram(m_line_program);
 
-	glUniformMatrix4fv(m_uniformLine.Modelview, 1, 0, modelview.Pointer());
-	glUniformMatrix4fv(m_uniformLine.Projection, 1, 0, projectionMatrix.Pointer());
+	SetTransformUniforms(m_uniformLine.ModelviewProjection,
+						 m_uniformLine.Modelview,
+						 m_uniformLine.Projection,
+						 modelview,
+						 projectionMatrix);
 	glVertexAttrib4f(m_attributeLine.Color, 1.f, 1.f, 1.f, 1.f);
 
-	glEnableVertexAttribArray(m_attributeLine.Position);
-	glBindBuffer(GL_ARRAY_BUFFER, drawable.VertexBuffer);
-	glVertexAttribPointer(m_attributeLine.Position, 3, GL_FLOAT,
-		GL_FALSE, stride, 0);
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, drawable.LineIndexBuffer);
+	if (!BindVertexArray(drawable.LineVertexArray)) {
+		SetLineAttributes(drawable);
+		m_state.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, drawable.LineIndexBuffer);
+	}
 	glDrawElements(GL_LINES, drawable.LineIndexCount, GL_UNSIGNED_SHORT, 0);
-	glDisableVertexAttribArray(m_attributeLine.Position);
+	m_statistics.DrawCalls++;
 }
 
 void RenderingEngine::Render(const vector<Visual>& visuals) const
 {
     glClearColor(0.0, 0.125f, 0.25f, 1);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        
+	m_statistics.DrawCalls = 0;
+	m_statistics.TrianglesDrawn = 0;
+	m_statistics.IndexBytesDrawn = 0;
+	m_statistics.ThumbnailsCopied = 0;
+	m_statistics.ThumbnailsRendered = 0;
+	m_statistics.FragmentsSaved = 0;
+	m_state.ResetCounters();
+
+	++m_frame;
+	m_thumbnailCopies.clear();
     vector<Visual>::const_iterator visual = visuals.begin();
     for (int visualIndex = 0; visual != visuals.end(); ++visual, ++visualIndex) {
-        // Set the viewport transform.
-        ivec2 size = visual->ViewportSize;
-        ivec2 lowerLeft = visual->LowerLeft;
-        glViewport(lowerLeft.x, lowerLeft.y, size.x, size.y);
+		int thumbnail = visual->Static ? FindThumbnail(*visual, visualIndex)
+									   : -1;
+		if (thumbnail >= 0)
+			m_thumbnailCopies.push_back(ivec2(thumbnail, visualIndex));
+		else
+			RenderVisual(*visual, m_drawables[visualIndex]);
+	}
+	CopyThumbnails(visuals);
 
-		// Draw the wireframe.
-		const Drawable& drawable = m_drawables[visualIndex];
+	m_statistics.StateCallsIssued = m_state.GetIssuedCalls();
+	m_statistics.StateCallsElided = m_state.GetElidedCalls();
+	m_statistics.UniformBytesUploaded = m_state.GetUniformBytes();
+}
 
-		// Set the model-view transform.
-		mat4 rotation = visual->Orientation.ToMatrix();
-		mat4 modelview = rotation * m_translation;
+void RenderingEngine::RenderVisual(const Visual& visual,
+								   const Drawable& drawable) const
+{
+    // Set the viewport transform.
+    ivec2 size = visual.ViewportSize;
+    ivec2 lowerLeft = visual.LowerLeft;
+    m_state.Viewport(lowerLeft.x, lowerLeft.y, size.x, size.y);
 
-		// Set the projection transform.
-		float h = 4.0f * size.y / size.x;
-		mat4 projectionMatrix = mat4::Frustum(-2, 2, -h / 2, h / 2, 5, 10);
+	// Set the model-view transform.
+	mat4 rotation = visual.Orientation.ToMatrix();
+	mat4 modelview = rotation * m_translation;
 
-		RenderTriangles(modelview, projectionMatrix, visual->Color, drawable);
-		if (drawable.LineIndexCount == 0)
-			RenderLines(modelview, projectionMatrix, drawable);
-    }
+	// Set the projection transform.
+	float h = 4.0f * size.y / size.x;
+	mat4 projectionMatrix = mat4::Frustum(-2, 2, -h / 2, h / 2, 5, 10);
+
+	if (drawable.Equation >= 0) {
+		RenderEquation(modelview, projectionMatrix, visual.Color, drawable);
+		return;
+	}
+
+	float projectedRadius = ComputeProjectedRadius(drawable, modelview,
+												   projectionMatrix, size);
+	int lod = SelectLod(drawable, projectedRadius);
+
+	RenderTriangles(modelview, projectionMatrix, visual.Color, drawable, lod);
+	if (drawable.LineIndexCount == 0)
+		RenderLines(modelview, projectionMatrix, drawable);
+}
+
+// The thumbnail of the visual, which is drawn first if there is none;
+// -1 when the visual does not fit into the atlas.
+int RenderingEngine::FindThumbnail(const Visual& visual, int index) const
+{
+	for (size_t i = 0; i < m_thumbnails.size(); i++) {
+		const Thumbnail& thumbnail = m_thumbnails[i];
+		if (thumbnail.Drawable == index &&
+			thumbnail.Color == visual.Color &&
+			thumbnail.Orientation == visual.Orientation &&
+			thumbnail.Size == visual.ViewportSize) {
+			m_thumbnails[i].LastUsed = m_frame;
+			return i;
+		}
+	}
+
+	int place = m_thumbnailFramebuffer ?
+		AllocateThumbnail(visual.ViewportSize) : -1;
+	if (place < 0)
+		return -1;
+	Thumbnail& thumbnail = m_thumbnails[place];
+	thumbnail.Drawable = index;
+	thumbnail.Color = visual.Color;
+	thumbnail.Orientation = visual.Orientation;
+	thumbnail.Size = visual.ViewportSize;
+
+	GLint framebuffer;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_thumbnailFramebuffer);
+
+	// The background is the same as the frame's, so a copy needs no
+	// blending.
+	const ivec2& lowerLeft = thumbnail.LowerLeft;
+	m_state.Enable(GL_SCISSOR_TEST);
+	glScissor(lowerLeft.x, lowerLeft.y, thumbnail.Size.x, thumbnail.Size.y);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	m_state.Disable(GL_SCISSOR_TEST);
+
+	Visual drawn = visual;
+	drawn.LowerLeft = lowerLeft;
+	RenderVisual(drawn, m_drawables[index]);
+
+	// The pixels no longer the background's were lit by the visual. Only
+	// the drawing of a thumbnail waits for the read, never a copy.
+	const ivec2& size = thumbnail.Size;
+	m_thumbnailPixels.resize(size.x * size.y * 4);
+	glReadPixels(lowerLeft.x, lowerLeft.y, size.x, size.y, GL_RGBA,
+				 GL_UNSIGNED_BYTE, m_thumbnailPixels.data());
+	thumbnail.Fragments = 0;
+	for (size_t i = 0; i < m_thumbnailPixels.size(); i += 4)
+		if (m_thumbnailPixels[i] != 0 || m_thumbnailPixels[i + 1] != 32 ||
+			m_thumbnailPixels[i + 2] != 64)
+			thumbnail.Fragments++;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	thumbnail.LastUsed = m_frame;
+	thumbnail.Drawn = m_frame;
+	m_statistics.ThumbnailsRendered++;
+	return place;
+}
+
+// A free place in the atlas for a thumbnail of the given size, taken from
+// a thumbnail no longer needed or else from the next shelf; -1 when there
+// is none. Thumbnails copied this frame or the last one are kept, so a
+// visual that does not fit among them is drawn as the others are until
+// some go out of use, rather than every thumbnail being drawn again.
+int RenderingEngine::AllocateThumbnail(const ivec2& size) const
+{
+	if (size.x <= 0 || size.y <= 0 ||
+		size.x > ThumbnailAtlasSize || size.y > ThumbnailAtlasSize)
+		return -1;
+
+	int place = FindFreeThumbnail(size);
+	if (place >= 0)
+		return place;
+
+	if (m_shelfCorner.x + size.x > ThumbnailAtlasSize) {
+		m_shelfCorner = ivec2(0, m_shelfCorner.y + m_shelfHeight);
+		m_shelfHeight = 0;
+	}
+	if (m_shelfCorner.y + size.y <= ThumbnailAtlasSize) {
+		Thumbnail thumbnail;
+		thumbnail.LowerLeft = m_shelfCorner;
+		thumbnail.Place = size;
+		m_thumbnails.push_back(thumbnail);
+		m_shelfCorner.x += size.x;
+		m_shelfHeight = std::max(m_shelfHeight, size.y);
+		return m_thumbnails.size() - 1;
+	}
+
+	// Free the places of thumbnails out of use; when that frees them all,
+	// start the shelves over, as the places may not suit the sizes now
+	// wanted.
+	bool inUse = false;
+	for (size_t i = 0; i < m_thumbnails.size(); i++) {
+		Thumbnail& thumbnail = m_thumbnails[i];
+		if (thumbnail.Drawable >= 0 && thumbnail.LastUsed < m_frame - 1)
+			thumbnail.Drawable = -1;
+		inUse = inUse || thumbnail.Drawable >= 0;
+	}
+	if (!inUse) {
+		m_thumbnails.clear();
+		m_shelfCorner = ivec2(0, 0);
+		m_shelfHeight = 0;
+		return AllocateThumbnail(size);
+	}
+	return FindFreeThumbnail(size);
+}
+
+// The smallest free place that holds size, or -1.
+int RenderingEngine::FindFreeThumbnail(const ivec2& size) const
+{
+	int best = -1;
+	for (size_t i = 0; i < m_thumbnails.size(); i++) {
+		const Thumbnail& thumbnail = m_thumbnails[i];
+		if (thumbnail.Drawable >= 0 ||
+			thumbnail.Place.x < size.x || thumbnail.Place.y < size.y)
+			continue;
+		if (best < 0 || thumbnail.Place.x * thumbnail.Place.y <
+			m_thumbnails[best].Place.x * m_thumbnails[best].Place.y)
+			best = i;
+	}
+	return best;
+}
+
+// Copies each thumbnail texel for texel onto its visual's viewport, over
+// whatever the visuals drawn before left there.
+void RenderingEngine::CopyThumbnails(const vector<Visual>& visuals) const
+{
+	if (m_thumbnailCopies.empty())
+		return;
+
+	m_state.Disable(GL_DEPTH_TEST);
+	m_state.UseProgram(m_thumbnailProgram);
+	m_state.BindTexture(m_thumbnailTexture);
+	BindVertexArray(0);
+	m_state.SetVertexAttribArrays(AttributeBit(m_thumbnailCorner));
+	m_state.BindBuffer(GL_ARRAY_BUFFER, m_cornerBuffer);
+	glVertexAttribPointer(m_thumbnailCorner, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+	const float texel = 1.0f / ThumbnailAtlasSize;
+	for (size_t i = 0; i < m_thumbnailCopies.size(); i++) {
+		const Thumbnail& thumbnail = m_thumbnails[m_thumbnailCopies[i].x];
+		const Visual& visual = visuals[m_thumbnailCopies[i].y];
+		m_state.Viewport(visual.LowerLeft.x, visual.LowerLeft.y,
+						 thumbnail.Size.x, thumbnail.Size.y);
+		m_state.Uniform4f(m_thumbnailTextureRect,
+						  thumbnail.LowerLeft.x * texel,
+						  thumbnail.LowerLeft.y * texel,
+						  thumbnail.Size.x * texel,
+						  thumbnail.Size.y * texel);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		m_statistics.DrawCalls++;
+		m_statistics.ThumbnailsCopied++;
+		if (thumbnail.Drawn != m_frame)
+			m_statistics.FragmentsSaved += thumbnail.Fragments;
+	}
+	m_state.Enable(GL_DEPTH_TEST);
+}
+
+void RenderingEngine::RenderInstances(int index,
+									  const vector<Visual>& instances) const
+{
+	const Drawable& drawable = m_drawables[index];
+
+	// Surfaces the vertex shader evaluates, submeshes, and surfaces too
+	// large to batch are drawn a copy at a time, as Render would.
+	bool batched = !m_instancedArraysSupported;
+	if (drawable.Equation >= 0 || !drawable.Submeshes.empty() ||
+		(batched && drawable.BatchSize == 0)) {
+		for (size_t i = 0; i < instances.size(); i++)
+			RenderVisual(instances[i], drawable);
+	} else if (!instances.empty()) {
+		// One viewport takes in all the copies.
+		ivec2 lowerLeft = instances[0].LowerLeft;
+		ivec2 upperRight = lowerLeft + instances[0].ViewportSize;
+		for (size_t i = 1; i < instances.size(); i++) {
+			ivec2 corner = instances[i].LowerLeft;
+			ivec2 size = instances[i].ViewportSize;
+			lowerLeft = ivec2(std::min(lowerLeft.x, corner.x),
+							  std::min(lowerLeft.y, corner.y));
+			upperRight = ivec2(std::max(upperRight.x, corner.x + size.x),
+							   std::max(upperRight.y, corner.y + size.y));
+		}
+		ivec2 size = upperRight - lowerLeft;
+		m_state.Viewport(lowerLeft.x, lowerLeft.y, size.x, size.y);
+
+		// The copies share a square frustum; scaling clip space to a copy's
+		// viewport makes it the frustum Render would give it. The level of
+		// detail is the one the largest copy needs.
+		m_instances.resize(instances.size());
+		float projectedRadius = 0;
+		for (size_t i = 0; i < instances.size(); i++) {
+			const Visual& visual = instances[i];
+			ivec2 viewportSize = visual.ViewportSize;
+			ivec2 offset = visual.LowerLeft - lowerLeft;
+
+			Instance& instance = m_instances[i];
+			instance.Orientation = visual.Orientation.ToVector();
+			instance.Viewport = vec4(
+				(float) viewportSize.x / size.x,
+				(float) viewportSize.x / size.y,
+				(float) (2 * offset.x + viewportSize.x) / size.x - 1,
+				(float) (2 * offset.y + viewportSize.y) / size.y - 1);
+			instance.Color = visual.Color * 0.75f;
+
+			mat4 rotation = visual.Orientation.ToMatrix();
+			mat4 modelview = rotation * m_translation;
+			float h = 4.0f * viewportSize.y / viewportSize.x;
+			mat4 projectionMatrix = mat4::Frustum(-2, 2, -h / 2, h / 2, 5, 10);
+			projectedRadius = std::max(projectedRadius,
+				ComputeProjectedRadius(drawable, modelview, projectionMatrix,
+									   viewportSize));
+		}
+		int lod = SelectLod(drawable, projectedRadius);
+
+		m_state.Enable(GL_POLYGON_OFFSET_FILL);
+		m_state.UseProgram(m_instanceProgram.Program);
+		mat4 projectionMatrix = mat4::Frustum(-2, 2, -2, 2, 5, 10);
+		m_state.UniformMatrix4fv(m_instanceProgram.Projection,
+								 projectionMatrix.Pointer());
+		m_state.Uniform3f(m_instanceProgram.Translation, m_translation.w.x,
+						  m_translation.w.y, m_translation.w.z);
+
+		if (batched)
+			DrawBatches(drawable, lod);
+		else
+			DrawInstances(drawable, lod);
+	}
+
+	m_statistics.StateCallsIssued = m_state.GetIssuedCalls();
+	m_statistics.StateCallsElided = m_state.GetElidedCalls();
+	m_statistics.UniformBytesUploaded = m_state.GetUniformBytes();
+}
+
+// The divisors belong to the default vertex array, where the draws that
+// set up their attributes anew would trip over them, so they are only
+// set for the draw.
+void RenderingEngine::DrawInstances(const Drawable& drawable, int lod) const
+{
+	const InstanceProgram& program = m_instanceProgram;
+	BindVertexArray(0);
+
+	// Orphan the copies of the last draw, as UpdateSurface does.
+	int size = m_instances.size() * sizeof(Instance);
+	m_state.BindBuffer(GL_ARRAY_BUFFER, m_instanceBuffer);
+	glBufferData(GL_ARRAY_BUFFER, size, 0, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, size, &m_instances[0]);
+
+	GLuint instanceAttributes[] = { program.InstanceOrientation,
+									program.InstanceViewport,
+									program.DiffuseMaterial };
+	glVertexAttribPointer(program.InstanceOrientation, 4, GL_FLOAT, GL_FALSE,
+		sizeof(Instance), (const GLvoid*) offsetof(Instance, Orientation));
+	glVertexAttribPointer(program.InstanceViewport, 4, GL_FLOAT, GL_FALSE,
+		sizeof(Instance), (const GLvoid*) offsetof(Instance, Viewport));
+	glVertexAttribPointer(program.DiffuseMaterial, 3, GL_FLOAT, GL_FALSE,
+		sizeof(Instance), (const GLvoid*) offsetof(Instance, Color));
+	for (int i = 0; i < 3; i++)
+		m_state.VertexAttribDivisor(instanceAttributes[i], 1);
+
+	m_state.SetVertexAttribArrays(AttributeBit(program.Position) |
+								  AttributeBit(program.Normal) |
+								  AttributeBit(program.InstanceOrientation) |
+								  AttributeBit(program.InstanceViewport) |
+								  AttributeBit(program.DiffuseMaterial));
+	m_state.BindBuffer(GL_ARRAY_BUFFER, drawable.VertexBuffer);
+	SetVertexAttribPointer(program.Position,
+						   m_vertexFormat.GetPosition(drawable.VertexCount));
+	SetVertexAttribPointer(program.Normal,
+						   m_vertexFormat.GetNormal(drawable.VertexCount));
+
+	GLuint indexBuffer = drawable.TriangleIndexBuffer;
+	GLenum primitive = drawable.TrianglePrimitive;
+	int firstIndex = 0;
+	int indexCount = drawable.TriangleIndexCount;
+	if (lod >= 0) {
+		indexBuffer = drawable.LodIndexBuffer;
+		primitive = GL_TRIANGLES;
+		firstIndex = drawable.Lods[lod].FirstIndex;
+		indexCount = drawable.Lods[lod].TriangleIndexCount;
+	}
+	m_state.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+
+	GLenum indexType = drawable.TriangleIndexType;
+	int indexSize = indexType == GL_UNSIGNED_INT ? sizeof(GLuint)
+												 : sizeof(GLushort);
+	int instanceCount = m_instances.size();
+	m_state.DrawElementsInstanced(primitive, indexCount, indexType,
+		(const GLvoid*) (size_t) (firstIndex * indexSize), instanceCount);
+	m_statistics.DrawCalls++;
+	m_statistics.TrianglesDrawn += instanceCount *
+		(primitive == GL_TRIANGLE_STRIP ? indexCount - 2 : indexCount / 3);
+	m_statistics.IndexBytesDrawn += instanceCount * indexCount * indexSize;
+
+	for (int i = 0; i < 3; i++)
+		m_state.VertexAttribDivisor(instanceAttributes[i], 0);
+}
+
+// Each batch draws as many copies of the triangles as it has copies of
+// the instances, which InstanceIndex picks from the uniform arrays.
+void RenderingEngine::DrawBatches(const Drawable& drawable, int lod) const
+{
+	const InstanceProgram& program = m_instanceProgram;
+	const int floatsPerVertex = m_vertexFormat.GetFloatsPerVertex();
+	int batchSize = drawable.BatchSize;
+	int vertexCount = drawable.VertexCount * batchSize;
+
+	BindVertexArray(0);
+	m_state.SetVertexAttribArrays(AttributeBit(program.Position) |
+								  AttributeBit(program.Normal) |
+								  AttributeBit(program.InstanceIndex));
+	m_state.BindBuffer(GL_ARRAY_BUFFER, drawable.BatchVertexBuffer);
+	SetVertexAttribPointer(program.Position,
+						   m_vertexFormat.GetPosition(vertexCount));
+	SetVertexAttribPointer(program.Normal,
+						   m_vertexFormat.GetNormal(vertexCount));
+	glVertexAttribPointer(program.InstanceIndex, 1, GL_FLOAT, GL_FALSE, 0,
+		(const GLvoid*) (vertexCount * floatsPerVertex * sizeof(float)));
+	m_state.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, drawable.BatchIndexBuffer);
+
+	const vector<int>& firstIndices = drawable.BatchFirstIndices;
+	int firstIndex = firstIndices[lod + 1];
+	int indexCount = (firstIndices[lod + 2] - firstIndex) / batchSize;
+
+	int instanceCount = m_instances.size();
+	for (int first = 0; first < instanceCount; first += batchSize) {
+		int count = std::min(batchSize, instanceCount - first);
+		m_batchUniforms.resize(count * 11);
+		float* orientations = &m_batchUniforms[0];
+		float* viewports = orientations + count * 4;
+		float* colors = viewports + count * 4;
+		for (int i = 0; i < count; i++) {
+			const Instance& instance = m_instances[first + i];
+			std::copy(instance.Orientation.Pointer(),
+					  instance.Orientation.Pointer() + 4, orientations + i * 4);
+			std::copy(instance.Viewport.Pointer(),
+					  instance.Viewport.Pointer() + 4, viewports + i * 4);
+			std::copy(instance.Color.Pointer(),
+					  instance.Color.Pointer() + 3, colors + i * 3);
+		}
+		m_state.Uniform4fv(program.InstanceOrientations, count, orientations);
+		m_state.Uniform4fv(program.InstanceViewports, count, viewports);
+		m_state.Uniform3fv(program.InstanceColors, count, colors);
+
+		DrawIndices(GL_TRIANGLES, firstIndex, indexCount * count,
+					GL_UNSIGNED_SHORT);
+	}
+}
+
+RenderStatistics RenderingEngine::GetStatistics() const
+{
+    return m_statistics;
 }
 
 GLuint RenderingEngine::BuildShader(const char* source, GLenum shaderType) const
@@ -355,5 +1903,122 @@ GLuint RenderingEngine::BuildProgram(const char* vertexShaderSource,
     
     return programHandle;
 }
+
+bool RenderingEngine::HasExtension(const char* name) const
+{
+    const char* extensions = (const char*) glGetString(GL_EXTENSIONS);
+    if (!extensions)
+        return false;
+
+    // Match whole names only; one extension name can prefix another.
+    size_t length = strlen(name);
+    for (const char* p = extensions; (p = strstr(p, name)) != 0; p += length) {
+        bool starts = p == extensions || p[-1] == ' ';
+        bool ends = p[length] == ' ' || p[length] == '\0';
+        if (starts && ends)
+            return true;
+    }
+    return false;
+}
+
+// ES 3.0 has instanced arrays; ES 2.0 needs ANGLE_instanced_arrays or
+// EXT_instanced_arrays, which name the same functions with a suffix.
+bool RenderingEngine::LoadInstancedArrays()
+{
+    const char* version = (const char*) glGetString(GL_VERSION);
+    const char* suffix = 0;
+    if (version && strncmp(version, "OpenGL ES ", 10) == 0 &&
+        atoi(version + 10) >= 3)
+        suffix = "";
+    else if (HasExtension("GL_ANGLE_instanced_arrays"))
+        suffix = "ANGLE";
+    else if (HasExtension("GL_EXT_instanced_arrays"))
+        suffix = "EXT";
+    return suffix && m_state.LoadInstancedArrays(suffix);
+}
+
+void RenderingEngine::CreateInstanceProgram()
+{
+    InstanceProgram& program = m_instanceProgram;
+    program.Program = BuildProgram(m_instancedArraysSupported ?
+                                   InstancedLightingVertexShader :
+                                   BatchedLightingVertexShader,
+                                   PixelLightingFragmentShader);
+    GLuint handle = program.Program;
+    program.Position = glGetAttribLocation(handle, "Position");
+    program.Normal = glGetAttribLocation(handle, "Normal");
+    program.InstanceOrientation = glGetAttribLocation(handle, "InstanceOrientation");
+    program.InstanceViewport = glGetAttribLocation(handle, "InstanceViewport");
+    program.DiffuseMaterial = glGetAttribLocation(handle, "DiffuseMaterial");
+    program.InstanceIndex = glGetAttribLocation(handle, "InstanceIndex");
+    program.Projection = glGetUniformLocation(handle, "Projection");
+    program.Translation = glGetUniformLocation(handle, "Translation");
+    program.InstanceOrientations = glGetUniformLocation(handle, "InstanceOrientations");
+    program.InstanceViewports = glGetUniformLocation(handle, "InstanceViewports");
+    program.InstanceColors = glGetUniformLocation(handle, "InstanceColors");
+
+    // The same light as the other triangles.
+    m_state.UseProgram(handle);
+    m_state.Uniform3f(glGetUniformLocation(handle, "LightPosition"), 0.25, 0.25, 0.25);
+    m_state.Uniform3f(glGetUniformLocation(handle, "SpecularMaterial"), 0.5, 0.5, 0.5);
+    m_state.Uniform1f(glGetUniformLocation(handle, "Shininess"), 50);
+
+    m_instanceBuffer = 0;
+    if (m_instancedArraysSupported)
+        glGenBuffers(1, &m_instanceBuffer);
+}
+
+void RenderingEngine::CreateThumbnailAtlas()
+{
+    glGenTextures(1, &m_thumbnailTexture);
+    m_state.BindTexture(m_thumbnailTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, ThumbnailAtlasSize,
+                 ThumbnailAtlasSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+
+    glGenRenderbuffers(1, &m_thumbnailDepthbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_thumbnailDepthbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16,
+                          ThumbnailAtlasSize, ThumbnailAtlasSize);
+
+    // The framebuffer drawn to by the caller stays bound.
+    GLint framebuffer;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebuffer);
+    glGenFramebuffers(1, &m_thumbnailFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_thumbnailFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, m_thumbnailTexture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                              GL_RENDERBUFFER, m_thumbnailDepthbuffer);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) ==
+                    GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+    // Without the atlas every static visual is drawn as the others are.
+    if (!complete) {
+        glDeleteFramebuffers(1, &m_thumbnailFramebuffer);
+        m_thumbnailFramebuffer = 0;
+    }
+
+    m_thumbnailProgram = BuildProgram(ThumbnailVertexShader,
+                                      ThumbnailFragmentShader);
+    m_thumbnailCorner = glGetAttribLocation(m_thumbnailProgram, "Corner");
+    m_thumbnailTextureRect = glGetUniformLocation(m_thumbnailProgram,
+                                                  "TextureRect");
+
+    // The corners of the quad, as a strip.
+    const float corners[] = { 0, 0,  1, 0,  0, 1,  1, 1 };
+    glGenBuffers(1, &m_cornerBuffer);
+    m_state.BindBuffer(GL_ARRAY_BUFFER, m_cornerBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+
+    m_thumbnails.clear();
+    m_shelfCorner = ivec2(0, 0);
+    m_shelfHeight = 0;
+    m_frame = 0;
+}
     
 }
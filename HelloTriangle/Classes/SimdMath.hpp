@@ -0,0 +1,314 @@
+#pragma once
+#include <cmath>
+#include "Vector.hpp"
+#include "ParametricSurface.hpp"
+
+// Four floats processed together with SSE2 or NEON, or one at a time on
+// anything else. Comparisons return masks that only Select understands.
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+struct Float4 {
+#if defined(SIMD_SSE2)
+    __m128 m;
+    Float4() {}
+    Float4(__m128 m) : m(m) {}
+    Float4(float s) : m(_mm_set1_ps(s)) {}
+    static Float4 Load(const float* p) { return _mm_loadu_ps(p); }
+    void Store(float* p) const { _mm_storeu_ps(p, m); }
+#elif defined(SIMD_NEON)
+    float32x4_t m;
+    Float4() {}
+    Float4(float32x4_t m) : m(m) {}
+    Float4(float s) : m(vdupq_n_f32(s)) {}
+    static Float4 Load(const float* p) { return vld1q_f32(p); }
+    void Store(float* p) const { vst1q_f32(p, m); }
+#else
+    float m[4];
+    Float4() {}
+    Float4(float s) { m[0] = m[1] = m[2] = m[3] = s; }
+    static Float4 Load(const float* p)
+    {
+        Float4 r;
+        for (int i = 0; i < 4; i++)
+            r.m[i] = p[i];
+        return r;
+    }
+    void Store(float* p) const
+    {
+        for (int i = 0; i < 4; i++)
+            p[i] = m[i];
+    }
+#endif
+};
+
+typedef Vector3<Float4> vec3x4;
+
+#if defined(SIMD_SSE2)
+
+inline Float4 operator+(const Float4& a, const Float4& b) { return _mm_add_ps(a.m, b.m); }
+inline Float4 operator-(const Float4& a, const Float4& b) { return _mm_sub_ps(a.m, b.m); }
+inline Float4 operator*(const Float4& a, const Float4& b) { return _mm_mul_ps(a.m, b.m); }
+inline Float4 operator/(const Float4& a, const Float4& b) { return _mm_div_ps(a.m, b.m); }
+inline Float4 operator<(const Float4& a, const Float4& b) { return _mm_cmplt_ps(a.m, b.m); }
+inline Float4 Sqrt(const Float4& a) { return _mm_sqrt_ps(a.m); }
+
+inline Float4 Select(const Float4& mask, const Float4& a, const Float4& b)
+{
+    return _mm_or_ps(_mm_and_ps(mask.m, a.m), _mm_andnot_ps(mask.m, b.m));
+}
+
+inline Float4 Floor(const Float4& a)
+{
+    Float4 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.m));
+    return t - Select(a < t, 1.0f, 0.0f);
+}
+
+#elif defined(SIMD_NEON)
+
+inline Float4 operator+(const Float4& a, const Float4& b) { return vaddq_f32(a.m, b.m); }
+inline Float4 operator-(const Float4& a, const Float4& b) { return vsubq_f32(a.m, b.m); }
+inline Float4 operator*(const Float4& a, const Float4& b) { return vmulq_f32(a.m, b.m); }
+inline Float4 operator<(const Float4& a, const Float4& b)
+{
+    return vreinterpretq_f32_u32(vcltq_f32(a.m, b.m));
+}
+
+#if defined(__aarch64__)
+inline Float4 operator/(const Float4& a, const Float4& b) { return vdivq_f32(a.m, b.m); }
+inline Float4 Sqrt(const Float4& a) { return vsqrtq_f32(a.m); }
+#else
+// ARMv7 only has estimates; two Newton-Raphson steps bring them to
+// nearly full precision.
+inline Float4 operator/(const Float4& a, const Float4& b)
+{
+    float32x4_t r = vrecpeq_f32(b.m);
+    r = vmulq_f32(r, vrecpsq_f32(b.m, r));
+    r = vmulq_f32(r, vrecpsq_f32(b.m, r));
+    return vmulq_f32(a.m, r);
+}
+
+inline Float4 Sqrt(const Float4& a)
+{
+    float32x4_t r = vrsqrteq_f32(a.m);
+    r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(a.m, r), r));
+    r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(a.m, r), r));
+    // a * 1 / sqrt(a), with 0 for 0 rather than 0 * infinity.
+    uint32x4_t zero = vceqq_f32(a.m, vdupq_n_f32(0));
+    return vbslq_f32(zero, a.m, vmulq_f32(a.m, r));
+}
+#endif
+
+inline Float4 Select(const Float4& mask, const Float4& a, const Float4& b)
+{
+    return vbslq_f32(vreinterpretq_u32_f32(mask.m), a.m, b.m);
+}
+
+inline Float4 Floor(const Float4& a)
+{
+    Float4 t = vcvtq_f32_s32(vcvtq_s32_f32(a.m));
+    return t - Select(a < t, 1.0f, 0.0f);
+}
+
+#else
+
+#define SIMD_FLOAT4_OPERATOR(op)                                        \
+inline Float4 operator op(const Float4& a, const Float4& b)             \
+{                                                                       \
+    Float4 r;                                                           \
+    for (int i = 0; i < 4; i++)                                         \
+        r.m[i] = a.m[i] op b.m[i];                                      \
+    return r;                                                           \
+}
+SIMD_FLOAT4_OPERATOR(+)
+SIMD_FLOAT4_OPERATOR(-)
+SIMD_FLOAT4_OPERATOR(*)
+SIMD_FLOAT4_OPERATOR(/)
+#undef SIMD_FLOAT4_OPERATOR
+
+// A nonzero lane means true.
+inline Float4 operator<(const Float4& a, const Float4& b)
+{
+    Float4 r;
+    for (int i = 0; i < 4; i++)
+        r.m[i] = a.m[i] < b.m[i] ? 1.0f : 0.0f;
+    return r;
+}
+
+inline Float4 Select(const Float4& mask, const Float4& a, const Float4& b)
+{
+    Float4 r;
+    for (int i = 0; i < 4; i++)
+        r.m[i] = mask.m[i] != 0 ? a.m[i] : b.m[i];
+    return r;
+}
+
+inline Float4 Sqrt(const Float4& a)
+{
+    Float4 r;
+    for (int i = 0; i < 4; i++)
+        r.m[i] = std::sqrt(a.m[i]);
+    return r;
+}
+
+inline Float4 Floor(const Float4& a)
+{
+    Float4 r;
+    for (int i = 0; i < 4; i++)
+        r.m[i] = std::floor(a.m[i]);
+    return r;
+}
+
+#endif
+
+inline Float4 operator-(const Float4& a)
+{
+    return Float4(0.0f) - a;
+}
+
+// Sine and cosine together, after Cephes' sinf and cosf: x is reduced to
+// [-Pi/4, Pi/4] around the nearest multiple of Pi/2 in three parts to
+// keep the precision, and the quadrant picks and signs the polynomials.
+// Good to about 1e-7 for |x| below a few thousand.
+inline void SinCos(const Float4& x, Float4& s, Float4& c)
+{
+    Float4 quadrant = Floor(x * 0.63661977236758134f + 0.5f);
+    Float4 r = x - quadrant * 1.5703125f;
+    r = r - quadrant * 4.837512969970703125e-4f;
+    r = r - quadrant * 7.549789954891882e-8f;
+
+    Float4 r2 = r * r;
+    Float4 sine = r + r * r2 * (-1.6666654611e-1f + r2 * (8.3321608736e-3f +
+                                r2 * -1.9515295891e-4f));
+    Float4 cosine = 1.0f - r2 * 0.5f + r2 * r2 *
+                    (4.166664568298827e-2f + r2 * (-1.388731625493765e-3f +
+                     r2 * 2.443315711809948e-5f));
+
+    // Quadrant modulo 4: 1 and 3 swap the two, 2 and 3 negate the sine,
+    // 1 and 2 the cosine.
+    Float4 k = quadrant - Floor(quadrant * 0.25f) * 4.0f;
+    Float4 swap = Float4(0.5f) < k - Floor(k * 0.5f) * 2.0f;
+    Float4 sinNegative = Float4(1.5f) < k;
+    Float4 cosNegative = Select(Float4(0.5f) < k, k, 3.0f) < Float4(2.5f);
+
+    Float4 sinValue = Select(swap, cosine, sine);
+    Float4 cosValue = Select(swap, sine, cosine);
+    s = Select(sinNegative, -sinValue, sinValue);
+    c = Select(cosNegative, -cosValue, cosValue);
+}
+
+// Four points of an equation's domain with the sines and cosines of its
+// LatticeAngles there, in the order they were added.
+struct LatticePoint4 {
+    Float4 X;
+    Float4 Y;
+    Float4 SinX[MaxLatticeAngles];
+    Float4 CosX[MaxLatticeAngles];
+    Float4 SinY[MaxLatticeAngles];
+    Float4 CosY[MaxLatticeAngles];
+};
+
+inline LatticePoint4 ComputeLatticePoint4(const LatticeAngles& angles,
+                                          const Float4& x, const Float4& y)
+{
+    LatticePoint4 p;
+    p.X = x;
+    p.Y = y;
+    for (int k = 0; k < angles.ColumnCount; k++)
+        SinCos(x * angles.Columns[k].Scale + angles.Columns[k].Offset,
+               p.SinX[k], p.CosX[k]);
+    for (int k = 0; k < angles.RowCount; k++)
+        SinCos(y * angles.Rows[k].Scale + angles.Rows[k].Offset,
+               p.SinY[k], p.CosY[k]);
+    return p;
+}
+
+// The same from the tables, for four columns from column on in row.
+inline LatticePoint4 LoadLatticePoint4(const TrigLattice& lattice, int row,
+                                       int column)
+{
+    const LatticeAngles& angles = lattice.Angles;
+    LatticePoint4 p;
+    p.X = Float4::Load(&lattice.X[column]);
+    p.Y = lattice.Y[row];
+    for (int k = 0; k < angles.ColumnCount; k++) {
+        int i = k * lattice.Stride + column;
+        p.SinX[k] = Float4::Load(&lattice.ColumnSin[i]);
+        p.CosX[k] = Float4::Load(&lattice.ColumnCos[i]);
+    }
+    for (int k = 0; k < angles.RowCount; k++) {
+        p.SinY[k] = lattice.RowSin[k * lattice.Rows + row];
+        p.CosY[k] = lattice.RowCos[k * lattice.Rows + row];
+    }
+    return p;
+}
+
+// Writes the first lanes of p, dx and dy to points i onwards of count in
+// structure of arrays form; null targets are skipped.
+inline void StoreLanes(const vec3x4& p, const vec3x4& pdx, const vec3x4& pdy,
+                       int count, int i, int lanes,
+                       float* range, float* dx, float* dy)
+{
+    const vec3x4* outputs[3] = { &p, &pdx, &pdy };
+    float* targets[3] = { range, dx, dy };
+    for (int o = 0; o < 3; o++) {
+        if (!targets[o])
+            continue;
+        float lane[3][4];
+        outputs[o]->x.Store(lane[0]);
+        outputs[o]->y.Store(lane[1]);
+        outputs[o]->z.Store(lane[2]);
+        for (int axis = 0; axis < 3; axis++)
+            for (int k = 0; k < lanes; k++)
+                targets[o][axis * count + i + k] = lane[axis][k];
+    }
+}
+
+// Runs surface.EvaluateLattice4 over count points in structure of arrays
+// form, four at a time, taking the sines and cosines with SinCos; the
+// last group is padded with copies of the last point. range, dx and dy
+// hold all the x, then all the y, then all the z values.
+template <typename Surface>
+void EvaluateBatch4(const Surface& surface, const float* u, const float* v,
+                    int count, float* range, float* dx, float* dy)
+{
+    LatticeAngles angles;
+    surface.Surface::GetLatticeAngles(angles);
+    for (int i = 0; i < count; i += 4) {
+        int lanes = count - i < 4 ? count - i : 4;
+        float paddedU[4], paddedV[4];
+        for (int k = 0; k < 4; k++) {
+            paddedU[k] = u[i + (k < lanes ? k : lanes - 1)];
+            paddedV[k] = v[i + (k < lanes ? k : lanes - 1)];
+        }
+
+        vec3x4 p, pdx, pdy;
+        surface.EvaluateLattice4(
+            ComputeLatticePoint4(angles, Float4::Load(paddedU),
+                                 Float4::Load(paddedV)),
+            p, dx ? &pdx : 0, dy ? &pdy : 0);
+        StoreLanes(p, pdx, pdy, count, i, lanes, range, dx, dy);
+    }
+}
+
+// The same for a row of a grid, from the tables of lattice.
+template <typename Surface>
+void EvaluateLatticeRow4(const Surface& surface, const TrigLattice& lattice,
+                         int row, float* range, float* dx, float* dy)
+{
+    int count = lattice.Columns;
+    for (int i = 0; i < count; i += 4) {
+        int lanes = count - i < 4 ? count - i : 4;
+        vec3x4 p, pdx, pdy;
+        surface.EvaluateLattice4(LoadLatticePoint4(lattice, row, i),
+                                 p, dx ? &pdx : 0, dy ? &pdy : 0);
+        StoreLanes(p, pdx, pdy, count, i, lanes, range, dx, dy);
+    }
+}
@@ -0,0 +1,94 @@
+#include <algorithm>
+
+#include "ThreadPool.hpp"
+
+ThreadPool::ThreadPool(int threadCount) :
+    m_body(0),
+    m_count(0),
+    m_busy(0),
+    m_generation(0),
+    m_quit(false)
+{
+    m_next = 0;
+    for (int i = 1; i < threadCount; i++)
+        m_workers.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_wake.notify_all();
+    for (size_t i = 0; i < m_workers.size(); i++)
+        m_workers[i].join();
+}
+
+ThreadPool& ThreadPool::Shared()
+{
+    // Never destroyed: joining the workers from a static destructor, after
+    // main has returned, hangs with the VS2012 runtime. The workers are
+    // idle by then and end with the process.
+    static ThreadPool* pool =
+        new ThreadPool(std::max(1u, std::thread::hardware_concurrency()));
+    return *pool;
+}
+
+void ThreadPool::ParallelFor(int count, const std::function<void(int)>& body)
+{
+    if (count <= 0)
+        return;
+
+    // Nothing to share out; skip the hand-off to the workers.
+    if (m_workers.empty() || count == 1) {
+        for (int i = 0; i < count; i++)
+            body(i);
+        return;
+    }
+
+    std::lock_guard<std::mutex> dispatch(m_dispatch);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_body = &body;
+        m_count = count;
+        m_next = 0;
+        m_busy = (int) m_workers.size();
+        ++m_generation;
+    }
+    m_wake.notify_all();
+
+    RunTasks();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_busy != 0)
+        m_done.wait(lock);
+    m_body = 0;
+}
+
+void ThreadPool::WorkerLoop()
+{
+    unsigned generation = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (!m_quit && m_generation == generation)
+                m_wake.wait(lock);
+            if (m_quit)
+                return;
+            generation = m_generation;
+        }
+
+        RunTasks();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_busy == 0)
+            m_done.notify_one();
+    }
+}
+
+void ThreadPool::RunTasks()
+{
+    for (int i = m_next++; i < m_count; i = m_next++)
+        (*m_body)(i);
+}
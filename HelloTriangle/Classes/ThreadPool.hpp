@@ -0,0 +1,47 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+using std::vector;
+
+// A fixed set of worker threads that run index-parallel loops.
+// The calling thread takes part in every loop, so a pool created with
+// threadCount == 1 runs everything inline. ParallelFor must not be called
+// from inside a loop body, and loop bodies must not throw.
+class ThreadPool {
+public:
+    explicit ThreadPool(int threadCount);
+    ~ThreadPool();
+
+    int GetThreadCount() const { return (int) m_workers.size() + 1; }
+
+    // Calls body(i) for every i in [0, count) and returns when all are done.
+    void ParallelFor(int count, const std::function<void(int)>& body);
+
+    // Process-wide pool sized to the number of hardware threads. It lives
+    // until the process exits and is never destroyed.
+    static ThreadPool& Shared();
+
+private:
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    void WorkerLoop();
+    void RunTasks();
+
+    vector<std::thread> m_workers;
+    std::mutex m_dispatch;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    const std::function<void(int)>* m_body;
+    int m_count;
+    std::atomic<int> m_next;
+    int m_busy;
+    unsigned m_generation;
+    bool m_quit;
+};
@@ -62,7 +62,7 @@ struct Vector2 {
                        y * (1 - t) + v.y * t);
     }
     template <typename P>
-    P* Write(P* pData)
+    P* Write(P* pData) const
     {
         Vector2* pVector = (Vector2*) pData;
         *pVector++ = *this;
@@ -152,7 +152,7 @@ struct Vector3 {
         return &x;
     }
     template <typename P>
-    P* Write(P* pData)
+    P* Write(P* pData) const
     {
         Vector3<T>* pVector = (Vector3<T>*) pData;
         *pVector++ = *this;
@@ -15,6 +15,7 @@
 //    example is to demonstrate the basic concepts of 
 //    OpenGL ES 2.0 rendering.
 #include <stdlib.h>
+#include <string.h>
 #include "esUtil.h"
 #include "Classes/Vector.hpp"
 #include "Classes/Interfaces.hpp"
@@ -50,12 +51,19 @@ void touchesMoved(ESContext* esContext, int px, int py, int nx, int ny)
 int main ( int argc, char *argv[] )
 {
    ESContext esContext;
+   unsigned char renderingFlags = 0;
+   int i;
+
+   // -shader-surfaces evaluates the parametric surfaces in the vertex shader.
+   for ( i = 1; i < argc; i++ )
+      if ( strcmp ( argv[i], "-shader-surfaces" ) == 0 )
+         renderingFlags |= RenderingFlagsShaderSurfaces;
 
    esInitContext ( &esContext );
 
    esCreateWindow ( &esContext, TEXT("Hello Triangle"), 320, 480, ES_WINDOW_RGB | ES_WINDOW_DEPTH );
    
-   AppEngineInstance()->Initialize(esContext.width, esContext.height);
+   AppEngineInstance(renderingFlags)->Initialize(esContext.width, esContext.height);
 
    esRegisterDrawFunc ( &esContext, Draw );
    esRegisterUpdateFunc( &esContext, Update );
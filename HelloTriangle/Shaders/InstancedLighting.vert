@@ -0,0 +1,63 @@
+const char* InstancedLightingVertexShader = STRINGIFY(
+
+attribute vec4 Position;
+attribute vec3 Normal;
+attribute vec4 InstanceOrientation;
+attribute vec4 InstanceViewport;
+attribute vec3 DiffuseMaterial;
+
+uniform mat4 Projection;
+uniform vec3 Translation;
+
+varying vec3 EyespaceNormal;
+varying vec3 Diffuse;
+
+vec3 Rotate(vec4 q, vec3 v)
+{
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+void main()
+{
+    vec3 position = Rotate(InstanceOrientation, Position.xyz) + Translation;
+    EyespaceNormal = Rotate(InstanceOrientation, Normal);
+    Diffuse = DiffuseMaterial;
+    vec4 clip = Projection * vec4(position, 1);
+    gl_Position = vec4(clip.xy * InstanceViewport.xy +
+                       clip.w * InstanceViewport.zw, clip.zw);
+}
+
+);
+const char* BatchedLightingVertexShader = STRINGIFY(
+
+attribute vec4 Position;
+attribute vec3 Normal;
+attribute float InstanceIndex;
+
+uniform mat4 Projection;
+uniform vec3 Translation;
+uniform vec4 InstanceOrientations[32];
+uniform vec4 InstanceViewports[32];
+uniform vec3 InstanceColors[32];
+
+varying vec3 EyespaceNormal;
+varying vec3 Diffuse;
+
+vec3 Rotate(vec4 q, vec3 v)
+{
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+void main()
+{
+    int instance = int(InstanceIndex);
+    vec4 orientation = InstanceOrientations[instance];
+    vec4 viewport = InstanceViewports[instance];
+    vec3 position = Rotate(orientation, Position.xyz) + Translation;
+    EyespaceNormal = Rotate(orientation, Normal);
+    Diffuse = InstanceColors[instance];
+    vec4 clip = Projection * vec4(position, 1);
+    gl_Position = vec4(clip.xy * viewport.xy + clip.w * viewport.zw, clip.zw);
+}
+
+);
@@ -0,0 +1,125 @@
+const char TorusShaderEquation[] = STRINGIFY(
+
+void Evaluate(vec2 domain, out vec3 range, out vec3 dx, out vec3 dy)
+{
+    float major = Parameters.x;
+    float minor = Parameters.y;
+    float u = domain.x;
+    float v = domain.y;
+    float ring = major + minor * cos(v);
+    range = vec3(ring * cos(u), ring * sin(u), minor * sin(v));
+    dx = vec3(-ring * sin(u), ring * cos(u), 0);
+    dy = vec3(-minor * sin(v) * cos(u), -minor * sin(v) * sin(u),
+              minor * cos(v));
+}
+
+);
+const char TrefoilKnotShaderEquation[] = STRINGIFY(
+
+void Evaluate(vec2 domain, out vec3 range, out vec3 dx, out vec3 dy)
+{
+    const float a = 0.5;
+    const float b = 0.3;
+    const float c = 0.5;
+    const float d = 0.1;
+    float scale = Parameters.x;
+    float u = (TwoPi - domain.x) * 2.0;
+    float v = domain.y;
+
+    float r = a + b * cos(1.5 * u);
+    vec3 center = vec3(r * cos(u), r * sin(u), c * sin(1.5 * u));
+    vec3 du = vec3(-1.5 * b * sin(1.5 * u) * cos(u) - r * sin(u),
+                   -1.5 * b * sin(1.5 * u) * sin(u) + r * cos(u),
+                   1.5 * c * cos(1.5 * u));
+    vec3 ddu = vec3(-2.25 * b * cos(1.5 * u) * cos(u) +
+                    3.0 * b * sin(1.5 * u) * sin(u) - r * cos(u),
+                    -2.25 * b * cos(1.5 * u) * sin(u) -
+                    3.0 * b * sin(1.5 * u) * cos(u) - r * sin(u),
+                    -2.25 * c * sin(1.5 * u));
+
+    float duLength = length(du);
+    vec3 q = du / duLength;
+    vec3 dq = (ddu - q * dot(q, ddu)) / duLength;
+
+    vec3 side = vec3(du.y, -du.x, 0);
+    vec3 dside = vec3(ddu.y, -ddu.x, 0);
+    float sideLength = length(side);
+    vec3 qvn = side / sideLength;
+    vec3 dqvn = (dside - qvn * dot(qvn, dside)) / sideLength;
+
+    vec3 ww = cross(q, qvn);
+    vec3 dww = cross(dq, qvn) + cross(q, dqvn);
+
+    vec3 radial = qvn * cos(v) + ww * sin(v);
+    vec3 dradial = dqvn * cos(v) + dww * sin(v);
+    range = (center + radial * d) * scale;
+    dx = (du + dradial * d) * (-2.0 * scale);
+    dy = (qvn * -sin(v) + ww * cos(v)) * (d * scale);
+}
+
+);
+const char MobiusStripShaderEquation[] = STRINGIFY(
+
+void Evaluate(vec2 domain, out vec3 range, out vec3 dx, out vec3 dy)
+{
+    const float major = 1.25;
+    const float a = 0.125;
+    const float b = 0.5;
+    float scale = Parameters.x;
+    float u = domain.x;
+    float t = domain.y;
+    float phi = u / 2.0;
+
+    float x = a * cos(t) * cos(phi) - b * sin(t) * sin(phi);
+    float y = a * cos(t) * sin(phi) + b * sin(t) * cos(phi);
+    float xu = -y / 2.0;
+    float yu = x / 2.0;
+    float xt = -a * sin(t) * cos(phi) - b * cos(t) * sin(phi);
+    float yt = -a * sin(t) * sin(phi) + b * cos(t) * cos(phi);
+
+    range = vec3((major + x) * cos(u), (major + x) * sin(u), y) * scale;
+    dx = vec3(xu * cos(u) - (major + x) * sin(u),
+              xu * sin(u) + (major + x) * cos(u), yu) * scale;
+    dy = vec3(xt * cos(u), xt * sin(u), yt) * scale;
+}
+
+);
+const char KleinBottleShaderEquation[] = STRINGIFY(
+
+void Evaluate(vec2 domain, out vec3 range, out vec3 dx, out vec3 dy)
+{
+    float scale = Parameters.x;
+    float v = 1.0 - domain.x;
+    float u = domain.y;
+    float g = 2.0 * (1.0 - cos(u) / 2.0);
+    float bend = 3.0 * (cos(u) * cos(u) - sin(u) - sin(u) * sin(u));
+
+    vec3 p;
+    vec3 pu;
+    vec3 pv;
+    if (u < Pi) {
+        p.xy = vec2(3.0 * cos(u) * (1.0 + sin(u)) + g * cos(u) * cos(v),
+                    8.0 * sin(u) + g * sin(u) * cos(v));
+        pu.xy = vec2(bend + (sin(u) * cos(u) - g * sin(u)) * cos(v),
+                     8.0 * cos(u) + (sin(u) * sin(u) + g * cos(u)) * cos(v));
+        pv.xy = vec2(-g * cos(u) * sin(v), -g * sin(u) * sin(v));
+    } else {
+        p.xy = vec2(3.0 * cos(u) * (1.0 + sin(u)) + g * cos(v + Pi),
+                    8.0 * sin(u));
+        pu.xy = vec2(bend + sin(u) * cos(v + Pi), 8.0 * cos(u));
+        pv.xy = vec2(-g * sin(v + Pi), 0);
+    }
+    p.z = -g * sin(v);
+    pu.z = -sin(u) * sin(v);
+    pv.z = -g * cos(v);
+
+    range = vec3(p.x, -p.y, p.z) * scale;
+    dx = vec3(-pv.x, pv.y, -pv.z) * scale;
+    dy = vec3(pu.x, -pu.y, pu.z) * scale;
+
+    // InvertNormal; dx only goes into the normal.
+    if (u > 3.0 * Pi / 2.0)
+        dx = -dx;
+}
+
+);
@@ -0,0 +1,30 @@
+const char* ParametricSurfaceVertexShader = STRINGIFY(
+
+attribute vec2 Grid;
+attribute vec3 DiffuseMaterial;
+
+uniform mat4 ModelviewProjection;
+uniform mat3 NormalMatrix;
+uniform vec2 UpperBound;
+uniform vec4 Parameters;
+
+varying vec3 EyespaceNormal;
+varying vec3 Diffuse;
+
+const float Pi = 3.14159265;
+const float TwoPi = 6.28318531;
+
+void Evaluate(vec2 domain, out vec3 range, out vec3 dx, out vec3 dy);
+
+void main()
+{
+    vec3 range;
+    vec3 dx;
+    vec3 dy;
+    Evaluate(Grid * UpperBound, range, dx, dy);
+    EyespaceNormal = NormalMatrix * normalize(cross(dx, dy));
+    Diffuse = DiffuseMaterial;
+    gl_Position = ModelviewProjection * vec4(range, 1);
+}
+
+);
@@ -4,8 +4,7 @@ attribute vec4 Position;
 attribute vec3 Normal;
 attribute vec3 DiffuseMaterial;
 
-uniform mat4 Projection;
-uniform mat4 Modelview;
+uniform mat4 ModelviewProjection;
 uniform mat3 NormalMatrix;
 
 varying vec3 EyespaceNormal;
@@ -15,7 +14,7 @@ void main()
 {
     EyespaceNormal = NormalMatrix * Normal;
     Diffuse = DiffuseMaterial;
-   gl_Position = Projection * Modelview * Position;
+   gl_Position = ModelviewProjection * Position;
 }
 
 );
@@ -3,13 +3,12 @@ const char* SimpleVertexShader = STRINGIFY(
 attribute vec4 Position; 
 attribute vec4 SourceColor;
 varying vec4 DestinationColor;
-uniform mat4 Projection;
-uniform mat4 Modelview;
+uniform mat4 ModelviewProjection;
 
 void main()                
 {                          
     DestinationColor = SourceColor;
-    gl_Position = Projection * Modelview * Position; 
+    gl_Position = ModelviewProjection * Position; 
 }                            
 
 );
@@ -0,0 +1,12 @@
+const char* ThumbnailFragmentShader = STRINGIFY(
+
+uniform sampler2D Atlas;
+
+varying mediump vec2 TextureCoord;
+
+void main()
+{
+    gl_FragColor = texture2D(Atlas, TextureCoord);
+}
+
+);
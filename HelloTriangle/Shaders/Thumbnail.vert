@@ -0,0 +1,15 @@
+const char* ThumbnailVertexShader = STRINGIFY(
+
+attribute vec2 Corner;
+
+uniform vec4 TextureRect;
+
+varying vec2 TextureCoord;
+
+void main()
+{
+    TextureCoord = TextureRect.xy + Corner * TextureRect.zw;
+    gl_Position = vec4(Corner * 2.0 - 1.0, 0, 1);
+}
+
+);
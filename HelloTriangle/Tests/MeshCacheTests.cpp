@@ -0,0 +1,192 @@
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include "Test.hpp"
+#include "../Classes/ObjectSurface.h"
+#include "../Classes/MeshCache.hpp"
+#include "../Classes/MappedFile.hpp"
+
+// A bumpy grid of size x size vertices.
+static void WriteModel(const string& path, int size)
+{
+    FILE* file = fopen(path.c_str(), "wb");
+    for (int y = 0; y < size; y++)
+        for (int x = 0; x < size; x++)
+            fprintf(file, "v %d %d %.3f\n", x, y, (x * y % 5) * 0.25f);
+    for (int y = 0; y < size - 1; y++)
+        for (int x = 0; x < size - 1; x++)
+            fprintf(file, "f %d %d %d %d\n", y * size + x + 1,
+                    y * size + x + 2, (y + 1) * size + x + 2,
+                    (y + 1) * size + x + 1);
+    fclose(file);
+}
+
+static string ReadFile(const string& path)
+{
+    std::ifstream file(path.c_str(), std::ios::binary);
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+static void WriteFile(const string& path, const string& contents)
+{
+    std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+    file.write(contents.data(), contents.size());
+}
+
+static bool SameMesh(const ISurface& a, const ISurface& b,
+                     const VertexFormat& format)
+{
+    vector<float> verticesA, verticesB;
+    vector<unsigned int> indicesA, indicesB;
+    a.GenerateVertices(verticesA, format);
+    b.GenerateVertices(verticesB, format);
+    a.GenerateTriangleIndices(indicesA);
+    b.GenerateTriangleIndices(indicesB);
+    return verticesA == verticesB && indicesA == indicesB;
+}
+
+TEST(MeshCacheServesTheParsedModel)
+{
+    string path = GetScratchPath("Cache.obj");
+    string cachePath = GetMeshCachePath(path);
+    WriteModel(path, 20);
+    remove(cachePath.c_str());
+    {
+        ObjSurface parsed(path);
+        ObjSurface cached(path);
+        MeshFileHeader header;
+        MappedFile* cacheFile = MapMeshCache(path, header);
+        CHECK(cacheFile != 0);
+        delete cacheFile;
+
+        CHECK(cached.GetVertexCount() == 400);
+        CHECK(cached.GetTriangleIndexCount() == 19 * 19 * 6);
+        CHECK(SameMesh(parsed, cached, VertexFlagsNormals));
+        CHECK(SameMesh(parsed, cached, VertexFormat()));
+        CHECK(SameMesh(parsed, cached,
+                       VertexFormat(VertexFlagsNormals | VertexFlagsTexCoords,
+                                    VertexLayoutPlanar)));
+
+        vec3 parsedMin, parsedMax, cachedMin, cachedMax;
+        parsed.GetBounds(parsedMin, parsedMax);
+        cached.GetBounds(cachedMin, cachedMax);
+        CHECK(parsedMin == vec3(0, 0, 0));
+        CHECK(parsedMax == vec3(19, 19, 1));
+        CHECK(cachedMin == parsedMin && cachedMax == parsedMax);
+    }
+    remove(cachePath.c_str());
+    remove(path.c_str());
+}
+
+TEST(MeshCacheRejectsDamagedIndices)
+{
+    string path = GetScratchPath("Cache.obj");
+    string cachePath = GetMeshCachePath(path);
+    WriteModel(path, 10);
+    remove(cachePath.c_str());
+    ObjSurface parsed(path);
+
+    string cache = ReadFile(cachePath);
+    MeshFileHeader header;
+    CHECK(cache.size() >= sizeof(header));
+    memcpy(&header, cache.data(), sizeof(header));
+
+    // An index one past the last vertex.
+    string damaged = cache;
+    memcpy(&damaged[header.IndexOffset + 4 * 4], &header.VertexCount, 4);
+    WriteFile(cachePath, damaged);
+    MappedFile* cacheFile = MapMeshCache(path, header);
+    CHECK(cacheFile == 0);
+    delete cacheFile;
+
+    // Half a triangle missing.
+    damaged = cache;
+    unsigned int indexCount = header.IndexCount - 1;
+    memcpy(&damaged[offsetof(MeshFileHeader, IndexCount)], &indexCount, 4);
+    WriteFile(cachePath, damaged);
+    cacheFile = MapMeshCache(path, header);
+    CHECK(cacheFile == 0);
+    delete cacheFile;
+
+    // The model is parsed again, and the cache written anew.
+    {
+        ObjSurface reparsed(path);
+        CHECK(SameMesh(parsed, reparsed, VertexFlagsNormals));
+    }
+    CHECK(ReadFile(cachePath) == cache);
+    remove(cachePath.c_str());
+    remove(path.c_str());
+}
+
+TEST(MeshCacheRewriteLeavesMappingsIntact)
+{
+    string path = GetScratchPath("Cache.obj");
+    string cachePath = GetMeshCachePath(path);
+    WriteModel(path, 10);
+    remove(cachePath.c_str());
+    { ObjSurface parsed(path); }
+
+    // The model changes while its old cache is mapped, as by a surface
+    // still drawing from it, and a new surface writes the cache again.
+    MeshFileHeader header;
+    MappedFile* cacheFile = MapMeshCache(path, header);
+    CHECK(cacheFile != 0);
+    if (cacheFile) {
+        string mapped(cacheFile->Data(), cacheFile->Size());
+        WriteModel(path, 12);
+        { ObjSurface reparsed(path); }
+        CHECK(string(cacheFile->Data(), cacheFile->Size()) == mapped);
+#ifndef _WIN32
+        // Windows keeps a mapped file where it is; the new cache is
+        // written by the next surface after the mapping goes.
+        CHECK(ReadFile(cachePath) != mapped);
+#endif
+        delete cacheFile;
+    }
+
+    { ObjSurface reparsed(path); }
+    cacheFile = MapMeshCache(path, header);
+    CHECK(cacheFile != 0 && header.VertexCount == 144);
+    delete cacheFile;
+    CHECK(!std::ifstream((cachePath + ".tmp").c_str()));
+    remove(cachePath.c_str());
+    remove(path.c_str());
+}
+
+// Loads the model without a cache, which writes one, then with it.
+static void BenchmarkLoad(const string& path)
+{
+    string cachePath = GetMeshCachePath(path);
+    remove(cachePath.c_str());
+
+    vector<float> vertices;
+    vector<unsigned int> indices;
+    double seconds[2];
+    for (int i = 0; i < 2; i++) {
+        double start = GetSeconds();
+        ObjSurface surface(path);
+        surface.GenerateVertices(vertices, VertexFlagsNormals);
+        surface.GenerateTriangleIndices(indices);
+        seconds[i] = GetSeconds() - start;
+    }
+
+    printf("  %-26s cold %7.2f ms, warm %6.2f ms\n", path.c_str(),
+           seconds[0] * 1000, seconds[1] * 1000);
+}
+
+BENCHMARK(MeshCacheColdAndWarmStart)
+{
+    BenchmarkLoad(GetModelPath("Ninja.obj"));
+    BenchmarkLoad(GetModelPath("micronapalmv2.obj"));
+
+    string path = GetScratchPath("Cache.obj");
+    WriteModel(path, 1000);
+    BenchmarkLoad(path);
+    remove(GetMeshCachePath(path).c_str());
+    remove(path.c_str());
+}
@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <cstdio>
+
+#include "Test.hpp"
+#include "TestSurfaces.hpp"
+#include "../Classes/MeshOptimizer.hpp"
+#include "../Classes/MappedFile.hpp"
+#include "../Classes/ObjParser.hpp"
+
+// The positions and triangles of a bundled model, without going through
+// ObjSurface and its cache.
+static void LoadModel(const string& name, vector<float>& vertices,
+                      vector<unsigned int>& indices)
+{
+    MappedFile file(GetModelPath(name));
+    vector<vec3> positions;
+    vector<ivec3> faces;
+    ParseObj(file.Data(), file.Data() + file.Size(), positions, faces);
+
+    vertices.resize(positions.size() * 3);
+    for (size_t i = 0; i < positions.size(); i++)
+        positions[i].Write(&vertices[i * 3]);
+    indices.resize(faces.size() * 3);
+    for (size_t i = 0; i < faces.size(); i++) {
+        indices[i * 3] = faces[i].x;
+        indices[i * 3 + 1] = faces[i].y;
+        indices[i * 3 + 2] = faces[i].z;
+    }
+}
+
+static bool IsBefore(const ivec3& a, const ivec3& b)
+{
+    if (a.x != b.x)
+        return a.x < b.x;
+    return a.y != b.y ? a.y < b.y : a.z < b.z;
+}
+
+// The positions and triangles of a parametric surface.
+static void LoadSurface(const ISurface& surface, vector<float>& vertices,
+                        vector<unsigned int>& indices)
+{
+    surface.GenerateVertices(vertices, VertexFormat());
+    surface.GenerateTriangleIndices(indices);
+}
+
+TEST(AnalyzeOverdrawCountsHiddenFragments)
+{
+    // Two squares, one behind the other along z, each two triangles.
+    float vertices[] = {
+        0, 0, 0,  1, 0, 0,  1, 1, 0,  0, 1, 0,
+        0, 0, 1,  1, 0, 1,  1, 1, 1,  0, 1, 1,
+    };
+    unsigned int back[] = { 0, 1, 2, 0, 2, 3 };
+    unsigned int both[] = { 0, 1, 2, 0, 2, 3, 4, 5, 6, 4, 6, 7 };
+    vector<float> square(vertices, vertices + 24);
+
+    OverdrawStatistics one = AnalyzeOverdraw(
+        vector<unsigned int>(back, back + 6), square, 3, 64);
+    CHECK(one.PixelsCovered > 0);
+    CHECK(one.Overdraw == 1);
+
+    // Seen from +z the far square is drawn first and then covered; seen
+    // from -z it is drawn first and hides the other.
+    OverdrawStatistics two = AnalyzeOverdraw(
+        vector<unsigned int>(both, both + 12), square, 3, 64);
+    CHECK(two.PixelsShaded > two.PixelsCovered);
+    CHECK(two.Overdraw > 1.4f && two.Overdraw < 1.6f);
+}
+
+// The triangles of a list with each one turned to start at its smallest
+// index, which keeps its winding, and sorted; two lists of the same
+// triangles in any order and rotation give the same result.
+static vector<ivec3> GetTriangleSet(const vector<unsigned int>& indices)
+{
+    vector<ivec3> triangles(indices.size() / 3);
+    for (size_t i = 0; i < triangles.size(); i++) {
+        const unsigned int* t = &indices[i * 3];
+        int first = t[0] < t[1] ? (t[0] < t[2] ? 0 : 2)
+                                : (t[1] < t[2] ? 1 : 2);
+        triangles[i] = ivec3(t[first], t[(first + 1) % 3],
+                             t[(first + 2) % 3]);
+    }
+    std::sort(triangles.begin(), triangles.end(), IsBefore);
+    return triangles;
+}
+
+// The cache simulations the benchmark below reports.
+static const int CacheSizes[2] = { 16, 32 };
+static const VertexCacheModel CacheModels[2] = {
+    VertexCacheFifo, VertexCacheLru
+};
+static const char* CacheModelNames[2] = { "FIFO", "LRU" };
+
+static void CheckVertexCache(const string& name, vector<float>& vertices,
+                             vector<unsigned int>& indices)
+{
+    int vertexCount = (int) vertices.size() / 3;
+    vector<unsigned int> optimized(indices);
+    VertexCacheStatistics statistics =
+        OptimizeVertexCache(optimized, vertexCount);
+    printf("  %-18s ACMR %.3f -> %.3f\n", name.c_str(),
+           statistics.AcmrBefore, statistics.AcmrAfter);
+    CHECK(statistics.AcmrBefore == ComputeAcmr(indices, vertexCount));
+    CHECK(statistics.AcmrAfter == ComputeAcmr(optimized, vertexCount));
+    CHECK(GetTriangleSet(optimized) == GetTriangleSet(indices));
+    for (int size = 0; size < 2; size++)
+        for (int model = 0; model < 2; model++)
+            CHECK(ComputeAcmr(optimized, vertexCount, CacheSizes[size],
+                              CacheModels[model]) <=
+                  ComputeAcmr(indices, vertexCount, CacheSizes[size],
+                              CacheModels[model]));
+}
+
+TEST(OptimizeVertexCacheKeepsTrianglesAndLowersAcmr)
+{
+    const char* models[2] = { "Ninja.obj", "micronapalmv2.obj" };
+    for (int i = 0; i < 2; i++) {
+        vector<float> vertices;
+        vector<unsigned int> indices;
+        LoadModel(models[i], vertices, indices);
+        CheckVertexCache(models[i], vertices, indices);
+    }
+    vector<float> vertices;
+    vector<unsigned int> indices;
+    LoadSurface(TrefoilKnot(1.8f), vertices, indices);
+    CheckVertexCache("TrefoilKnot", vertices, indices);
+}
+
+// A grid's strip, unpacked, holds the triangles of its list with the same
+// winding; they may start at another corner.
+static void CheckStrip(const char* name, const ISurface& surface)
+{
+    vector<unsigned int> strip, unpacked, triangles;
+    surface.GenerateTriangleStripIndices(strip);
+    surface.GenerateTriangleIndices(triangles);
+    UnpackTriangleStrip(strip, unpacked);
+    printf("  %-12s %6d strip indices for %6d list indices\n", name,
+           (int) strip.size(), (int) triangles.size());
+    CHECK((int) strip.size() == surface.GetTriangleStripIndexCount());
+    CHECK(unpacked.size() == triangles.size());
+    CHECK(GetTriangleSet(unpacked) == GetTriangleSet(triangles));
+}
+
+TEST(TriangleStripsUnpackToTheTriangleLists)
+{
+    CheckStrip("Cone", Cone(3, 1));
+    CheckStrip("Sphere", Sphere(1.4f));
+    CheckStrip("Torus", Torus(1.4f, 0.3f));
+    CheckStrip("TrefoilKnot", TrefoilKnot(1.8f));
+    CheckStrip("MobiusStrip", MobiusStrip(1));
+    CheckStrip("KleinBottle", KleinBottle(0.2f));
+    CheckStrip("Quad", Quad(2, 2));
+}
+
+// Overdraw limits for the bundled models, from 256x256 counts (2.41 and
+// 2.00 when they were set), with a little room for changes.
+static void CheckOverdraw(const string& name, float limit)
+{
+    vector<float> vertices;
+    vector<unsigned int> indices;
+    LoadModel(name, vertices, indices);
+    int vertexCount = (int) vertices.size() / 3;
+
+    OptimizeVertexCache(indices, vertexCount);
+    float acmr = ComputeAcmr(indices, vertexCount);
+    float before = AnalyzeOverdraw(indices, vertices, 3).Overdraw;
+    vector<unsigned int> sorted(indices);
+    OptimizeOverdraw(sorted, vertices, 3);
+    float after = AnalyzeOverdraw(sorted, vertices, 3).Overdraw;
+
+    printf("  %-18s overdraw %.3f -> %.3f, ACMR %.3f -> %.3f\n",
+           name.c_str(), before, after, acmr,
+           ComputeAcmr(sorted, vertexCount));
+    CHECK(after < before);
+    CHECK(after <= limit);
+    // The clusters give up some vertex cache locality: 0.04 to 0.05.
+    CHECK(ComputeAcmr(sorted, vertexCount) <= acmr + 0.06f);
+}
+
+TEST(OptimizeOverdrawOnBundledModels)
+{
+    CheckOverdraw("Ninja.obj", 2.45f);
+    CheckOverdraw("micronapalmv2.obj", 2.05f);
+}
+
+// ACMR before and after OptimizeVertexCache, and vertex fetch traffic
+// before and after OptimizeVertexFetch, which runs next as in the
+// renderer. Vertices count as a
+// position and a normal, the 24 bytes the renderer uploads for each.
+static void BenchmarkMesh(const string& name, vector<float>& vertices,
+                          vector<unsigned int>& indices)
+{
+    const int vertexSize = 6 * sizeof(float);
+    int vertexCount = (int) vertices.size() / 3;
+    vector<unsigned int> original(indices);
+    OptimizeVertexCache(indices, vertexCount);
+    printf("  %-18s ACMR", name.c_str());
+    for (int size = 0; size < 2; size++)
+        for (int model = 0; model < 2; model++)
+            printf("%s %s %d %.3f -> %.3f", size + model ? "," : "",
+                   CacheModelNames[model], CacheSizes[size],
+                   ComputeAcmr(original, vertexCount, CacheSizes[size],
+                               CacheModels[model]),
+                   ComputeAcmr(indices, vertexCount, CacheSizes[size],
+                               CacheModels[model]));
+    printf("\n");
+
+    VertexFetchStatistics before =
+        AnalyzeVertexFetch(indices, vertexCount, vertexSize);
+    vector<unsigned int> remap;
+    OptimizeVertexFetch(indices, vertices, 3, remap);
+    VertexFetchStatistics after =
+        AnalyzeVertexFetch(indices, vertexCount, vertexSize);
+    printf("  %-18s %6d triangles, %5.1f -> %5.1f bytes per triangle, "
+           "overfetch %.2f -> %.2f\n", "",
+           (int) indices.size() / 3, before.BytesPerTriangle,
+           after.BytesPerTriangle, before.Overfetch, after.Overfetch);
+}
+
+static void BenchmarkModel(const string& name)
+{
+    vector<float> vertices;
+    vector<unsigned int> indices;
+    LoadModel(name, vertices, indices);
+    BenchmarkMesh(name, vertices, indices);
+}
+
+static void BenchmarkSurface(const string& name, const ISurface& surface)
+{
+    vector<float> vertices;
+    vector<unsigned int> indices;
+    LoadSurface(surface, vertices, indices);
+    BenchmarkMesh(name, vertices, indices);
+}
+
+BENCHMARK(MeshOptimizerPasses)
+{
+    BenchmarkModel("Ninja.obj");
+    BenchmarkModel("micronapalmv2.obj");
+    BenchmarkSurface("Sphere", Sphere(1.4f));
+    BenchmarkSurface("Torus", Torus(1.4f, 0.3f));
+    BenchmarkSurface("TrefoilKnot", TrefoilKnot(1.8f));
+    BenchmarkSurface("MobiusStrip", MobiusStrip(1));
+    BenchmarkSurface("KleinBottle", KleinBottle(0.2f));
+    BenchmarkSurface("Torus 300x300",
+                     Resampled<Torus>(Torus(1.4f, 0.3f), 300));
+}
@@ -0,0 +1,69 @@
+#include <algorithm>
+
+#include "Test.hpp"
+#include "TestSurfaces.hpp"
+#include "../Classes/MeshSplitter.hpp"
+
+TEST(LargeMeshUsesWideIndices)
+{
+    // 90000 vertices, more than 16-bit indices can address.
+    Resampled<Torus> surface(Torus(1.4f, 0.3f), 300);
+    int vertexCount = surface.GetVertexCount();
+    CHECK(vertexCount == 90000);
+    CHECK(surface.GetIndexSize() == 4);
+
+    vector<unsigned int> indices;
+    surface.GenerateTriangleIndices(indices);
+    CHECK((int) indices.size() == surface.GetTriangleIndexCount());
+
+    // Every index is in range, and every vertex is drawn.
+    vector<bool> used(vertexCount, false);
+    bool inRange = true;
+    for (size_t i = 0; i < indices.size(); i++) {
+        inRange = inRange && indices[i] < (unsigned int) vertexCount;
+        if (inRange)
+            used[indices[i]] = true;
+    }
+    CHECK(inRange);
+    CHECK(std::find(used.begin(), used.end(), false) == used.end());
+}
+
+TEST(SplitMeshKeepsPartsAddressable)
+{
+    Resampled<Torus> surface(Torus(1.4f, 0.3f), 300);
+    int vertexCount = surface.GetVertexCount();
+    vector<float> vertices;
+    vector<unsigned int> indices;
+    surface.GenerateVertices(vertices, VertexFlagsNormals);
+    surface.GenerateTriangleIndices(indices);
+
+    vector<MeshPart> parts;
+    SplitMesh(indices, vertexCount, 65536, parts);
+    CHECK(parts.size() >= 2);
+
+    // Each part addresses only its own vertices, with 16-bit indices, and
+    // mapped back the parts give the triangles in their original order.
+    vector<unsigned int> rejoined;
+    bool addressable = true;
+    for (size_t i = 0; i < parts.size(); i++) {
+        const MeshPart& part = parts[i];
+        CHECK(part.VertexRemap.size() <= 65536);
+        CHECK(part.Indices.size() % 3 == 0);
+        for (size_t j = 0; j < part.Indices.size(); j++) {
+            unsigned short index = part.Indices[j];
+            addressable = addressable && index < part.VertexRemap.size() &&
+                          part.VertexRemap[index] < (unsigned int) vertexCount;
+            if (addressable)
+                rejoined.push_back(part.VertexRemap[index]);
+        }
+
+        vector<float> gathered;
+        GatherVertices(vertices, 6, part.VertexRemap, gathered);
+        CHECK(gathered.size() == part.VertexRemap.size() * 6);
+        unsigned int last = part.VertexRemap.back();
+        CHECK(std::equal(gathered.end() - 6, gathered.end(),
+                         vertices.begin() + last * 6));
+    }
+    CHECK(addressable);
+    CHECK(rejoined == indices);
+}
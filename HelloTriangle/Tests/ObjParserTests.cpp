@@ -0,0 +1,191 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "Test.hpp"
+#include "../Classes/ObjParser.hpp"
+#include "../Classes/MappedFile.hpp"
+#include "../Classes/ThreadPool.hpp"
+
+static void Parse(const string& image, vector<vec3>& vertices,
+                  vector<ivec3>& faces, int workerCount = 1)
+{
+    const char* begin = image.data();
+    ParseObj(begin, begin + image.size(), vertices, faces, workerCount);
+}
+
+TEST(ObjParserReadsVerticesAndFaces)
+{
+    string image =
+        "# comment\r\n"
+        "v 1 2 3\r\n"
+        "v -1.5 2.5e1 +0.25\r\n"
+        "vt 0.5 0.5\r\n"
+        "vn 0 0 1\r\n"
+        "  v 4 5 6\n"
+        "v 7 8 9\n"
+        "f 1/1/1 2/1/1 3/1/1 4//1\n"
+        "f -1 -2 -3\n";
+    vector<vec3> vertices;
+    vector<ivec3> faces;
+    Parse(image, vertices, faces);
+
+    CHECK(vertices.size() == 4);
+    CHECK(vertices[1] == vec3(-1.5f, 25, 0.25f));
+    CHECK(vertices[3] == vec3(7, 8, 9));
+    CHECK(faces.size() == 3);
+    CHECK(faces[0] == ivec3(0, 1, 2));
+    CHECK(faces[1] == ivec3(0, 2, 3));
+    CHECK(faces[2] == ivec3(3, 2, 1));
+}
+
+TEST(ObjParserDropsFacesWithMissingVertices)
+{
+    string image =
+        "v 0 0 0\n"
+        "v 1 0 0\n"
+        "v 0 1 0\n"
+        "f 0 1 2\n"
+        "f 1 2 4\n"
+        "f -4 1 2\n"
+        "f 1 2 3\n";
+    vector<vec3> vertices;
+    vector<ivec3> faces;
+    Parse(image, vertices, faces);
+
+    CHECK(faces.size() == 1);
+    CHECK(!faces.empty() && faces[0] == ivec3(0, 1, 2));
+}
+
+TEST(ObjParserMergesChunksInFileOrder)
+{
+    // Enough text for several chunks, with relative and absolute indices
+    // that reach into other chunks, and bad faces all over; the last line
+    // refers to a vertex past the end.
+    string image;
+    char line[96];
+    for (int i = 0; i < 100000; i++) {
+        sprintf(line, "v %d.5 %d.25 -%d\n", i, i % 7, i % 13);
+        image += line;
+        if (i >= 2) {
+            sprintf(line, "f %d -2 -1\nf %d %d %d\nf %d 0 %d\n",
+                    i / 2 + 1, i + 1, i, i + 2, i, i + 1);
+            image += line;
+        }
+    }
+
+    vector<vec3> serialVertices, parallelVertices;
+    vector<ivec3> serialFaces, parallelFaces;
+    Parse(image, serialVertices, serialFaces, 1);
+    Parse(image, parallelVertices, parallelFaces, 4);
+
+    CHECK(serialVertices.size() == 100000);
+    CHECK(serialFaces.size() == 99998 * 2 - 1);
+    CHECK(parallelVertices == serialVertices);
+    CHECK(parallelFaces == serialFaces);
+}
+
+TEST(ObjParserReadsFloatsLikeStrtod)
+{
+    const char* formats[] = { "%.6f", "%.9g", "%e" };
+    char text[64];
+    srand(1);
+    for (int i = 0; i < 30000; i++) {
+        double value = (rand() - RAND_MAX / 2) / (double) (rand() + 1);
+        if (i % 3 == 2)
+            value *= 1e-30;
+        sprintf(text, formats[i % 3], value);
+
+        float parsed;
+        const char* end = ParseFloat(text, text + strlen(text), parsed);
+        CHECK(end == text + strlen(text));
+        CHECK(parsed == (float) strtod(text, 0));
+    }
+}
+
+// A grid of columns x rows vertices, two triangles per cell.
+static void WriteGridObj(const string& path, int columns, int rows)
+{
+    FILE* file = fopen(path.c_str(), "wb");
+    for (int y = 0; y < rows; y++)
+        for (int x = 0; x < columns; x++)
+            fprintf(file, "v %.6f %.6f %.6f\n", x / (float) columns,
+                    y / (float) rows, (x * y % 97) / 97.0f);
+    for (int y = 0; y < rows - 1; y++) {
+        for (int x = 0; x < columns - 1; x++) {
+            int i = y * columns + x + 1;
+            fprintf(file, "f %d %d %d\nf %d %d %d\n", i, i + 1,
+                    i + columns, i + 1, i + columns + 1, i + columns);
+        }
+    }
+    fclose(file);
+}
+
+// Parses path repeats times on one thread and prints the best throughput.
+static void BenchmarkParse(const string& path, int repeats)
+{
+    MappedFile file(path);
+    double best = 0;
+    size_t vertexCount = 0, faceCount = 0;
+    for (int i = 0; i < repeats; i++) {
+        vector<vec3> vertices;
+        vector<ivec3> faces;
+        vertices.reserve(file.Size() / 64);
+        faces.reserve(file.Size() / 32);
+        double start = GetSeconds();
+        ParseObj(file.Data(), file.Data() + file.Size(), vertices, faces);
+        double seconds = GetSeconds() - start;
+        if (i == 0 || seconds < best)
+            best = seconds;
+        vertexCount = vertices.size();
+        faceCount = faces.size();
+    }
+
+    printf("  %-26s %6.1f MB %9u vertices %9u faces: %7.1f MB/s "
+           "%6.2f M vertices/s\n", path.c_str(), file.Size() / 1e6,
+           (unsigned) vertexCount, (unsigned) faceCount,
+           file.Size() / 1e6 / best, vertexCount / 1e6 / best);
+}
+
+BENCHMARK(ObjParserThroughput)
+{
+    BenchmarkParse(GetModelPath("Ninja.obj"), 10);
+    BenchmarkParse(GetModelPath("micronapalmv2.obj"), 10);
+
+    // About ten million faces.
+    string path = GetScratchPath("Grid.obj");
+    WriteGridObj(path, 2237, 2238);
+    BenchmarkParse(path, 3);
+    remove(path.c_str());
+}
+
+BENCHMARK(ObjParserScaling)
+{
+    // About two million faces, parsed in as many chunks as threads.
+    string path = GetScratchPath("Grid.obj");
+    WriteGridObj(path, 1001, 1001);
+    {
+        MappedFile file(path);
+        int threadCount = ThreadPool::Shared().GetThreadCount();
+        double serial = 0;
+        for (int workers = 1; workers <= threadCount; workers++) {
+            double best = 0;
+            for (int i = 0; i < 3; i++) {
+                vector<vec3> vertices;
+                vector<ivec3> faces;
+                double start = GetSeconds();
+                ParseObj(file.Data(), file.Data() + file.Size(),
+                         vertices, faces, workers);
+                double seconds = GetSeconds() - start;
+                if (i == 0 || seconds < best)
+                    best = seconds;
+            }
+            if (workers == 1)
+                serial = best;
+            printf("  threads %2d: %7.1f MB/s, %.2fx\n", workers,
+                   file.Size() / 1e6 / best, serial / best);
+        }
+    }
+    remove(path.c_str());
+}
@@ -0,0 +1,544 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "../Classes/ParametricMesher.hpp"
+#include "Test.hpp"
+#include "TestSurfaces.hpp"
+
+// Smallest dot product between the normals of the two vertex arrays, in
+// the interleaved position and normal format.
+static float CompareNormals(const vector<float>& a, const vector<float>& b)
+{
+    float smallest = 1;
+    for (size_t i = 3; i + 3 <= a.size() && i + 3 <= b.size(); i += 6) {
+        float dot = a[i] * b[i] + a[i + 1] * b[i + 1] + a[i + 2] * b[i + 2];
+        smallest = std::min(smallest, dot);
+    }
+    return a.size() == b.size() ? smallest : -1;
+}
+
+template <typename Surface>
+static void CheckDifferenceNormals(const char* name, const Surface& surface)
+{
+    Resampled<Surface> fine(surface, 200);
+    vector<float> analytic, differences;
+    ScalarSurface<Surface>(fine, true).GenerateVertices(analytic,
+                                                        VertexFlagsNormals);
+    ScalarSurface<Surface>(fine, false).GenerateVertices(differences,
+                                                         VertexFlagsNormals);
+
+    // The differences are one-sided along the edges of the domain, and
+    // the derivatives are exact at seams, so those differ the most.
+    float smallest = CompareNormals(analytic, differences);
+    printf("  %-12s smallest cosine %.4f\n", name, smallest);
+    CHECK(smallest > 0.99f);
+}
+
+TEST(ParametricNormalsFromDifferencesMatchDerivatives)
+{
+    CheckDifferenceNormals("Torus", Torus(1.4f, 0.3f));
+    CheckDifferenceNormals("TrefoilKnot", TrefoilKnot(1.8f));
+    CheckDifferenceNormals("MobiusStrip", MobiusStrip(1));
+    CheckDifferenceNormals("KleinBottle", KleinBottle(0.2f));
+}
+
+// Generates surface's vertices with normals and returns the best time of
+// a few runs in seconds.
+static double TimeGenerateVertices(const ISurface& surface)
+{
+    double best = 0;
+    vector<float> vertices;
+    for (int i = 0; i < 3; i++) {
+        double start = GetSeconds();
+        surface.GenerateVertices(vertices, VertexFlagsNormals);
+        double seconds = GetSeconds() - start;
+        if (i == 0 || seconds < best)
+            best = seconds;
+    }
+    return best;
+}
+
+template <typename Surface>
+static void BenchmarkNormals(const char* name, const Surface& surface)
+{
+    Resampled<Surface> fine(surface, 512);
+    double analytic = TimeGenerateVertices(ScalarSurface<Surface>(fine, true));
+    double differences =
+        TimeGenerateVertices(ScalarSurface<Surface>(fine, false));
+    double vertices = fine.GetVertexCount() / 1e6;
+    printf("  %-12s derivatives %6.1f ms (%5.2f M vertices/s), "
+           "differences %6.1f ms (%5.2f M vertices/s)\n", name,
+           analytic * 1000, vertices / analytic,
+           differences * 1000, vertices / differences);
+}
+
+BENCHMARK(ParametricNormalPaths)
+{
+    BenchmarkNormals("Torus", Torus(1.4f, 0.3f));
+    BenchmarkNormals("TrefoilKnot", TrefoilKnot(1.8f));
+    BenchmarkNormals("MobiusStrip", MobiusStrip(1));
+    BenchmarkNormals("KleinBottle", KleinBottle(0.2f));
+}
+
+TEST(SinCosMatchesScalarAtQuadrantEdges)
+{
+    // Multiples of Pi/4 are where the reduction switches quadrant and
+    // polynomial; check each side of them, and far out where the three
+    // part reduction has to hold its precision.
+    float largest = 0;
+    const float step = 0.78539816339744831f;
+    for (int k = -64; k <= 64; k++) {
+        for (int side = 0; side < 5; side++) {
+            const float offsets[5] = { -1e-4f, -1e-6f, 0, 1e-6f, 1e-4f };
+            float x = k * step + offsets[side];
+            Float4 s, c;
+            SinCos(Float4(x), s, c);
+            float lanes[2][4];
+            s.Store(lanes[0]);
+            c.Store(lanes[1]);
+            largest = std::max(largest,
+                               (float) std::fabs(lanes[0][0] - sin((double) x)));
+            largest = std::max(largest,
+                               (float) std::fabs(lanes[1][0] - cos((double) x)));
+        }
+    }
+    for (int i = 0; i < 1000; i++) {
+        float x = (i - 500) * 2.9f;
+        Float4 s, c;
+        SinCos(Float4(x), s, c);
+        float lanes[2][4];
+        s.Store(lanes[0]);
+        c.Store(lanes[1]);
+        largest = std::max(largest,
+                           (float) std::fabs(lanes[0][0] - sin((double) x)));
+        largest = std::max(largest,
+                           (float) std::fabs(lanes[1][0] - cos((double) x)));
+    }
+    printf("  largest error %.2g\n", largest);
+    CHECK(largest < 1e-6f);
+}
+
+// Points spread evenly but irregularly over surface's domain; an odd
+// count, so the batch functions pad their last group.
+template <typename Surface>
+static void MakeSamples(const Surface& surface, int count,
+                        vector<float>& u, vector<float>& v)
+{
+    vec2 upper = Resampled<Surface>(surface, 1).GetInterval().UpperBound;
+    u.resize(count);
+    v.resize(count);
+    for (int i = 0; i < count; i++) {
+        double x = i * 0.6180339887498949, y = i * 0.7548776662466927;
+        u[i] = (float) (upper.x * (x - floor(x)));
+        v[i] = (float) (upper.y * (y - floor(y)));
+    }
+}
+
+static float Difference(const float* soa, int count, int i, const vec3& p)
+{
+    float error = std::fabs(soa[i] - p.x);
+    error = std::max(error, std::fabs(soa[count + i] - p.y));
+    error = std::max(error, std::fabs(soa[2 * count + i] - p.z));
+    return error / (1 + sqrt(p.Dot(p)));
+}
+
+template <typename Surface>
+static void CheckBatch(const char* name, const Surface& surface)
+{
+    const int count = 4003;
+    vector<float> u, v;
+    MakeSamples(surface, count, u, v);
+    vector<float> range(count * 3), dx(count * 3), dy(count * 3);
+    vector<float> rangeOnly(count * 3);
+    surface.EvaluateBatch(&u[0], &v[0], count, &rangeOnly[0]);
+    CHECK(surface.EvaluateBatchWithDerivatives(&u[0], &v[0], count,
+                                               &range[0], &dx[0], &dy[0]));
+
+    float largest = 0;
+    for (int i = 0; i < count; i++) {
+        vec2 domain(u[i], v[i]);
+        vec3 p, pdx, pdy;
+        CHECK(surface.EvaluateWithDerivatives(domain, p, pdx, pdy));
+        largest = std::max(largest, Difference(&rangeOnly[0], count, i,
+                                               surface.Evaluate(domain)));
+        largest = std::max(largest, Difference(&range[0], count, i, p));
+        largest = std::max(largest, Difference(&dx[0], count, i, pdx));
+        largest = std::max(largest, Difference(&dy[0], count, i, pdy));
+    }
+    printf("  %-12s largest relative error %.2g\n", name, largest);
+    CHECK(largest < 1e-5f);
+}
+
+TEST(SimdBatchMatchesScalarEvaluate)
+{
+    CheckBatch("Torus", Torus(1.4f, 0.3f));
+    CheckBatch("TrefoilKnot", TrefoilKnot(1.8f));
+    CheckBatch("MobiusStrip", MobiusStrip(1));
+    CheckBatch("KleinBottle", KleinBottle(0.2f));
+}
+
+template <typename Surface>
+static void BenchmarkBatch(const char* name, const Surface& surface)
+{
+    const int count = 1 << 18;
+    vector<float> u, v;
+    MakeSamples(surface, count, u, v);
+    vector<float> range(count * 3), dx(count * 3), dy(count * 3);
+
+    double scalar = 0, simd = 0;
+    for (int run = 0; run < 3; run++) {
+        double start = GetSeconds();
+        for (int i = 0; i < count; i++) {
+            vec3 p, pdx, pdy;
+            surface.EvaluateWithDerivatives(vec2(u[i], v[i]), p, pdx, pdy);
+            range[i] = p.x;
+            range[count + i] = p.y;
+            range[2 * count + i] = p.z;
+            dx[i] = pdx.x;
+            dx[count + i] = pdx.y;
+            dx[2 * count + i] = pdx.z;
+            dy[i] = pdy.x;
+            dy[count + i] = pdy.y;
+            dy[2 * count + i] = pdy.z;
+        }
+        double middle = GetSeconds();
+        surface.EvaluateBatchWithDerivatives(&u[0], &v[0], count,
+                                             &range[0], &dx[0], &dy[0]);
+        double end = GetSeconds();
+        if (run == 0 || middle - start < scalar)
+            scalar = middle - start;
+        if (run == 0 || end - middle < simd)
+            simd = end - middle;
+    }
+    printf("  %-12s scalar %6.1f M samples/s, SIMD %6.1f M samples/s "
+           "(%.1fx)\n", name, count / scalar / 1e6, count / simd / 1e6,
+           scalar / simd);
+}
+
+BENCHMARK(SimdBatchSamplesPerSecond)
+{
+    BenchmarkBatch("Torus", Torus(1.4f, 0.3f));
+    BenchmarkBatch("TrefoilKnot", TrefoilKnot(1.8f));
+    BenchmarkBatch("MobiusStrip", MobiusStrip(1));
+    BenchmarkBatch("KleinBottle", KleinBottle(0.2f));
+}
+
+// Generates equation's vertices with normals and texture coordinates on
+// workerCount bands, the way GenerateVertices does on all of them.
+template <typename Equation>
+static void GenerateOnBands(const Equation& equation,
+                            const ParametricInterval& interval,
+                            vector<float>& vertices, int workerCount)
+{
+    const unsigned char flags = VertexFlagsNormals | VertexFlagsTexCoords;
+    ParametricMesher<Equation, flags>::Generate(equation, interval, flags,
+                                                vertices, workerCount);
+}
+
+template <typename Surface>
+static void CheckBands(const char* name, const Surface& surface)
+{
+    // Differences reach into the neighbouring rows, across the bands.
+    Resampled<Surface> fine(surface, 300);
+    ScalarSurface<Surface> differences(fine, false);
+    ParametricInterval interval = fine.GetInterval();
+    for (int path = 0; path < 2; path++) {
+        vector<float> serial;
+        if (path == 0)
+            GenerateOnBands<Surface>(fine, interval, serial, 1);
+        else
+            GenerateOnBands<ParametricSurface>(differences, interval,
+                                               serial, 1);
+        for (int workers = 2; workers <= 8; workers *= 2) {
+            vector<float> banded;
+            if (path == 0)
+                GenerateOnBands<Surface>(fine, interval, banded, workers);
+            else
+                GenerateOnBands<ParametricSurface>(differences, interval,
+                                                   banded, workers);
+            CHECK(banded.size() == serial.size());
+            CHECK(banded == serial);
+        }
+    }
+    printf("  %-12s identical on 2, 4 and 8 bands\n", name);
+}
+
+TEST(RowBandsMatchSerialPass)
+{
+    CheckBands("Torus", Torus(1.4f, 0.3f));
+    CheckBands("TrefoilKnot", TrefoilKnot(1.8f));
+    CheckBands("MobiusStrip", MobiusStrip(1));
+    CheckBands("KleinBottle", KleinBottle(0.2f));
+}
+
+BENCHMARK(RowBandScaling)
+{
+    Resampled<KleinBottle> fine(KleinBottle(0.2f), 1024);
+    ParametricInterval interval = fine.GetInterval();
+    int threadCount = ThreadPool::Shared().GetThreadCount();
+    double serial = 0;
+    for (int workers = 1; workers <= threadCount; workers++) {
+        double best = 0;
+        vector<float> vertices;
+        for (int i = 0; i < 3; i++) {
+            double start = GetSeconds();
+            GenerateOnBands<KleinBottle>(fine, interval, vertices, workers);
+            double seconds = GetSeconds() - start;
+            if (i == 0 || seconds < best)
+                best = seconds;
+        }
+        if (workers == 1)
+            serial = best;
+        printf("  threads %2d: %6.1f ms, %5.1f M vertices/s, %.2fx\n",
+               workers, best * 1000, fine.GetVertexCount() / best / 1e6,
+               serial / best);
+    }
+}
+
+// Compares the lattice path of surface's mesher with the scalar Evaluate
+// and EvaluateWithDerivatives, vertex by vertex.
+template <typename Surface>
+static void CheckLattice(const char* name, const Surface& surface)
+{
+    Resampled<Surface> fine(surface, 257);
+    LatticeAngles angles;
+    CHECK(fine.GetLatticeAngles(angles));
+
+    vector<float> lattice, scalar;
+    fine.GenerateVertices(lattice, VertexFlagsNormals);
+    ScalarSurface<Surface>(fine, true).GenerateVertices(scalar,
+                                                        VertexFlagsNormals);
+    CHECK(lattice.size() == scalar.size());
+
+    float position = 0, normal = 0;
+    for (size_t i = 0; i + 6 <= lattice.size() && i + 6 <= scalar.size();
+         i += 6) {
+        for (int k = 0; k < 3; k++) {
+            position = std::max(position,
+                                std::fabs(lattice[i + k] - scalar[i + k]));
+            normal = std::max(normal, std::fabs(lattice[i + 3 + k] -
+                                                scalar[i + 3 + k]));
+        }
+    }
+    printf("  %-12s largest position error %.2g, normal error %.2g\n",
+           name, position, normal);
+    CHECK(position < 1e-5f);
+    CHECK(normal < 2e-5f);
+}
+
+TEST(LatticeMatchesScalarEvaluate)
+{
+    CheckLattice("Torus", Torus(1.4f, 0.3f));
+    CheckLattice("TrefoilKnot", TrefoilKnot(1.8f));
+    CheckLattice("MobiusStrip", MobiusStrip(1));
+    CheckLattice("KleinBottle", KleinBottle(0.2f));
+}
+
+template <typename Surface>
+static void BenchmarkGrid(const char* name, const Surface& surface,
+                          bool latticed)
+{
+    Resampled<Surface> fine(surface, 512);
+    double seconds = TimeGenerateVertices(fine);
+    printf("  %-12s %6.1f ms, %5.1f M vertices/s", name, seconds * 1000,
+           fine.GetVertexCount() / seconds / 1e6);
+
+    if (latticed) {
+        // The same through the batch functions, with SinCos at each point.
+        Unlatticed<Surface> batch(fine);
+        ParametricInterval interval = fine.GetInterval();
+        double best = 0;
+        vector<float> vertices;
+        for (int i = 0; i < 3; i++) {
+            double start = GetSeconds();
+            ParametricMesher<Unlatticed<Surface>, VertexFlagsNormals>::
+                Generate(batch, interval, VertexFlagsNormals, vertices);
+            double elapsed = GetSeconds() - start;
+            if (i == 0 || elapsed < best)
+                best = elapsed;
+        }
+        printf(", without the lattice %6.1f ms", best * 1000);
+    }
+    printf("\n");
+}
+
+BENCHMARK(ParametricGrid512)
+{
+    BenchmarkGrid("Cone", Cone(3, 1), false);
+    BenchmarkGrid("Sphere", Sphere(1.4f), false);
+    BenchmarkGrid("Torus", Torus(1.4f, 0.3f), true);
+    BenchmarkGrid("TrefoilKnot", TrefoilKnot(1.8f), true);
+    BenchmarkGrid("MobiusStrip", MobiusStrip(1), true);
+    BenchmarkGrid("KleinBottle", KleinBottle(0.2f), true);
+    BenchmarkGrid("Quad", Quad(2, 2), false);
+}
+
+// Distance from p to the nearest point of the triangle abc.
+static float DistanceToTriangle(const vec3& p, const vec3& a, const vec3& b,
+                                const vec3& c)
+{
+    vec3 ab = b - a, ac = c - a, ap = p - a;
+    float d1 = ab.Dot(ap), d2 = ac.Dot(ap);
+    vec3 nearest;
+    if (d1 <= 0 && d2 <= 0) {
+        nearest = a;
+    } else {
+        vec3 bp = p - b, cp = p - c;
+        float d3 = ab.Dot(bp), d4 = ac.Dot(bp);
+        float d5 = ab.Dot(cp), d6 = ac.Dot(cp);
+        float vc = d1 * d4 - d3 * d2;
+        float vb = d5 * d2 - d1 * d6;
+        float va = d3 * d6 - d5 * d4;
+        if (d3 >= 0 && d4 <= d3)
+            nearest = b;
+        else if (d6 >= 0 && d5 <= d6)
+            nearest = c;
+        else if (vc <= 0 && d1 >= 0 && d3 <= 0)
+            nearest = a + ab * (d1 / (d1 - d3));
+        else if (vb <= 0 && d2 >= 0 && d6 <= 0)
+            nearest = a + ac * (d2 / (d2 - d6));
+        else if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0)
+            nearest = b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+        else if (va + vb + vc > 0)
+            nearest = a + ab * (vb / (va + vb + vc)) +
+                      ac * (vc / (va + vb + vc));
+        else
+            nearest = a;
+    }
+    vec3 d = p - nearest;
+    return sqrt(d.Dot(d));
+}
+
+// The domain coordinates of a grid's lines along one axis, evenly spaced
+// unless the interval places them.
+static vector<float> GetGridLines(const vector<float>& placed, int divisions,
+                                  float upperBound)
+{
+    if (!placed.empty())
+        return placed;
+    vector<float> lines(divisions);
+    for (int i = 0; i < divisions; i++)
+        lines[i] = upperBound * i / (divisions - 1);
+    return lines;
+}
+
+// Largest distance from a dense sample of the surface to its mesh, taken
+// from each sample to the two triangles of the grid cell it falls in.
+template <typename Surface>
+static float MeasureDeviation(const Adaptive<Surface>& surface)
+{
+    ParametricInterval interval = surface.GetInterval();
+    vector<float> columns = GetGridLines(interval.Columns,
+                                         interval.Divisions.x,
+                                         interval.UpperBound.x);
+    vector<float> rows = GetGridLines(interval.Rows, interval.Divisions.y,
+                                      interval.UpperBound.y);
+    vector<float> vertices;
+    surface.GenerateVertices(vertices, VertexFormat());
+    int width = (int) columns.size();
+
+    const int samples = 601;
+    float deviation = 0;
+    for (int j = 0; j < samples; j++) {
+        float v = interval.UpperBound.y * j / (samples - 1);
+        int row = (int) (std::upper_bound(rows.begin(), rows.end(), v) -
+                         rows.begin()) - 1;
+        row = std::max(0, std::min(row, (int) rows.size() - 2));
+        for (int i = 0; i < samples; i++) {
+            float u = interval.UpperBound.x * i / (samples - 1);
+            int column = (int) (std::upper_bound(columns.begin(),
+                                                 columns.end(), u) -
+                                columns.begin()) - 1;
+            column = std::max(0, std::min(column, width - 2));
+
+            const float* p = &vertices[3 * (row * width + column)];
+            vec3 p00(p[0], p[1], p[2]), p10(p[3], p[4], p[5]);
+            p += 3 * width;
+            vec3 p01(p[0], p[1], p[2]), p11(p[3], p[4], p[5]);
+            vec3 point = surface.Evaluate(vec2(u, v));
+            float distance = std::min(
+                DistanceToTriangle(point, p00, p10, p01),
+                DistanceToTriangle(point, p10, p11, p01));
+            deviation = std::max(deviation, distance);
+        }
+    }
+    return deviation;
+}
+
+// Whether lines run from 0 to upperBound and increase strictly.
+static bool CheckGridLines(const vector<float>& lines, float upperBound)
+{
+    bool increasing = lines.size() >= 2 && lines.front() == 0 &&
+                      lines.back() == upperBound;
+    for (size_t i = 1; i < lines.size(); i++)
+        increasing = increasing && lines[i - 1] < lines[i];
+    return increasing;
+}
+
+template <typename Surface>
+static void CheckChordalTolerance(const char* name, const Surface& surface)
+{
+    const float tolerances[] = { 0.03f, 0.01f, 0.003f };
+    for (int t = 0; t < 3; t++) {
+        Adaptive<Surface> adaptive(surface, tolerances[t]);
+        ParametricInterval interval = adaptive.GetInterval();
+        CHECK(CheckGridLines(interval.Columns, interval.UpperBound.x));
+        CHECK(CheckGridLines(interval.Rows, interval.UpperBound.y));
+        CHECK(interval.Divisions == ivec2((int) interval.Columns.size(),
+                                          (int) interval.Rows.size()));
+
+        float deviation = MeasureDeviation(adaptive);
+        printf("  %-12s %4dx%-4d deviation %.4f of %.4f\n", name,
+               interval.Divisions.x, interval.Divisions.y, deviation,
+               tolerances[t]);
+        CHECK(deviation <= tolerances[t]);
+    }
+
+    // No grid meets a tolerance of 0 or less; the grid stays as it was.
+    ParametricInterval even = Adaptive<Surface>(surface, 0).GetInterval();
+    ParametricInterval negative =
+        Adaptive<Surface>(surface, -1).GetInterval();
+    CHECK(even.Columns.empty() && even.Rows.empty());
+    CHECK(negative.Columns.empty() && negative.Rows.empty());
+    CHECK(even.Divisions == negative.Divisions);
+}
+
+TEST(ChordalToleranceBoundsMeshDeviation)
+{
+    CheckChordalTolerance("Cone", Cone(3, 1));
+    CheckChordalTolerance("Sphere", Sphere(1.4f));
+    CheckChordalTolerance("Torus", Torus(1.4f, 0.3f));
+    CheckChordalTolerance("TrefoilKnot", TrefoilKnot(1.8f));
+    CheckChordalTolerance("MobiusStrip", MobiusStrip(1));
+    CheckChordalTolerance("KleinBottle", KleinBottle(0.2f));
+    CheckChordalTolerance("Quad", Quad(2, 2));
+}
+
+// The fixed grid against one placed to the fixed grid's own deviation.
+template <typename Surface>
+static void BenchmarkChordalTolerance(const char* name,
+                                      const Surface& surface)
+{
+    Adaptive<Surface> fixed(surface, 0);
+    float fixedDeviation = MeasureDeviation(fixed);
+    double start = GetSeconds();
+    Adaptive<Surface> adaptive(surface, std::max(fixedDeviation, 1e-4f));
+    double seconds = GetSeconds() - start;
+    printf("  %-12s fixed %5d vertices, deviation %.4f; "
+           "adaptive %5d vertices, deviation %.4f, placed in %.1f ms\n",
+           name, fixed.GetVertexCount(), fixedDeviation,
+           adaptive.GetVertexCount(), MeasureDeviation(adaptive),
+           seconds * 1000);
+}
+
+BENCHMARK(ChordalToleranceVertexCounts)
+{
+    BenchmarkChordalTolerance("Cone", Cone(3, 1));
+    BenchmarkChordalTolerance("Sphere", Sphere(1.4f));
+    BenchmarkChordalTolerance("Torus", Torus(1.4f, 0.3f));
+    BenchmarkChordalTolerance("TrefoilKnot", TrefoilKnot(1.8f));
+    BenchmarkChordalTolerance("MobiusStrip", MobiusStrip(1));
+    BenchmarkChordalTolerance("KleinBottle", KleinBottle(0.2f));
+    BenchmarkChordalTolerance("Quad", Quad(2, 2));
+}
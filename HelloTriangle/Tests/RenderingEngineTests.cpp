@@ -0,0 +1,726 @@
+#include <GLES2/gl2.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../Classes/Interfaces.hpp"
+#include "Test.hpp"
+#include "TestContext.hpp"
+#include "TestSurfaces.hpp"
+
+static const int SceneWidth = 320;
+static const int SceneHeight = 480;
+
+// Draws the first surface of engine, tilted so that its inside shows, and
+// reads the pixels back. The viewport is twice the scene, centered on
+// it, so that the CPU path picks its full level of detail, as the shader
+// path has.
+static void RenderFirstSurface(IRenderingEngine& engine,
+                               vector<unsigned char>& pixels)
+{
+    vector<Visual> visuals(1);
+    visuals[0].Color = vec3(0, 1, 1);
+    visuals[0].LowerLeft = ivec2(-SceneWidth / 2, -SceneHeight / 2);
+    visuals[0].ViewportSize = ivec2(SceneWidth * 2, SceneHeight * 2);
+    visuals[0].Orientation = Quaternion::CreateFromAxisAngle(
+        vec3(0.894427f, 0.447214f, 0), 0.7f);
+    visuals[0].Static = false;
+    engine.Render(visuals);
+    ReadTestPixels(SceneWidth, SceneHeight, pixels);
+}
+
+static void RenderSurface(const ISurface& surface, unsigned char flags,
+                          vector<unsigned char>& pixels)
+{
+    vector<ISurface*> surfaces(1, const_cast<ISurface*>(&surface));
+    IRenderingEngine* engine = ES2::CreateRenderingEngine(flags);
+    engine->Initialize(surfaces);
+    RenderFirstSurface(*engine, pixels);
+    delete engine;
+}
+
+// Renders surface on the CPU and in the vertex shader and compares the
+// two. The shader evaluates in single precision on the GPU, so a few
+// pixels along the silhouettes are allowed to move.
+static void CheckShaderSurface(const char* name, const ISurface& surface)
+{
+    vector<unsigned char> cpu, shader;
+    RenderSurface(surface, 0, cpu);
+    RenderSurface(surface, RenderingFlagsShaderSurfaces, shader);
+
+    // The background the engine clears to, and the surface over it.
+    const unsigned char background[3] = { 0, 32, 64 };
+    int cpuCovered = 0, shaderCovered = 0, differing = 0;
+    for (size_t i = 0; i < cpu.size(); i += 3) {
+        int largest = 0;
+        bool cpuBackground = true, shaderBackground = true;
+        for (int c = 0; c < 3; c++) {
+            largest = std::max(largest, abs(cpu[i + c] - shader[i + c]));
+            cpuBackground = cpuBackground && cpu[i + c] == background[c];
+            shaderBackground = shaderBackground &&
+                               shader[i + c] == background[c];
+        }
+        cpuCovered += !cpuBackground;
+        shaderCovered += !shaderBackground;
+        differing += largest > 24;
+    }
+    printf("  %-12s covered %6d and %6d pixels, %4d differ by more than 24\n",
+           name, cpuCovered, shaderCovered, differing);
+    CHECK(cpuCovered > SceneWidth * SceneHeight / 20);
+    CHECK(abs(cpuCovered - shaderCovered) < cpuCovered / 100);
+    CHECK(differing < cpuCovered / 100);
+}
+
+TEST(ShaderSurfacesMatchCpuSurfaces)
+{
+    if (!MakeTestContext(SceneWidth, SceneHeight)) {
+        printf("  no EGL display, skipped\n");
+        return;
+    }
+    CheckShaderSurface("Torus", Torus(1.4f, 0.3f));
+    CheckShaderSurface("TrefoilKnot", TrefoilKnot(1.8f));
+    CheckShaderSurface("KleinBottle", KleinBottle(0.2f));
+    CheckShaderSurface("MobiusStrip", MobiusStrip(1));
+}
+
+// Another surface with its vertices scattered, so that the engine lays
+// them out again in the order they are drawn, and followed by extra
+// copies of the last one that no line or triangle uses. Vertices are
+// interleaved, as the engine asks for them.
+class ScatteredSurface : public ISurface {
+public:
+    ScatteredSurface(const ISurface& surface, int padding) :
+        m_surface(surface), m_padding(padding)
+    {
+        int count = surface.GetVertexCount();
+        m_stride = 7919;
+        while (GreatestCommonDivisor(m_stride, count) != 1)
+            ++m_stride;
+    }
+    int GetVertexCount() const
+    {
+        return m_surface.GetVertexCount() + m_padding;
+    }
+    int GetLineIndexCount() const { return m_surface.GetLineIndexCount(); }
+    int GetTriangleIndexCount() const
+    {
+        return m_surface.GetTriangleIndexCount();
+    }
+    int GetIndexSize() const { return GetVertexCount() > 65536 ? 4 : 2; }
+    void GenerateVertices(vector<float>& vertices,
+                          const VertexFormat& format) const
+    {
+        vector<float> source;
+        m_surface.GenerateVertices(source, format);
+        int floatsPerVertex = format.GetFloatsPerVertex();
+        int count = m_surface.GetVertexCount();
+        vertices.resize((count + m_padding) * floatsPerVertex);
+        for (int i = 0; i < count; i++)
+            std::copy(&source[i * floatsPerVertex],
+                      &source[(i + 1) * floatsPerVertex],
+                      &vertices[Scatter(i) * floatsPerVertex]);
+        for (int i = count; i < count + m_padding; i++)
+            std::copy(&source[(count - 1) * floatsPerVertex],
+                      &source[count * floatsPerVertex],
+                      &vertices[i * floatsPerVertex]);
+    }
+    void GenerateLineIndices(vector<unsigned short>& indices) const
+    {
+        m_surface.GenerateLineIndices(indices);
+        ScatterIndices(indices);
+    }
+    void GenerateTriangleIndices(vector<unsigned short>& indices) const
+    {
+        m_surface.GenerateTriangleIndices(indices);
+        ScatterIndices(indices);
+    }
+    void GenerateTriangleIndices(vector<unsigned int>& indices) const
+    {
+        m_surface.GenerateTriangleIndices(indices);
+        ScatterIndices(indices);
+    }
+    int GetTriangleStripIndexCount() const
+    {
+        return m_surface.GetTriangleStripIndexCount();
+    }
+    void GenerateTriangleStripIndices(vector<unsigned int>& indices) const
+    {
+        m_surface.GenerateTriangleStripIndices(indices);
+        ScatterIndices(indices);
+    }
+    bool GetShaderEquation(ShaderEquation& equation) const { return false; }
+
+private:
+    static int GreatestCommonDivisor(int a, int b)
+    {
+        return b == 0 ? a : GreatestCommonDivisor(b, a % b);
+    }
+    int Scatter(int vertex) const
+    {
+        return (int) ((long long) vertex * m_stride %
+                      m_surface.GetVertexCount());
+    }
+    template <typename Index>
+    void ScatterIndices(vector<Index>& indices) const
+    {
+        for (size_t i = 0; i < indices.size(); i++)
+            indices[i] = (Index) Scatter(indices[i]);
+    }
+
+    const ISurface& m_surface;
+    int m_padding;
+    int m_stride;
+};
+
+TEST(UpdateSurfaceRebuildsForOtherVertexCounts)
+{
+    if (!MakeTestContext(SceneWidth, SceneHeight)) {
+        printf("  no EGL display, skipped\n");
+        return;
+    }
+
+    // The same triangles over fewer vertices than the drawable was made
+    // for, and over more, have to end up as a fresh drawable would.
+    Torus torus(1.4f, 0.3f);
+    ScatteredSurface scattered(torus, 0);
+    ScatteredSurface padded(torus, 64);
+    const ISurface* pairs[2][2] = {
+        { &padded, &scattered },
+        { &scattered, &padded },
+    };
+    for (int i = 0; i < 2; i++) {
+        vector<ISurface*> surfaces(1, const_cast<ISurface*>(pairs[i][0]));
+        IRenderingEngine* engine = ES2::CreateRenderingEngine();
+        engine->Initialize(surfaces);
+        engine->UpdateSurface(0, const_cast<ISurface*>(pairs[i][1]));
+        vector<unsigned char> updated, fresh;
+        RenderFirstSurface(*engine, updated);
+        delete engine;
+
+        RenderSurface(*pairs[i][1], 0, fresh);
+        CHECK(updated == fresh);
+    }
+}
+
+TEST(DrawablesWithoutLinesIssueOnlyTheirTriangles)
+{
+    if (!MakeTestContext(SceneWidth, SceneHeight)) {
+        printf("  no EGL display, skipped\n");
+        return;
+    }
+
+    // Past 65536 vertices a surface has no line indices, and with one
+    // visual each there is one draw call per surface.
+    Torus torus(1.4f, 0.3f);
+    Resampled<Torus> wideTorus(torus, 300);
+    vector<ISurface*> surfaces;
+    surfaces.push_back(&torus);
+    surfaces.push_back(&wideTorus);
+    IRenderingEngine* engine = ES2::CreateRenderingEngine();
+    engine->Initialize(surfaces);
+
+    vector<Visual> visuals(2);
+    for (int i = 0; i < 2; i++) {
+        visuals[i].Color = vec3(0, 1, 1);
+        visuals[i].LowerLeft = ivec2(0, i * SceneHeight / 2);
+        visuals[i].ViewportSize = ivec2(SceneWidth, SceneHeight / 2);
+        visuals[i].Static = false;
+    }
+    engine->Render(visuals);
+    CHECK(engine->GetStatistics().DrawCalls == 2);
+    delete engine;
+}
+
+TEST(VertexArraysRenderLikeTheFallback)
+{
+    if (!MakeTestContext(SceneWidth, SceneHeight)) {
+        printf("  no EGL display, skipped\n");
+        return;
+    }
+
+    Torus torus(1.4f, 0.3f);
+    TrefoilKnot trefoilKnot(1.8f);
+    KleinBottle kleinBottle(0.2f);
+    MobiusStrip mobiusStrip(1);
+    const ISurface* surfaces[4] = {
+        &torus, &trefoilKnot, &kleinBottle, &mobiusStrip
+    };
+    for (int i = 0; i < 4; i++) {
+        vector<unsigned char> recorded, fallback;
+        RenderSurface(*surfaces[i], 0, recorded);
+        RenderSurface(*surfaces[i], RenderingFlagsNoVertexArrays, fallback);
+        CHECK(recorded == fallback);
+    }
+}
+
+// Static visuals of 100x100 pixels side by side, more than the 512x512
+// atlas holds and most of them out of the scene; the first 25 fit.
+static vector<Visual> MakeStaticVisuals(int count, float angle)
+{
+    vector<Visual> visuals(count);
+    for (int i = 0; i < count; i++) {
+        visuals[i].Color = vec3(0, 1, 1);
+        visuals[i].LowerLeft = ivec2(i % 3 * 100, i / 3 * 100);
+        visuals[i].ViewportSize = ivec2(100, 100);
+        visuals[i].Orientation = Quaternion::CreateFromAxisAngle(
+            vec3(0.894427f, 0.447214f, 0), angle + 0.1f * i);
+        visuals[i].Static = true;
+    }
+    return visuals;
+}
+
+TEST(StaticVisualsOverflowingTheAtlasKeepTheirThumbnails)
+{
+    if (!MakeTestContext(SceneWidth, SceneHeight)) {
+        printf("  no EGL display, skipped\n");
+        return;
+    }
+
+    const int count = 40;
+    Torus torus(1.4f, 0.3f);
+    vector<ISurface*> surfaces(count, &torus);
+    IRenderingEngine* engine = ES2::CreateRenderingEngine();
+    engine->Initialize(surfaces);
+
+    // The thumbnails that fit are drawn once; the rest are drawn as
+    // visuals that are not static every frame. Copies save fragments from
+    // the frame after their thumbnails are drawn.
+    vector<Visual> visuals = MakeStaticVisuals(count, 0);
+    engine->Render(visuals);
+    RenderStatistics statistics = engine->GetStatistics();
+    CHECK(statistics.ThumbnailsRendered == 25);
+    CHECK(statistics.FragmentsSaved == 0);
+    int fragmentsSaved = 0;
+    for (int frame = 0; frame < 3; frame++) {
+        engine->Render(visuals);
+        statistics = engine->GetStatistics();
+        CHECK(statistics.ThumbnailsRendered == 0);
+        CHECK(statistics.ThumbnailsCopied == 25);
+        if (frame == 0)
+            fragmentsSaved = statistics.FragmentsSaved;
+        CHECK(statistics.FragmentsSaved == fragmentsSaved);
+    }
+    printf("  %d fragments saved per frame\n", fragmentsSaved);
+    CHECK(fragmentsSaved > 25 * 100 * 100 / 20);
+    CHECK(fragmentsSaved < 25 * 100 * 100);
+
+    // Once all of them turn, the old thumbnails are still in use for a
+    // frame; after that they give their places to the new ones.
+    visuals = MakeStaticVisuals(count, 1);
+    engine->Render(visuals);
+    statistics = engine->GetStatistics();
+    CHECK(statistics.ThumbnailsRendered == 0);
+    engine->Render(visuals);
+    statistics = engine->GetStatistics();
+    CHECK(statistics.ThumbnailsRendered == 25);
+    engine->Render(visuals);
+    statistics = engine->GetStatistics();
+    CHECK(statistics.ThumbnailsRendered == 0);
+    CHECK(statistics.ThumbnailsCopied == 25);
+
+    // The copies look like the visuals drawn directly. A thumbnail is
+    // drawn at its place in the atlas rather than in the scene, so the
+    // rasterizer may round its shading a step or two differently.
+    vector<unsigned char> copied, drawn;
+    ReadTestPixels(SceneWidth, SceneHeight, copied);
+    vector<Visual> moving(visuals);
+    for (size_t i = 0; i < moving.size(); i++)
+        moving[i].Static = false;
+    engine->Render(moving);
+    ReadTestPixels(SceneWidth, SceneHeight, drawn);
+    int largest = 0;
+    for (size_t i = 0; i < copied.size(); i++)
+        largest = std::max(largest, abs(copied[i] - drawn[i]));
+    CHECK(largest <= 2);
+
+    // A copy on its own saves the pixels it covers in the scene.
+    vector<Visual> first(visuals.begin(), visuals.begin() + 1);
+    engine->Render(first);
+    statistics = engine->GetStatistics();
+    CHECK(statistics.ThumbnailsCopied == 1);
+    ReadTestPixels(SceneWidth, SceneHeight, copied);
+    int covered = 0;
+    for (size_t i = 0; i < copied.size(); i += 3)
+        covered += copied[i] != 0 || copied[i + 1] != 32 ||
+                   copied[i + 2] != 64;
+    CHECK(covered > 0);
+    CHECK(statistics.FragmentsSaved == covered);
+    delete engine;
+}
+
+// Renders a scene of many small visuals with and without vertex array
+// objects and reports the time Render takes to issue a frame, which is
+// all CPU work; the GPU is waited for outside of it.
+static void BenchmarkManyVisuals(const char* name, const ISurface* kinds[4])
+{
+    const int size = 20;
+    const int columns = SceneWidth / size, rows = SceneHeight / size;
+    vector<ISurface*> surfaces;
+    vector<Visual> visuals;
+    for (int i = 0; i < columns * rows; i++) {
+        surfaces.push_back(const_cast<ISurface*>(kinds[i % 4]));
+        Visual visual;
+        visual.Color = vec3(0, 1, 1);
+        visual.LowerLeft = ivec2(i % columns * size, i / columns * size);
+        visual.ViewportSize = ivec2(size, size);
+        visual.Orientation = Quaternion::CreateFromAxisAngle(
+            vec3(0.894427f, 0.447214f, 0), 0.01f * i);
+        visual.Static = false;
+        visuals.push_back(visual);
+    }
+
+    // The two engines take turns, frame by frame, so that neither one is
+    // favoured by whatever else the machine is doing.
+    const unsigned char flags[2] = { 0, RenderingFlagsNoVertexArrays };
+    const char* labels[2] = { "with VAOs", "without" };
+    IRenderingEngine* engines[2];
+    double best[2];
+    for (int f = 0; f < 2; f++) {
+        engines[f] = ES2::CreateRenderingEngine(flags[f]);
+        engines[f]->Initialize(surfaces);
+        engines[f]->Render(visuals);
+        glFinish();
+    }
+    for (int frame = 0; frame < 100; frame++) {
+        for (int f = 0; f < 2; f++) {
+            double start = GetSeconds();
+            engines[f]->Render(visuals);
+            double seconds = GetSeconds() - start;
+            glFinish();
+            if (frame == 0 || seconds < best[f])
+                best[f] = seconds;
+        }
+    }
+
+    printf("  %s, %d visuals\n", name, (int) visuals.size());
+    for (int f = 0; f < 2; f++) {
+        RenderStatistics statistics = engines[f]->GetStatistics();
+        printf("    %-10s %6.2f ms per frame, %5d state calls, "
+               "%4d draw calls\n", labels[f], best[f] * 1000,
+               statistics.StateCallsIssued, statistics.DrawCalls);
+        delete engines[f];
+    }
+}
+
+BENCHMARK(ManyVisualsWithAndWithoutVertexArrays)
+{
+    if (!MakeTestContext(SceneWidth, SceneHeight)) {
+        printf("  no EGL display, skipped\n");
+        return;
+    }
+
+    Torus torus(1.4f, 0.3f);
+    TrefoilKnot trefoilKnot(1.8f);
+    KleinBottle kleinBottle(0.2f);
+    MobiusStrip mobiusStrip(1);
+    const ISurface* surfaces[4] = {
+        &torus, &trefoilKnot, &kleinBottle, &mobiusStrip
+    };
+    BenchmarkManyVisuals("default grids", surfaces);
+
+    // With tiny grids the draws cost next to nothing, and the setup
+    // around them is most of the frame.
+    Resampled<Torus> coarseTorus(torus, 4);
+    Resampled<TrefoilKnot> coarseTrefoilKnot(trefoilKnot, 4);
+    Resampled<KleinBottle> coarseKleinBottle(kleinBottle, 4);
+    Resampled<MobiusStrip> coarseMobiusStrip(mobiusStrip, 4);
+    const ISurface* coarse[4] = {
+        &coarseTorus, &coarseTrefoilKnot, &coarseKleinBottle,
+        &coarseMobiusStrip
+    };
+    BenchmarkManyVisuals("4x4 grids", coarse);
+}
+
+TEST(TriangleListsAndStripsRenderAlike)
+{
+    if (!MakeTestContext(SceneWidth, SceneHeight)) {
+        printf("  no EGL display, skipped\n");
+        return;
+    }
+
+    Torus torus(1.4f, 0.3f);
+    TrefoilKnot trefoilKnot(1.8f);
+    const ISurface* surfaces[2] = { &torus, &trefoilKnot };
+    for (int i = 0; i < 2; i++) {
+        vector<unsigned char> lists, strips;
+        RenderSurface(*surfaces[i], RenderingFlagsTriangleLists, lists);
+        RenderSurface(*surfaces[i], RenderingFlagsTriangleStrips, strips);
+
+        // The same triangles, but a strip starts some of them at another
+        // corner, which can round the shading of a pixel differently.
+        int largest = 0;
+        for (size_t p = 0; p < lists.size() && p < strips.size(); p++)
+            largest = std::max(largest, abs(lists[p] - strips[p]));
+        CHECK(lists.size() == strips.size());
+        CHECK(largest <= 1);
+    }
+}
+
+// Index memory and index bytes read per frame for a surface drawn as the
+// engine picks, as a list and as a strip.
+static void BenchmarkIndexModes(const char* name, const ISurface& surface)
+{
+    const unsigned char flags[3] = {
+        0, RenderingFlagsTriangleLists, RenderingFlagsTriangleStrips
+    };
+    printf("  %-14s", name);
+    for (int f = 0; f < 3; f++) {
+        vector<ISurface*> surfaces(1, const_cast<ISurface*>(&surface));
+        IRenderingEngine* engine = ES2::CreateRenderingEngine(flags[f]);
+        engine->Initialize(surfaces);
+        vector<unsigned char> pixels;
+        RenderFirstSurface(*engine, pixels);
+        RenderStatistics statistics = engine->GetStatistics();
+        printf("%s %7d / %7d", f ? "," : "", statistics.IndexBufferBytes,
+               statistics.IndexBytesDrawn);
+        delete engine;
+    }
+    printf("\n");
+}
+
+BENCHMARK(TriangleListAndStripIndexBytes)
+{
+    if (!MakeTestContext(SceneWidth, SceneHeight)) {
+        printf("  no EGL display, skipped\n");
+        return;
+    }
+
+    printf("  index buffer bytes / index bytes drawn: picked, lists, "
+           "strips\n");
+    BenchmarkIndexModes("Cone", Cone(3, 1));
+    BenchmarkIndexModes("Sphere", Sphere(1.4f));
+    BenchmarkIndexModes("Torus", Torus(1.4f, 0.3f));
+    BenchmarkIndexModes("TrefoilKnot", TrefoilKnot(1.8f));
+    BenchmarkIndexModes("MobiusStrip", MobiusStrip(1));
+    BenchmarkIndexModes("KleinBottle", KleinBottle(0.2f));
+    BenchmarkIndexModes("Quad", Quad(2, 2));
+    Torus torus(1.4f, 0.3f);
+    BenchmarkIndexModes("Torus 300x300", Resampled<Torus>(torus, 300));
+}
+
+// Index memory of an engine made afresh for surfaces.
+static RenderStatistics GetFreshStatistics(const vector<ISurface*>& surfaces)
+{
+    IRenderingEngine* engine = ES2::CreateRenderingEngine();
+    engine->Initialize(surfaces);
+    RenderStatistics statistics = engine->GetStatistics();
+    delete engine;
+    return statistics;
+}
+
+static bool SameIndexMemory(const RenderStatistics& a,
+                            const RenderStatistics& b)
+{
+    return a.IndexBufferBytes == b.IndexBufferBytes &&
+           a.IndexBytesShared == b.IndexBytesShared &&
+           a.VertexBufferBytes == b.VertexBufferBytes;
+}
+
+TEST(SharedIndexBuffersFollowUpdateSurface)
+{
+    if (!MakeTestContext(SceneWidth, SceneHeight)) {
+        printf("  no EGL display, skipped\n");
+        return;
+    }
+
+    // Each engine keeps its own record of the GL bindings, so the fresh
+    // engines to compare with are done with before the one updated.
+    Torus torus(1.4f, 0.3f);
+    TrefoilKnot trefoilKnot(1.8f);
+    vector<ISurface*> tori(3, &torus);
+    vector<ISurface*> mixed(tori);
+    mixed[1] = &trefoilKnot;
+    RenderStatistics freshTori = GetFreshStatistics(tori);
+    RenderStatistics freshMixed = GetFreshStatistics(mixed);
+
+    // Copies of the torus come out of the reordering passes alike and
+    // share their index buffers.
+    IRenderingEngine* engine = ES2::CreateRenderingEngine();
+    engine->Initialize(tori);
+    RenderStatistics initialized = engine->GetStatistics();
+    CHECK(initialized.IndexBytesShared > 0);
+    CHECK(SameIndexMemory(initialized, freshTori));
+
+    // A surface of another topology takes buffers of its own, and gives
+    // them back when the torus returns.
+    engine->UpdateSurface(1, &trefoilKnot);
+    RenderStatistics updated = engine->GetStatistics();
+    engine->UpdateSurface(1, &torus);
+    RenderStatistics restored = engine->GetStatistics();
+    printf("  index bytes / shared: tori %d / %d, with a trefoil knot "
+           "%d / %d, restored %d / %d\n", initialized.IndexBufferBytes,
+           initialized.IndexBytesShared, updated.IndexBufferBytes,
+           updated.IndexBytesShared, restored.IndexBufferBytes,
+           restored.IndexBytesShared);
+    CHECK(updated.IndexBytesShared < initialized.IndexBytesShared);
+    CHECK(SameIndexMemory(updated, freshMixed));
+    CHECK(SameIndexMemory(restored, freshTori));
+
+    // The engine still draws what a fresh one does.
+    vector<unsigned char> pixels, freshPixels;
+    RenderFirstSurface(*engine, pixels);
+    delete engine;
+    RenderSurface(torus, 0, freshPixels);
+    CHECK(pixels == freshPixels);
+}
+
+// Copies of one surface in cells of the given size across the scene, each
+// turned a little further than the last.
+static vector<Visual> MakeCopyVisuals(int width, int height)
+{
+    const int columns = SceneWidth / width, rows = SceneHeight / height;
+    vector<Visual> visuals(columns * rows);
+    for (int i = 0; i < columns * rows; i++) {
+        Visual& visual = visuals[i];
+        visual.Color = vec3(0, 1, 1);
+        visual.LowerLeft = ivec2(i % columns * width, i / columns * height);
+        visual.ViewportSize = ivec2(width, height);
+        visual.Orientation = Quaternion::CreateFromAxisAngle(
+            vec3(0.894427f, 0.447214f, 0), 0.1f * i);
+        visual.Static = false;
+    }
+    return visuals;
+}
+
+// Draws the copies as Render does, a visual and a drawable apiece, each
+// drawable replaced with the update when there is one.
+static void RenderCopiesOneByOne(const ISurface& surface, ISurface* update,
+                                 const vector<Visual>& visuals,
+                                 vector<unsigned char>& pixels)
+{
+    vector<ISurface*> surfaces(visuals.size(),
+                               const_cast<ISurface*>(&surface));
+    IRenderingEngine* engine = ES2::CreateRenderingEngine(0);
+    engine->Initialize(surfaces);
+    for (size_t i = 0; update && i < surfaces.size(); i++)
+        engine->UpdateSurface(i, update);
+    engine->Render(visuals);
+    ReadTestPixels(SceneWidth, SceneHeight, pixels);
+    delete engine;
+}
+
+// Draws the copies with RenderInstances over a cleared frame, after
+// replacing the surface with the update when there is one, and returns
+// the draw calls they took.
+static int RenderCopiesAtOnce(const ISurface& surface, ISurface* update,
+                              unsigned char flags,
+                              const vector<Visual>& visuals,
+                              vector<unsigned char>& pixels)
+{
+    vector<ISurface*> surfaces(1, const_cast<ISurface*>(&surface));
+    IRenderingEngine* engine = ES2::CreateRenderingEngine(flags);
+    engine->Initialize(surfaces);
+    if (update)
+        engine->UpdateSurface(0, update);
+    engine->Render(vector<Visual>());
+    int drawCalls = engine->GetStatistics().DrawCalls;
+    engine->RenderInstances(0, visuals);
+    drawCalls = engine->GetStatistics().DrawCalls - drawCalls;
+    ReadTestPixels(SceneWidth, SceneHeight, pixels);
+    delete engine;
+    return drawCalls;
+}
+
+// The copies are not cut off at the edges of their cells, and the
+// rasterizer sees one viewport rather than many, so a few edge pixels
+// round differently.
+static void CheckCopies(const char* name, const vector<unsigned char>& drawn,
+                        const vector<unsigned char>& copied)
+{
+    int covered = 0, differing = 0;
+    for (size_t i = 0; i < drawn.size(); i += 3) {
+        int largest = 0;
+        bool background = drawn[i] == 0 && drawn[i + 1] == 32 &&
+                          drawn[i + 2] == 64;
+        for (int c = 0; c < 3; c++)
+            largest = std::max(largest, abs(drawn[i + c] - copied[i + c]));
+        covered += !background;
+        differing += largest > 24;
+    }
+    printf("  %-18s covered %6d pixels, %4d differ by more than 24\n",
+           name, covered, differing);
+    CHECK(covered > SceneWidth * SceneHeight / 20);
+    CHECK(differing < covered / 100);
+}
+
+TEST(RenderInstancesMatchesRender)
+{
+    if (!MakeTestContext(SceneWidth, SceneHeight)) {
+        printf("  no EGL display, skipped\n");
+        return;
+    }
+
+    // Cells taller than wide, so that each copy's frustum is remapped
+    // from the shared square one; 80 copies take three batches.
+    vector<Visual> visuals = MakeCopyVisuals(40, 48);
+    Torus torus(1.4f, 0.3f), fatTorus(1.2f, 0.5f);
+    vector<unsigned char> drawn, instanced, batched;
+
+    RenderCopiesOneByOne(torus, 0, visuals, drawn);
+    int instancedDraws = RenderCopiesAtOnce(torus, 0, 0, visuals, instanced);
+    int batchedDraws = RenderCopiesAtOnce(torus, 0,
+                                          RenderingFlagsNoInstancedArrays,
+                                          visuals, batched);
+    CheckCopies("instanced", drawn, instanced);
+    CheckCopies("batched", drawn, batched);
+    CHECK(batchedDraws == 3);
+    if (instancedDraws == 1)
+        printf("  instanced in 1 draw call, batched in %d\n", batchedDraws);
+    else
+        printf("  no instanced arrays, batched in %d\n", instancedDraws);
+
+    // Replacing the surface with one of the same topology rewrites the
+    // vertices in place, and the batch buffers along with them. The
+    // levels of detail keep their triangles, so the copies are compared
+    // with visuals updated the same way rather than with a fresh torus.
+    RenderCopiesOneByOne(torus, &fatTorus, visuals, drawn);
+    RenderCopiesAtOnce(torus, &fatTorus, 0, visuals, instanced);
+    RenderCopiesAtOnce(torus, &fatTorus, RenderingFlagsNoInstancedArrays,
+                       visuals, batched);
+    CheckCopies("updated instanced", drawn, instanced);
+    CheckCopies("updated batched", drawn, batched);
+}
+
+// Draws 384 copies of a torus in 20 by 20 cells, with Render and with
+// RenderInstances both instanced and batched, and reports the time each
+// takes to issue a frame.
+BENCHMARK(RenderInstancesAgainstRender)
+{
+    if (!MakeTestContext(SceneWidth, SceneHeight)) {
+        printf("  no EGL display, skipped\n");
+        return;
+    }
+
+    Torus torus(1.4f, 0.3f);
+    vector<Visual> visuals = MakeCopyVisuals(20, 20);
+    const char* labels[3] = { "Render", "instanced", "batched" };
+    const unsigned char flags[3] = { 0, 0, RenderingFlagsNoInstancedArrays };
+    printf("  %d copies\n", (int) visuals.size());
+    for (int f = 0; f < 3; f++) {
+        vector<ISurface*> surfaces(f == 0 ? visuals.size() : 1, &torus);
+        IRenderingEngine* engine = ES2::CreateRenderingEngine(flags[f]);
+        engine->Initialize(surfaces);
+        vector<Visual> none;
+        double best = 0;
+        for (int frame = 0; frame < 100; frame++) {
+            double start = GetSeconds();
+            if (f == 0) {
+                engine->Render(visuals);
+            } else {
+                engine->Render(none);
+                engine->RenderInstances(0, visuals);
+            }
+            double seconds = GetSeconds() - start;
+            glFinish();
+            if (frame == 0 || seconds < best)
+                best = seconds;
+        }
+        RenderStatistics statistics = engine->GetStatistics();
+        printf("    %-10s %6.2f ms per frame, %4d draw calls, "
+               "%5d state calls, %6d uniform bytes\n", labels[f],
+               best * 1000, statistics.DrawCalls,
+               statistics.StateCallsIssued, statistics.UniformBytesUploaded);
+        delete engine;
+    }
+}
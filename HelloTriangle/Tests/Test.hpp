@@ -0,0 +1,45 @@
+#pragma once
+#include <string>
+
+using std::string;
+
+// A small runner for the engine code that does not need a window. Tests
+// check their results with CHECK and run by default; benchmarks print
+// their numbers and only run when asked for, since they take a while.
+//
+//     Tests [bench] [name]
+//
+// runs the tests, or with "bench" the benchmarks, whose names contain
+// name. The exit code is the number of failed tests.
+
+typedef void (*TestFunction)();
+
+// Adds a test to the list the runner goes through; the macros below call
+// it from static initializers.
+int RegisterTest(const char* name, TestFunction function, bool benchmark);
+
+// Records a failed CHECK; the test carries on, so one run shows them all.
+void ReportFailure(const char* file, int line, const char* expression);
+
+#define TEST(name) \
+    static void name(); \
+    static int name##Registration = RegisterTest(#name, name, false); \
+    static void name()
+
+#define BENCHMARK(name) \
+    static void name(); \
+    static int name##Registration = RegisterTest(#name, name, true); \
+    static void name()
+
+#define CHECK(expression) \
+    ((expression) ? (void) 0 : ReportFailure(__FILE__, __LINE__, #expression))
+
+// Wall-clock time in seconds from an arbitrary start.
+double GetSeconds();
+
+// Path of a scratch file of the given name, for tests that need one.
+string GetScratchPath(const string& name);
+
+// The bundled model of the given name, relative to the working directory
+// the makefile and the project run from.
+string GetModelPath(const string& name);
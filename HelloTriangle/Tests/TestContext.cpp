@@ -0,0 +1,75 @@
+#include <EGL/egl.h>
+#include <GLES2/gl2.h>
+
+#include "TestContext.hpp"
+
+bool MakeTestContext(int width, int height)
+{
+    static EGLDisplay display = EGL_NO_DISPLAY;
+    static EGLSurface surface = EGL_NO_SURFACE;
+    static EGLContext context = EGL_NO_CONTEXT;
+    static int surfaceWidth, surfaceHeight;
+
+    if (context == EGL_NO_CONTEXT) {
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, 0, 0))
+            return false;
+
+        const EGLint configAttributes[] = {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+            EGL_RED_SIZE, 8,
+            EGL_GREEN_SIZE, 8,
+            EGL_BLUE_SIZE, 8,
+            EGL_DEPTH_SIZE, 16,
+            EGL_NONE
+        };
+        EGLConfig config;
+        EGLint configCount = 0;
+        if (!eglChooseConfig(display, configAttributes, &config, 1,
+                             &configCount) || configCount == 0)
+            return false;
+
+        const EGLint contextAttributes[] = {
+            EGL_CONTEXT_CLIENT_VERSION, 2,
+            EGL_NONE
+        };
+        eglBindAPI(EGL_OPENGL_ES_API);
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT,
+                                   contextAttributes);
+        if (context == EGL_NO_CONTEXT)
+            return false;
+
+        const EGLint surfaceAttributes[] = {
+            EGL_WIDTH, width,
+            EGL_HEIGHT, height,
+            EGL_NONE
+        };
+        surface = eglCreatePbufferSurface(display, config, surfaceAttributes);
+        if (surface == EGL_NO_SURFACE ||
+            !eglMakeCurrent(display, surface, surface, context)) {
+            eglDestroyContext(display, context);
+            context = EGL_NO_CONTEXT;
+            return false;
+        }
+        surfaceWidth = width;
+        surfaceHeight = height;
+    }
+
+    if (width != surfaceWidth || height != surfaceHeight)
+        return false;
+    glClearColor(0, 0, 0, 1);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    return true;
+}
+
+void ReadTestPixels(int width, int height, vector<unsigned char>& pixels)
+{
+    // RGBA is the one format every implementation reads back.
+    vector<unsigned char> rgba(width * height * 4);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, &rgba[0]);
+    pixels.resize(width * height * 3);
+    for (int i = 0; i < width * height; i++)
+        for (int c = 0; c < 3; c++)
+            pixels[i * 3 + c] = rgba[i * 4 + c];
+}
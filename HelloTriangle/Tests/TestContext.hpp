@@ -0,0 +1,14 @@
+#pragma once
+#include <vector>
+
+using std::vector;
+
+// Makes an OpenGL ES 2.0 context current on the calling thread, drawing
+// into a width by height pbuffer with a depth buffer, for tests that go
+// through the rendering engine. The context is made on the first call and
+// kept; later calls with the same size only clear it. Returns false when
+// the system offers no EGL display or configuration, and the test skips.
+bool MakeTestContext(int width, int height);
+
+// The red, green and blue bytes of every pixel drawn, bottom row first.
+void ReadTestPixels(int width, int height, vector<unsigned char>& pixels);
@@ -0,0 +1,84 @@
+#pragma once
+#include "../Classes/ParametricEquations.hpp"
+
+// A copy of one of the parametric surfaces with its grid made divisions
+// columns by divisions rows, for tests that need finer meshes than the
+// ones the application shows.
+template <typename Surface>
+class Resampled : public Surface {
+public:
+    Resampled(const Surface& surface, int divisions) : Surface(surface)
+    {
+        ParametricInterval interval = this->GetInterval();
+        interval.Divisions = ivec2(divisions, divisions);
+        interval.Columns.clear();
+        interval.Rows.clear();
+        this->SetInterval(interval);
+    }
+
+    using Surface::GetInterval;
+    bool IsInverted(const vec2& domain) const
+    {
+        return this->InvertNormal(domain);
+    }
+};
+
+// Calls a surface's scalar Evaluate through ParametricSurface's vtable,
+// with or without its EvaluateWithDerivatives, and none of its batch or
+// lattice versions. The mesher's two ways of finding normals can then be
+// compared on the same equation.
+template <typename Surface>
+class ScalarSurface : public ParametricSurface {
+public:
+    ScalarSurface(const Resampled<Surface>& surface, bool derivatives) :
+        m_surface(surface),
+        m_derivatives(derivatives)
+    {
+        SetInterval(surface.GetInterval());
+    }
+
+protected:
+    vec3 Evaluate(const vec2& domain) const
+    {
+        return m_surface.Evaluate(domain);
+    }
+    bool EvaluateWithDerivatives(const vec2& domain, vec3& range,
+                                 vec3& dx, vec3& dy) const
+    {
+        return m_derivatives &&
+               m_surface.EvaluateWithDerivatives(domain, range, dx, dy);
+    }
+    bool InvertNormal(const vec2& domain) const
+    {
+        return m_surface.IsInverted(domain);
+    }
+
+private:
+    Resampled<Surface> m_surface;
+    bool m_derivatives;
+};
+
+// The same surface with its lattice hidden, so that the mesher takes the
+// sines and cosines at every point with the batch functions. Generate it
+// with ParametricMesher<Unlatticed<Surface>, Flags>; GenerateVertices
+// goes back to the surface's own mesher.
+template <typename Surface>
+class Unlatticed : public Resampled<Surface> {
+public:
+    Unlatticed(const Resampled<Surface>& surface) :
+        Resampled<Surface>(surface) {}
+    bool GetLatticeAngles(LatticeAngles& angles) const { return false; }
+};
+
+// A copy of one of the parametric surfaces with its grid placed by
+// SetChordalTolerance, and its interval in view to measure the result.
+template <typename Surface>
+class Adaptive : public Surface {
+public:
+    Adaptive(const Surface& surface, float tolerance) : Surface(surface)
+    {
+        this->SetChordalTolerance(tolerance);
+    }
+
+    using Surface::GetInterval;
+};
@@ -0,0 +1,82 @@
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <vector>
+
+#include "Test.hpp"
+
+using std::vector;
+
+struct TestCase {
+    const char* Name;
+    TestFunction Function;
+    bool Benchmark;
+};
+
+// A function-local static, so that registering from static initializers
+// in other files does not depend on their order.
+static vector<TestCase>& GetTests()
+{
+    static vector<TestCase> tests;
+    return tests;
+}
+
+static int s_failures;
+
+int RegisterTest(const char* name, TestFunction function, bool benchmark)
+{
+    TestCase test = { name, function, benchmark };
+    GetTests().push_back(test);
+    return (int) GetTests().size();
+}
+
+void ReportFailure(const char* file, int line, const char* expression)
+{
+    printf("    %s(%d): CHECK(%s) failed\n", file, line, expression);
+    ++s_failures;
+}
+
+double GetSeconds()
+{
+    typedef std::chrono::high_resolution_clock Clock;
+    return std::chrono::duration<double>(
+        Clock::now().time_since_epoch()).count();
+}
+
+string GetScratchPath(const string& name)
+{
+    return "Test" + name;
+}
+
+string GetModelPath(const string& name)
+{
+    return "Models/" + name;
+}
+
+int main(int argc, char* argv[])
+{
+    bool benchmarks = argc > 1 && strcmp(argv[1], "bench") == 0;
+    const char* filter = argc > (benchmarks ? 2 : 1) ?
+                         argv[benchmarks ? 2 : 1] : "";
+
+    int failedTests = 0;
+    int testCount = 0;
+    const vector<TestCase>& tests = GetTests();
+    for (size_t i = 0; i < tests.size(); i++) {
+        const TestCase& test = tests[i];
+        if (test.Benchmark != benchmarks || !strstr(test.Name, filter))
+            continue;
+
+        printf("%s\n", test.Name);
+        fflush(stdout);
+        int failures = s_failures;
+        test.Function();
+        if (s_failures != failures)
+            ++failedTests;
+        ++testCount;
+    }
+
+    printf("%d of %d %s failed\n", failedTests, testCount,
+           benchmarks ? "benchmarks" : "tests");
+    return failedTests;
+}